@@ -0,0 +1,86 @@
+#ifndef _MIVE_ESPNOW_PROTO_H
+#define _MIVE_ESPNOW_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ESP-NOW command protocol between the remote and the garage.
+//
+// The remote sends a COMMAND frame for every button press and repeats the
+// same frame until the matching ACK comes back or the deadline passes.
+// seq numbers the presses of one boot, counter is the boot number of the
+// remote and never goes down. The garage keeps the last (counter, seq) it
+// carried out, answers repeats of it with the stored ACK and drops anything
+// older, so a press actuates the door once no matter how many copies arrive.
+
+#define MIVE_ESPNOW_MAGIC 0x494d4556
+#define MIVE_ESPNOW_VERSION 1
+
+// Remote retry policy.
+#define MIVE_ESPNOW_RETRY_MS 40
+#define MIVE_ESPNOW_DEADLINE_MS 1000
+
+enum mive_espnow_type_e
+{
+  MIVE_ESPNOW_TYPE_COMMAND = 1,
+  MIVE_ESPNOW_TYPE_ACK,
+};
+
+// Same values as enum mive_garage_command_e on the garage.
+enum mive_espnow_command_e
+{
+  MIVE_ESPNOW_CMD_TOGGLE = 0,
+  MIVE_ESPNOW_CMD_OPEN,
+  MIVE_ESPNOW_CMD_CLOSE,
+  MIVE_ESPNOW_CMD_STOP,
+};
+
+enum mive_espnow_result_e
+{
+  // Relay pulsed, state is where the door is headed.
+  MIVE_ESPNOW_RESULT_ACTUATED = 0,
+  // Command doesn't apply in the current state, state is unchanged.
+  MIVE_ESPNOW_RESULT_NOT_APPLICABLE,
+  // Garage couldn't queue the command, retrying may work.
+  MIVE_ESPNOW_RESULT_BUSY,
+};
+
+typedef struct __attribute__((packed)) mive_espnow_frame_s
+{
+  uint32_t magic;
+  uint8_t version;
+  // enum mive_espnow_type_e
+  uint8_t type;
+  // enum mive_espnow_command_e, echoed in the ACK.
+  uint8_t command;
+  // ACK only, enum mive_espnow_result_e.
+  uint8_t result;
+  // Remote boot number.
+  uint32_t counter;
+  uint16_t seq;
+  // ACK only, enum garage_state_e on the garage.
+  uint8_t state;
+  // Transmission number of the COMMAND this answers, 0 for the first one.
+  uint8_t attempt;
+} mive_espnow_frame_t;
+
+// Checks magic, version and length, copies the frame out of the radio buffer.
+static inline bool mive_espnow_frame_parse(const uint8_t* data, int len, mive_espnow_frame_t* frame)
+{
+  if(len != (int)sizeof(*frame))
+  {
+    return false;
+  }
+
+  memcpy(frame, data, sizeof(*frame));
+  return frame->magic == MIVE_ESPNOW_MAGIC && frame->version == MIVE_ESPNOW_VERSION;
+}
+
+// Whether seq a comes after seq b, survives the 16 bit wrap.
+static inline bool mive_espnow_seq_after(uint16_t a, uint16_t b)
+{
+  return (int16_t)(a - b) > 0;
+}
+
+#endif // _MIVE_ESPNOW_PROTO_H
\ No newline at end of file
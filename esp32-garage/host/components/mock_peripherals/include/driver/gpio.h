@@ -0,0 +1,11 @@
+#ifndef _MOCK_GPIO_H
+#define _MOCK_GPIO_H
+
+typedef enum
+{
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_0 = 0,
+  GPIO_NUM_MAX = 40,
+} gpio_num_t;
+
+#endif // _MOCK_GPIO_H
\ No newline at end of file
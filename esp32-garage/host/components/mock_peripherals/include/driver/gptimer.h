@@ -0,0 +1,7 @@
+#ifndef _MOCK_GPTIMER_H
+#define _MOCK_GPTIMER_H
+
+// Handle type only, ranging is replaced as a whole on the host.
+typedef struct mock_gptimer_s* gptimer_handle_t;
+
+#endif // _MOCK_GPTIMER_H
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef _MOCK_I2C_MASTER_H
+#define _MOCK_I2C_MASTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Just enough of the ESP-IDF I2C master API for garage.c, the device on the
+// other end is simulated in mock_i2c.c.
+
+typedef struct mock_i2c_bus_s* i2c_master_bus_handle_t;
+typedef struct mock_i2c_dev_s* i2c_master_dev_handle_t;
+
+typedef int i2c_port_num_t;
+
+typedef enum
+{
+  I2C_CLK_SRC_DEFAULT = 0,
+} i2c_clock_source_t;
+
+typedef enum
+{
+  I2C_ADDR_BIT_LEN_7 = 0,
+  I2C_ADDR_BIT_LEN_10,
+} i2c_addr_bit_len_t;
+
+typedef struct
+{
+  i2c_port_num_t i2c_port;
+  int sda_io_num;
+  int scl_io_num;
+  i2c_clock_source_t clk_source;
+  uint8_t glitch_ignore_cnt;
+  int intr_priority;
+  size_t trans_queue_depth;
+  struct {
+    uint32_t enable_internal_pullup : 1;
+  } flags;
+} i2c_master_bus_config_t;
+
+typedef struct
+{
+  i2c_addr_bit_len_t dev_addr_length;
+  uint16_t device_address;
+  uint32_t scl_speed_hz;
+} i2c_device_config_t;
+
+typedef enum
+{
+  I2C_EVENT_ALIVE = 0,
+  I2C_EVENT_DONE,
+  I2C_EVENT_NACK,
+  I2C_EVENT_TIMEOUT,
+} i2c_master_event_t;
+
+typedef struct
+{
+  i2c_master_event_t event;
+} i2c_master_event_data_t;
+
+typedef bool (*i2c_master_callback_t)(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_data_t* evt_data, void* arg);
+
+typedef struct
+{
+  i2c_master_callback_t on_trans_done;
+} i2c_master_event_callbacks_t;
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t* bus_config, i2c_master_bus_handle_t* ret_bus_handle);
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus_handle);
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle, const i2c_device_config_t* dev_config, i2c_master_dev_handle_t* ret_handle);
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t handle);
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev, const uint8_t* write_buffer, size_t write_size, int xfer_timeout_ms);
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t i2c_dev, const uint8_t* write_buffer, size_t write_size, uint8_t* read_buffer, size_t read_size, int xfer_timeout_ms);
+// Once registered, transfers on the device complete from an esp_timer after
+// the configured latency instead of on the calling task.
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_callbacks_t* cbs, void* user_data);
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t bus_handle);
+// Gives up with ESP_ERR_TIMEOUT while a transfer hangs, see mock_i2c_hang_next.
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus_handle, int timeout_ms);
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t i2c_dev, uint8_t* read_buffer, size_t read_size, int xfer_timeout_ms);
+
+#endif // _MOCK_I2C_MASTER_H
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef _MOCK_MCPWM_CAP_H
+#define _MOCK_MCPWM_CAP_H
+
+// Handle types only, ranging is replaced as a whole on the host.
+typedef struct mock_mcpwm_cap_timer_s* mcpwm_cap_timer_handle_t;
+typedef struct mock_mcpwm_cap_channel_s* mcpwm_cap_channel_handle_t;
+
+#endif // _MOCK_MCPWM_CAP_H
\ No newline at end of file
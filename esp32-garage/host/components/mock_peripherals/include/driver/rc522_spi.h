@@ -0,0 +1,6 @@
+#ifndef _MOCK_RC522_SPI_H
+#define _MOCK_RC522_SPI_H
+
+#include "rc522.h"
+
+#endif // _MOCK_RC522_SPI_H
\ No newline at end of file
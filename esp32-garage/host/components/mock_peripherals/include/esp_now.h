@@ -0,0 +1,15 @@
+#ifndef _MOCK_ESP_NOW_H
+#define _MOCK_ESP_NOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Only what the garage sends with, frames end up in mock_espnow.c.
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
+
+esp_err_t esp_now_send(const uint8_t* peer_addr, const uint8_t* data, size_t len);
+
+#endif // _MOCK_ESP_NOW_H
\ No newline at end of file
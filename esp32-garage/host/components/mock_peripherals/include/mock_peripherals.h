@@ -0,0 +1,62 @@
+#ifndef _MOCK_PERIPHERALS_H
+#define _MOCK_PERIPHERALS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Knobs and probes for the mocked drivers.
+
+// ==== I2C, the ATmega door controller ====
+
+// Door state register as read by mive_garage_read_async (enum garage_state_e).
+void mock_i2c_set_door_state(uint8_t state);
+uint8_t mock_i2c_get_door_state(void);
+// Polls a moving door takes to reach its end position.
+void mock_i2c_set_travel_polls(uint32_t polls);
+// Time every transfer takes, 100 kHz makes ~300 us for a 2 byte write.
+void mock_i2c_set_latency_us(uint32_t latency_us);
+// Relay pulses since boot.
+uint32_t mock_i2c_get_actuations(void);
+// The next count transfers get NACKed, like a wedged ATmega would.
+void mock_i2c_fail_next(uint32_t count);
+// The next count transfers never complete, the ones queued behind them wait
+// too, until the bus is deleted. A driver that lost an interrupt.
+void mock_i2c_hang_next(uint32_t count);
+// i2c_master_bus_reset calls since boot.
+uint32_t mock_i2c_get_bus_resets(void);
+
+// ==== MQTT ====
+
+// Reports MQTT_EVENT_CONNECTED / MQTT_EVENT_DISCONNECTED to the registered handler.
+void mock_mqtt_connect(void);
+void mock_mqtt_disconnect(void);
+// Delivers a message as MQTT_EVENT_DATA, split into chunk sized fragments
+// (0 for a single one). Runs the handler on the calling task like the client task would.
+void mock_mqtt_inject(const char* topic, const char* data, size_t len, size_t chunk, bool retain);
+uint32_t mock_mqtt_get_publish_count(void);
+// esp_mqtt_client_enqueue calls, the outbox flush uses those.
+uint32_t mock_mqtt_get_enqueue_count(void);
+uint32_t mock_mqtt_get_subscribe_count(void);
+// Every esp_mqtt_client_publish blocks this long, a broker that can't keep up.
+void mock_mqtt_set_publish_delay_ms(uint32_t delay_ms);
+// Sees every esp_mqtt_client_publish payload, on the publishing task.
+typedef void (*mock_mqtt_publish_cb_t)(const char* topic, const char* data, int len, void* arg);
+void mock_mqtt_set_publish_cb(mock_mqtt_publish_cb_t cb, void* arg);
+
+// ==== RC522 ====
+
+// Holds a card to the reader and takes it away again.
+// Taps are delivered whether the reader is paused or not, so the control
+// logic can be driven without waiting for a scan window.
+void mock_rc522_tap(const uint8_t* uid, uint8_t uid_len);
+// Reader polling, as last set by rc522_start / rc522_pause.
+bool mock_rc522_is_scanning(void);
+
+// ==== ESP-NOW ====
+
+// Frames the garage sent (ACKs) since boot, and a copy of the last one.
+uint32_t mock_espnow_get_sent_count(void);
+size_t mock_espnow_get_last_sent(uint8_t* buf, size_t len);
+
+#endif // _MOCK_PERIPHERALS_H
\ No newline at end of file
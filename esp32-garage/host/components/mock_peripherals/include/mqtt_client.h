@@ -0,0 +1,81 @@
+#ifndef _MOCK_MQTT_CLIENT_H
+#define _MOCK_MQTT_CLIENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+// Subset of the esp-mqtt client API. Nothing goes on the wire, publishes are
+// counted and incoming messages are injected with mock_mqtt_inject().
+
+typedef struct mock_mqtt_client_s* esp_mqtt_client_handle_t;
+
+typedef enum
+{
+  MQTT_EVENT_ANY = -1,
+  MQTT_EVENT_ERROR = 0,
+  MQTT_EVENT_CONNECTED,
+  MQTT_EVENT_DISCONNECTED,
+  MQTT_EVENT_SUBSCRIBED,
+  MQTT_EVENT_UNSUBSCRIBED,
+  MQTT_EVENT_PUBLISHED,
+  MQTT_EVENT_DATA,
+  MQTT_EVENT_BEFORE_CONNECT,
+  MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef enum
+{
+  MQTT_ERROR_TYPE_NONE = 0,
+  MQTT_ERROR_TYPE_TCP_TRANSPORT,
+  MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+} esp_mqtt_error_type_t;
+
+typedef struct
+{
+  esp_err_t esp_tls_last_esp_err;
+  int esp_tls_stack_err;
+  int esp_tls_cert_verify_flags;
+  esp_mqtt_error_type_t error_type;
+  int connect_return_code;
+  int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+
+typedef struct
+{
+  esp_mqtt_event_id_t event_id;
+  esp_mqtt_client_handle_t client;
+  char* data;
+  int data_len;
+  int total_data_len;
+  int current_data_offset;
+  char* topic;
+  int topic_len;
+  int msg_id;
+  int session_present;
+  esp_mqtt_error_codes_t* error_handle;
+  bool retain;
+  int qos;
+  bool dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t* esp_mqtt_event_handle_t;
+
+typedef struct
+{
+  struct {
+    struct {
+      const char* uri;
+    } address;
+  } broker;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void* event_handler_arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain);
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain, bool store);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos);
+
+#endif // _MOCK_MQTT_CLIENT_H
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef _MOCK_RC522_H
+#define _MOCK_RC522_H
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+// Subset of the abobija/rc522 API, cards are presented with mock_rc522_tap().
+
+typedef struct mock_rc522_driver_s* rc522_driver_handle_t;
+typedef struct mock_rc522_s* rc522_handle_t;
+
+typedef enum
+{
+  RC522_EVENT_ANY = -1,
+  RC522_EVENT_NONE,
+  RC522_EVENT_PICC_STATE_CHANGED,
+} rc522_event_t;
+
+typedef struct
+{
+  rc522_driver_handle_t driver;
+  uint32_t poll_interval_ms;
+} rc522_config_t;
+
+esp_err_t rc522_create(const rc522_config_t* config, rc522_handle_t* out_rc522);
+esp_err_t rc522_register_events(rc522_handle_t rc522, rc522_event_t event, esp_event_handler_t event_handler, void* event_handler_arg);
+esp_err_t rc522_start(rc522_handle_t rc522);
+esp_err_t rc522_pause(rc522_handle_t rc522);
+
+#endif // _MOCK_RC522_H
\ No newline at end of file
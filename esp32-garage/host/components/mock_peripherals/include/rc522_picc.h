@@ -0,0 +1,37 @@
+#ifndef _MOCK_RC522_PICC_H
+#define _MOCK_RC522_PICC_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define RC522_PICC_UID_SIZE_MAX 10
+
+typedef enum
+{
+  RC522_PICC_STATE_IDLE = 0,
+  RC522_PICC_STATE_READY,
+  RC522_PICC_STATE_ACTIVE,
+  RC522_PICC_STATE_HALT,
+} rc522_picc_state_t;
+
+typedef struct
+{
+  uint8_t value[RC522_PICC_UID_SIZE_MAX];
+  uint8_t length;
+} rc522_picc_uid_t;
+
+typedef struct
+{
+  rc522_picc_uid_t uid;
+  rc522_picc_state_t state;
+} rc522_picc_t;
+
+typedef struct
+{
+  rc522_picc_t* picc;
+  rc522_picc_state_t old_state;
+} rc522_picc_state_changed_event_t;
+
+esp_err_t rc522_picc_print(const rc522_picc_t* picc);
+
+#endif // _MOCK_RC522_PICC_H
\ No newline at end of file
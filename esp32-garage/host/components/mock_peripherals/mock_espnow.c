@@ -0,0 +1,33 @@
+#include <string.h>
+#include "esp_now.h"
+#include "mock_peripherals.h"
+
+static uint8_t last_frame[ESP_NOW_MAX_DATA_LEN];
+static size_t last_len = 0;
+static uint32_t sent_count = 0;
+
+esp_err_t esp_now_send(const uint8_t* peer_addr, const uint8_t* data, size_t len)
+{
+  if(len > sizeof(last_frame))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memcpy(last_frame, data, len);
+  last_len = len;
+  __atomic_fetch_add(&sent_count, 1, __ATOMIC_RELAXED);
+  return ESP_OK;
+}
+
+uint32_t mock_espnow_get_sent_count(void)
+{
+  return __atomic_load_n(&sent_count, __ATOMIC_RELAXED);
+}
+
+size_t mock_espnow_get_last_sent(uint8_t* buf, size_t len)
+{
+  size_t copy = (last_len < len) ? last_len : len;
+
+  memcpy(buf, last_frame, copy);
+  return copy;
+}
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "driver/i2c_master.h"
+#include "mock_peripherals.h"
+
+// Mirrors enum garage_state_e and the ATmega's single-button behaviour.
+#define DOOR_INVALID 0
+#define DOOR_CLOSED 1
+#define DOOR_CLOSING_STOPPED 2
+#define DOOR_OPEN 3
+#define DOOR_OPENING_STOPPED 4
+#define DOOR_OPENING 5
+#define DOOR_CLOSING 6
+
+// Command bit of the register written by mive_garage_actuate_async.
+#define DOOR_COMMAND_BIT 0x80
+
+struct mock_i2c_bus_s
+{
+  int port;
+};
+
+struct mock_i2c_dev_s
+{
+  uint16_t address;
+  i2c_master_callback_t on_trans_done;
+  void* user_data;
+};
+
+// Transfers waiting for xfer_timer. The caller pushes and the timer pops,
+// one of each, so the indices need no lock.
+#define PENDING_DEPTH 16
+
+struct mock_i2c_xfer_s
+{
+  bool press;
+  uint8_t* read_buffer;
+};
+
+static struct mock_i2c_bus_s mock_bus;
+static struct mock_i2c_dev_s mock_dev;
+
+static uint8_t door_state = DOOR_CLOSED;
+static uint32_t travel_polls = 8;
+static uint32_t travel_left = 0;
+static uint32_t latency_us = 0;
+static uint32_t actuations = 0;
+static uint32_t fail_next = 0;
+static uint32_t hang_next = 0;
+// The transfer at pending_head never completes, everything behind it waits.
+static volatile bool hung = false;
+static uint32_t bus_resets = 0;
+
+static esp_timer_handle_t xfer_timer = NULL;
+static struct mock_i2c_xfer_s pending[PENDING_DEPTH];
+static uint32_t pending_head = 0;
+static uint32_t pending_tail = 0;
+static uint32_t pending_count = 0;
+
+void mock_i2c_set_door_state(uint8_t state)
+{
+  door_state = state;
+  travel_left = travel_polls;
+}
+
+uint8_t mock_i2c_get_door_state(void)
+{
+  return door_state;
+}
+
+void mock_i2c_set_travel_polls(uint32_t polls)
+{
+  travel_polls = polls;
+}
+
+void mock_i2c_set_latency_us(uint32_t us)
+{
+  latency_us = us;
+}
+
+uint32_t mock_i2c_get_actuations(void)
+{
+  return __atomic_load_n(&actuations, __ATOMIC_RELAXED);
+}
+
+void mock_i2c_fail_next(uint32_t count)
+{
+  __atomic_store_n(&fail_next, count, __ATOMIC_RELAXED);
+}
+
+void mock_i2c_hang_next(uint32_t count)
+{
+  __atomic_store_n(&hang_next, count, __ATOMIC_RELAXED);
+}
+
+uint32_t mock_i2c_get_bus_resets(void)
+{
+  return __atomic_load_n(&bus_resets, __ATOMIC_RELAXED);
+}
+
+static void bus_delay(void)
+{
+  if(latency_us > 0)
+  {
+    usleep(latency_us);
+  }
+}
+
+static void door_press(void)
+{
+  switch (door_state)
+  {
+    case DOOR_CLOSED:
+    case DOOR_CLOSING_STOPPED:
+      door_state = DOOR_OPENING;
+      break;
+    case DOOR_OPEN:
+    case DOOR_OPENING_STOPPED:
+      door_state = DOOR_CLOSING;
+      break;
+    case DOOR_OPENING:
+      door_state = DOOR_OPENING_STOPPED;
+      break;
+    case DOOR_CLOSING:
+      door_state = DOOR_CLOSING_STOPPED;
+      break;
+    default:
+      break;
+  }
+  travel_left = travel_polls;
+  __atomic_fetch_add(&actuations, 1, __ATOMIC_RELAXED);
+}
+
+static void door_poll(void)
+{
+  if(door_state != DOOR_OPENING && door_state != DOOR_CLOSING)
+  {
+    return;
+  }
+
+  if(travel_left > 0)
+  {
+    travel_left--;
+    return;
+  }
+
+  door_state = (door_state == DOOR_OPENING) ? DOOR_OPEN : DOOR_CLOSED;
+}
+
+// Whether this transfer gets NACKed instead of reaching the door.
+static bool xfer_fails(void)
+{
+  uint32_t left = __atomic_load_n(&fail_next, __ATOMIC_RELAXED);
+
+  while(left > 0)
+  {
+    if(__atomic_compare_exchange_n(&fail_next, &left, left - 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void xfer_run(bool press, uint8_t* read_buffer)
+{
+  if(press)
+  {
+    door_press();
+    return;
+  }
+
+  door_poll();
+  if(read_buffer != NULL)
+  {
+    read_buffer[0] = door_state;
+  }
+}
+
+static void xfer_timer_callback(void* arg)
+{
+  struct mock_i2c_xfer_s* xfer = &pending[pending_head % PENDING_DEPTH];
+  i2c_master_event_data_t edata = {
+    .event = I2C_EVENT_DONE,
+  };
+
+  if(__atomic_load_n(&pending_count, __ATOMIC_ACQUIRE) == 0)
+  {
+    // Dropped with the bus.
+    return;
+  }
+
+  if(__atomic_load_n(&hang_next, __ATOMIC_RELAXED) > 0)
+  {
+    // Stays at the head without a completion, until the bus is deleted.
+    __atomic_sub_fetch(&hang_next, 1, __ATOMIC_RELAXED);
+    hung = true;
+    return;
+  }
+
+  if(xfer_fails())
+  {
+    edata.event = I2C_EVENT_NACK;
+  }
+  else
+  {
+    xfer_run(xfer->press, xfer->read_buffer);
+  }
+  __atomic_store_n(&pending_head, pending_head + 1, __ATOMIC_RELEASE);
+
+  if(mock_dev.on_trans_done != NULL)
+  {
+    mock_dev.on_trans_done(&mock_dev, &edata, mock_dev.user_data);
+  }
+
+  if(__atomic_sub_fetch(&pending_count, 1, __ATOMIC_ACQ_REL) > 0)
+  {
+    esp_timer_start_once(xfer_timer, latency_us);
+  }
+}
+
+static esp_err_t xfer_queue(bool press, uint8_t* read_buffer)
+{
+  if(pending_tail - __atomic_load_n(&pending_head, __ATOMIC_ACQUIRE) >= PENDING_DEPTH)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  pending[pending_tail % PENDING_DEPTH] = (struct mock_i2c_xfer_s){
+    .press = press,
+    .read_buffer = read_buffer,
+  };
+  pending_tail++;
+
+  if(__atomic_fetch_add(&pending_count, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    esp_timer_start_once(xfer_timer, latency_us);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t* bus_config, i2c_master_bus_handle_t* ret_bus_handle)
+{
+  mock_bus.port = bus_config->i2c_port;
+  *ret_bus_handle = &mock_bus;
+  return ESP_OK;
+}
+
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus_handle)
+{
+  // Whatever was queued goes with the bus, without a completion.
+  if(hung)
+  {
+    __atomic_store_n(&pending_head, pending_tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&pending_count, 0, __ATOMIC_RELEASE);
+    hung = false;
+  }
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus_handle, int timeout_ms)
+{
+  for(int waited_ms = 0; __atomic_load_n(&pending_count, __ATOMIC_ACQUIRE) > 0; ++waited_ms)
+  {
+    if(waited_ms >= timeout_ms)
+    {
+      return ESP_ERR_TIMEOUT;
+    }
+    usleep(1000);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t bus_handle)
+{
+  __atomic_fetch_add(&bus_resets, 1, __ATOMIC_RELAXED);
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle, const i2c_device_config_t* dev_config, i2c_master_dev_handle_t* ret_handle)
+{
+  mock_dev.address = dev_config->device_address;
+  mock_dev.on_trans_done = NULL;
+  *ret_handle = &mock_dev;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t handle)
+{
+  handle->on_trans_done = NULL;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_callbacks_t* cbs, void* user_data)
+{
+  const esp_timer_create_args_t xfer_timer_args = {
+    .callback = xfer_timer_callback,
+    .name = "mock_i2c",
+  };
+
+  if(xfer_timer == NULL && esp_timer_create(&xfer_timer_args, &xfer_timer) != ESP_OK)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+
+  i2c_dev->on_trans_done = cbs->on_trans_done;
+  i2c_dev->user_data = user_data;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev, const uint8_t* write_buffer, size_t write_size, int xfer_timeout_ms)
+{
+  if(i2c_dev == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if(i2c_dev->on_trans_done != NULL)
+  {
+    return xfer_queue(write_size >= 2 && (write_buffer[1] & DOOR_COMMAND_BIT), NULL);
+  }
+
+  bus_delay();
+  if(xfer_fails())
+  {
+    return ESP_FAIL;
+  }
+  xfer_run(write_size >= 2 && (write_buffer[1] & DOOR_COMMAND_BIT), NULL);
+
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t i2c_dev, const uint8_t* write_buffer, size_t write_size, uint8_t* read_buffer, size_t read_size, int xfer_timeout_ms)
+{
+  if(i2c_dev == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if(i2c_dev->on_trans_done != NULL)
+  {
+    return xfer_queue(false, (read_size > 0) ? read_buffer : NULL);
+  }
+
+  bus_delay();
+  if(xfer_fails())
+  {
+    return ESP_FAIL;
+  }
+  xfer_run(false, (read_size > 0) ? read_buffer : NULL);
+
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t i2c_dev, uint8_t* read_buffer, size_t read_size, int xfer_timeout_ms)
+{
+  return i2c_master_transmit_receive(i2c_dev, NULL, 0, read_buffer, read_size, xfer_timeout_ms);
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+#include "mock_peripherals.h"
+
+struct mock_mqtt_client_s
+{
+  esp_event_handler_t handler;
+  void* handler_arg;
+  int next_msg_id;
+};
+
+static struct mock_mqtt_client_s mock_client;
+static uint32_t publish_count = 0;
+static uint32_t subscribe_count = 0;
+static uint32_t enqueue_count = 0;
+static uint32_t publish_delay_ms = 0;
+static mock_mqtt_publish_cb_t publish_cb = NULL;
+static void* publish_cb_arg = NULL;
+
+static void deliver(esp_mqtt_event_t* event)
+{
+  if(mock_client.handler == NULL)
+  {
+    return;
+  }
+
+  event->client = &mock_client;
+  mock_client.handler(mock_client.handler_arg, "MQTT_EVENTS", event->event_id, event);
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config)
+{
+  memset(&mock_client, 0, sizeof(mock_client));
+  mock_client.next_msg_id = 1;
+  return &mock_client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void* event_handler_arg)
+{
+  client->handler = event_handler;
+  client->handler_arg = event_handler_arg;
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+  return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain)
+{
+  uint32_t delay_ms = __atomic_load_n(&publish_delay_ms, __ATOMIC_RELAXED);
+
+  if(delay_ms > 0)
+  {
+    vTaskDelay(pdMS_TO_TICKS(delay_ms));
+  }
+  if(publish_cb != NULL)
+  {
+    publish_cb(topic, data, (len == 0) ? (int)strlen(data) : len, publish_cb_arg);
+  }
+  __atomic_fetch_add(&publish_count, 1, __ATOMIC_RELAXED);
+  return (qos > 0) ? __atomic_fetch_add(&client->next_msg_id, 1, __ATOMIC_RELAXED) : 0;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain, bool store)
+{
+  __atomic_fetch_add(&enqueue_count, 1, __ATOMIC_RELAXED);
+  return (qos > 0) ? __atomic_fetch_add(&client->next_msg_id, 1, __ATOMIC_RELAXED) : 0;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos)
+{
+  __atomic_fetch_add(&subscribe_count, 1, __ATOMIC_RELAXED);
+  return __atomic_fetch_add(&client->next_msg_id, 1, __ATOMIC_RELAXED);
+}
+
+void mock_mqtt_connect(void)
+{
+  esp_mqtt_event_t event = {
+    .event_id = MQTT_EVENT_CONNECTED,
+  };
+  deliver(&event);
+}
+
+void mock_mqtt_disconnect(void)
+{
+  esp_mqtt_event_t event = {
+    .event_id = MQTT_EVENT_DISCONNECTED,
+  };
+  deliver(&event);
+}
+
+void mock_mqtt_inject(const char* topic, const char* data, size_t len, size_t chunk, bool retain)
+{
+  size_t offset = 0;
+
+  if(chunk == 0 || chunk > len)
+  {
+    chunk = len;
+  }
+
+  do
+  {
+    size_t this_len = (len - offset < chunk) ? (len - offset) : chunk;
+    esp_mqtt_event_t event = {
+      .event_id = MQTT_EVENT_DATA,
+      .data = (char*)data + offset,
+      .data_len = this_len,
+      .total_data_len = len,
+      .current_data_offset = offset,
+      // Only the first fragment carries the topic, like the real client.
+      .topic = (offset == 0) ? (char*)topic : NULL,
+      .topic_len = (offset == 0) ? strlen(topic) : 0,
+      .retain = retain,
+    };
+    deliver(&event);
+    offset += this_len;
+  } while(offset < len);
+}
+
+uint32_t mock_mqtt_get_publish_count(void)
+{
+  return __atomic_load_n(&publish_count, __ATOMIC_RELAXED);
+}
+
+uint32_t mock_mqtt_get_enqueue_count(void)
+{
+  return __atomic_load_n(&enqueue_count, __ATOMIC_RELAXED);
+}
+
+uint32_t mock_mqtt_get_subscribe_count(void)
+{
+  return __atomic_load_n(&subscribe_count, __ATOMIC_RELAXED);
+}
+
+void mock_mqtt_set_publish_delay_ms(uint32_t delay_ms)
+{
+  __atomic_store_n(&publish_delay_ms, delay_ms, __ATOMIC_RELAXED);
+}
+
+void mock_mqtt_set_publish_cb(mock_mqtt_publish_cb_t cb, void* arg)
+{
+  publish_cb_arg = arg;
+  publish_cb = cb;
+}
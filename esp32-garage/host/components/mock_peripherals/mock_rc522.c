@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include "rc522.h"
+#include "rc522_picc.h"
+#include "mock_peripherals.h"
+
+struct mock_rc522_s
+{
+  esp_event_handler_t handler;
+  void* handler_arg;
+  bool scanning;
+};
+
+static struct mock_rc522_s mock_scanner;
+
+esp_err_t rc522_create(const rc522_config_t* config, rc522_handle_t* out_rc522)
+{
+  memset(&mock_scanner, 0, sizeof(mock_scanner));
+  *out_rc522 = &mock_scanner;
+  return ESP_OK;
+}
+
+esp_err_t rc522_register_events(rc522_handle_t rc522, rc522_event_t event, esp_event_handler_t event_handler, void* event_handler_arg)
+{
+  rc522->handler = event_handler;
+  rc522->handler_arg = event_handler_arg;
+  return ESP_OK;
+}
+
+esp_err_t rc522_start(rc522_handle_t rc522)
+{
+  rc522->scanning = true;
+  return ESP_OK;
+}
+
+esp_err_t rc522_pause(rc522_handle_t rc522)
+{
+  rc522->scanning = false;
+  return ESP_OK;
+}
+
+bool mock_rc522_is_scanning(void)
+{
+  return mock_scanner.scanning;
+}
+
+esp_err_t rc522_picc_print(const rc522_picc_t* picc)
+{
+  return ESP_OK;
+}
+
+static void picc_set_state(rc522_picc_t* picc, rc522_picc_state_t state)
+{
+  rc522_picc_state_changed_event_t event = {
+    .picc = picc,
+    .old_state = picc->state,
+  };
+
+  picc->state = state;
+  if(mock_scanner.handler != NULL)
+  {
+    mock_scanner.handler(mock_scanner.handler_arg, "RC522_EVENTS", RC522_EVENT_PICC_STATE_CHANGED, &event);
+  }
+}
+
+void mock_rc522_tap(const uint8_t* uid, uint8_t uid_len)
+{
+  rc522_picc_t picc = {0};
+
+  if(uid_len > RC522_PICC_UID_SIZE_MAX)
+  {
+    uid_len = RC522_PICC_UID_SIZE_MAX;
+  }
+  memcpy(picc.uid.value, uid, uid_len);
+  picc.uid.length = uid_len;
+
+  picc_set_state(&picc, RC522_PICC_STATE_ACTIVE);
+  picc_set_state(&picc, RC522_PICC_STATE_IDLE);
+}
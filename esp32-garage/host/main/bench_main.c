@@ -0,0 +1,873 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "include/program.h"
+#include "include/control.h"
+#include "include/event_queue.h"
+#include "include/metrics.h"
+#include "include/nfc.h"
+#include "include/duty.h"
+#include "include/presence.h"
+#include "include/dlog.h"
+#include "include/boot.h"
+#include "mive_espnow_proto.h"
+#include "mock_peripherals.h"
+#include "mock_ranging.h"
+#include "mock_nfc_irq.h"
+
+// Feeds synthetic event storms through the real control logic and reports
+// throughput, lane high-water marks and per-handler latency.
+// Exits with 1 if any check fails, so it can gate CI.
+
+static const char *TAG = "bench";
+
+#define BENCH_EVENTS_PER_STORM 2000
+// History pages, more than the net ring holds.
+#define BENCH_HISTORY_PAGES 10
+// Storm producers yield after this many events to let the queue drain a bit.
+#define BENCH_BURST 16
+#define BENCH_MAX_DISTANCE_CM 300
+// Simulated I2C transfer time.
+#define BENCH_I2C_LATENCY_US 300
+
+// Regression limit. Host timings are looser than on the board, this only
+// catches handlers that got dramatically slower.
+#define BENCH_MAX_HANDLER_P99_US 5000
+
+#define BENCH_CONTROL_PRIO 15
+// Producers outrank main_task so bursts really pile up in the queue.
+#define BENCH_PRODUCER_PRIO 16
+
+static const uint8_t known_card[] = {0xde, 0xad, 0xbe, 0xef};
+static const uint8_t unknown_card[] = {0x01, 0x02, 0x03, 0x04};
+static const uint8_t new_card[] = {0x0a, 0x0b, 0x0c, 0x0d};
+static const uint8_t remote_mac[] = {0xe8, 0x6b, 0xea, 0xfb, 0x47, 0xe8};
+static const uint8_t stranger_mac[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+// Remote boot number, bumped by every storm so its presses never look stale.
+static uint32_t remote_counter = 1;
+
+static const char* event_name[] = {
+  [MIVE_EVENT_NONE] = "NONE",
+  [MIVE_EVENT_GET_GARAGE_INFO] = "GET_GARAGE_INFO",
+  [MIVE_EVENT_SEND_GARAGE_INFO] = "SEND_GARAGE_INFO",
+  [MIVE_EVENT_SEND_AUTH_STATE] = "SEND_AUTH_STATE",
+  [MIVE_EVENT_START_GARAGE] = "START_GARAGE",
+  [MIVE_EVENT_MEASURE_DISTANCE] = "MEASURE_DISTANCE",
+  [MIVE_EVENT_REGISTER_CARD] = "REGISTER_CARD",
+  [MIVE_EVENT_MQTT_CONNECTED] = "MQTT_CONNECTED",
+  [MIVE_EVENT_SAVE_UUID] = "SAVE_UUID",
+  [MIVE_EVENT_RESET_GARAGE_SWITCH] = "RESET_GARAGE_SWITCH",
+  [MIVE_EVENT_DISTANCE_READY] = "DISTANCE_READY",
+  [MIVE_EVENT_SEND_PRESENCE] = "SEND_PRESENCE",
+  [MIVE_EVENT_SEND_STATE_DOC] = "SEND_STATE_DOC",
+  [MIVE_EVENT_PUBLISH_METRICS] = "PUBLISH_METRICS",
+  [MIVE_EVENT_DUMP_TRACE] = "DUMP_TRACE",
+  [MIVE_EVENT_NFC_DUTY] = "NFC_DUTY",
+  [MIVE_EVENT_NFC_FIELD] = "NFC_FIELD",
+  [MIVE_EVENT_GARAGE_DONE] = "GARAGE_DONE",
+  [MIVE_EVENT_CARD_REJECTED] = "CARD_REJECTED",
+  [MIVE_EVENT_HISTORY_FLUSH] = "HISTORY_FLUSH",
+  [MIVE_EVENT_HISTORY_QUERY] = "HISTORY_QUERY",
+  [MIVE_EVENT_ENROLL_CARD] = "ENROLL_CARD",
+  [MIVE_EVENT_CARD_REMOVED] = "CARD_REMOVED",
+  [MIVE_EVENT_NET_DRAINED] = "NET_DRAINED",
+  [MIVE_EVENT_CHECK_CARD] = "CHECK_CARD",
+  [MIVE_EVENT_LOAD_CREDENTIALS] = "LOAD_CREDENTIALS",
+};
+
+#define BENCH_EVENT_TYPES (sizeof(event_name) / sizeof(event_name[0]))
+
+struct bench_stats
+{
+  mive_histogram_t handler[BENCH_EVENT_TYPES];
+  mive_histogram_t queue[BENCH_EVENT_TYPES];
+  uint32_t handled;
+};
+
+static mive_program_t* program = NULL;
+static struct bench_stats stats;
+static int failures = 0;
+
+typedef void (*bench_storm_fn_t)(uint32_t index);
+
+static void bench_dispatch(mive_event_t* event)
+{
+  int64_t dequeued_us = esp_timer_get_time();
+  unsigned int event_type = event->event_type;
+
+  program->metrics.current_source = event->source;
+
+  mive_control_handle_event(program, event);
+
+  if(event_type < BENCH_EVENT_TYPES)
+  {
+    mive_histogram_add(&stats.queue[event_type], dequeued_us - event->enqueued_us);
+    mive_histogram_add(&stats.handler[event_type], esp_timer_get_time() - dequeued_us);
+  }
+  __atomic_fetch_add(&stats.handled, 1, __ATOMIC_RELAXED);
+}
+
+// Same as mive_control_run, plus per event type timing.
+static void bench_control_task(void* context)
+{
+  mive_event_t event = {0};
+
+  mive_control_init(program, BENCH_MAX_DISTANCE_CM);
+
+  while(1)
+  {
+    while(mive_control_take_due(program, &event))
+    {
+      bench_dispatch(&event);
+    }
+
+    if(mive_event_queue_receive(&program->main_queue, &event, mive_control_timeout(program)) == pdTRUE)
+    {
+      bench_dispatch(&event);
+    }
+  }
+}
+
+static void bench_check(bool ok, const char* what)
+{
+  if(!ok)
+  {
+    ESP_LOGE(TAG, "FAIL: %s", what);
+    failures++;
+  }
+}
+
+// Waits until every lane is empty and nothing was handled for a while.
+static void bench_wait_idle(bool net)
+{
+  struct mive_event_lane_stats lane_stats;
+  uint32_t handled = 0;
+  bool busy = true;
+
+  while(busy)
+  {
+    handled = __atomic_load_n(&stats.handled, __ATOMIC_RELAXED);
+    vTaskDelay(pdMS_TO_TICKS(20));
+
+    busy = (handled != __atomic_load_n(&stats.handled, __ATOMIC_RELAXED));
+    for(uint32_t lane = 0; lane < MIVE_LANE_MAX; ++lane)
+    {
+      mive_event_queue_get_stats(&program->main_queue, lane, &lane_stats);
+      busy |= (lane_stats.depth != 0);
+    }
+    busy |= (net && mive_net_pending(&program->net) != 0);
+  }
+}
+
+// main_task is idle, the net task may still be publishing.
+static void bench_drain_queue(void)
+{
+  bench_wait_idle(false);
+}
+
+// main_task is idle and everything it published is out.
+static void bench_drain(void)
+{
+  bench_wait_idle(true);
+}
+
+static void bench_report(const char* name, int64_t elapsed_us, struct mive_event_lane_stats* before)
+{
+  struct mive_event_lane_stats lane_stats;
+
+  printf("\n== %s: %lu events in %.1f ms, %.0f events/s\n", name, (unsigned long)stats.handled, elapsed_us / 1000.0,
+    stats.handled * 1e6 / (elapsed_us > 0 ? elapsed_us : 1));
+
+  printf("%-14s %9s %9s %9s %9s\n", "lane", "high_water", "sent", "dropped", "coalesced");
+  for(uint32_t lane = 0; lane < MIVE_LANE_MAX; ++lane)
+  {
+    mive_event_queue_get_stats(&program->main_queue, lane, &lane_stats);
+    // Storms overload the lanes on purpose, drops are reported but not a failure.
+    printf("%-14lu %9lu %9lu %9lu %9lu\n", (unsigned long)lane, (unsigned long)lane_stats.high_water,
+      (unsigned long)(lane_stats.sent - before[lane].sent), (unsigned long)(lane_stats.dropped - before[lane].dropped),
+      (unsigned long)(lane_stats.coalesced - before[lane].coalesced));
+  }
+
+  printf("%-20s %7s %9s %9s %9s %9s\n", "handler", "count", "queue_p99", "p50_us", "p99_us", "max_us");
+  for(uint32_t type = 0; type < BENCH_EVENT_TYPES; ++type)
+  {
+    mive_histogram_t* hist = &stats.handler[type];
+    uint32_t p99 = mive_histogram_percentile(hist, 99);
+
+    if(hist->count == 0)
+    {
+      continue;
+    }
+
+    printf("%-20s %7lu %9lu %9lu %9lu %9lu\n", event_name[type], (unsigned long)hist->count,
+      (unsigned long)mive_histogram_percentile(&stats.queue[type], 99), (unsigned long)mive_histogram_percentile(hist, 50),
+      (unsigned long)p99, (unsigned long)hist->max_us);
+    bench_check(p99 <= BENCH_MAX_HANDLER_P99_US, event_name[type]);
+  }
+}
+
+static void bench_storm(const char* name, bench_storm_fn_t storm)
+{
+  struct mive_event_lane_stats before[MIVE_LANE_MAX];
+  int64_t start_us = 0;
+
+  bench_drain();
+  memset(&stats, 0, sizeof(stats));
+  for(uint32_t lane = 0; lane < MIVE_LANE_MAX; ++lane)
+  {
+    mive_event_queue_get_stats(&program->main_queue, lane, &before[lane]);
+  }
+
+  vTaskPrioritySet(NULL, BENCH_PRODUCER_PRIO);
+  start_us = esp_timer_get_time();
+  for(uint32_t i = 0; i < BENCH_EVENTS_PER_STORM; ++i)
+  {
+    storm(i);
+    if((i % BENCH_BURST) == BENCH_BURST - 1)
+    {
+      vTaskDelay(1);
+    }
+  }
+  vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+  bench_drain();
+
+  bench_report(name, esp_timer_get_time() - start_us, before);
+}
+
+// ==== Storms ====
+
+static void storm_mqtt_commands(uint32_t index)
+{
+  static const char* commands[] = {"OPEN", "STOP", "CLOSE", " toggle ", "STOP"};
+  const char* command = commands[index % (sizeof(commands) / sizeof(commands[0]))];
+
+  // Every fourth message arrives in fragments to exercise the streaming parser.
+  mock_mqtt_inject("/garage/door/1/set", command, strlen(command), (index % 4 == 0) ? 2 : 0, false);
+}
+
+static void storm_nfc_taps(uint32_t index)
+{
+  if(index % 2)
+  {
+    mock_rc522_tap(known_card, sizeof(known_card));
+  }
+  else
+  {
+    mock_rc522_tap(unknown_card, sizeof(unknown_card));
+  }
+}
+
+static void bench_espnow_press(uint16_t seq, uint8_t attempt)
+{
+  mive_espnow_frame_t frame = {
+    .magic = MIVE_ESPNOW_MAGIC,
+    .version = MIVE_ESPNOW_VERSION,
+    .type = MIVE_ESPNOW_TYPE_COMMAND,
+    .command = MIVE_ESPNOW_CMD_TOGGLE,
+    .counter = remote_counter,
+    .seq = seq,
+    .attempt = attempt,
+  };
+
+  mive_control_espnow_received(program, remote_mac, (uint8_t*)&frame, sizeof(frame));
+}
+
+static void storm_espnow(uint32_t index)
+{
+  if(index == 0)
+  {
+    remote_counter++;
+  }
+
+  // Every other press gets retransmitted once, like a lost ACK would cause.
+  bench_espnow_press(index / 2 + 1, index % 2);
+}
+
+static void storm_telemetry(uint32_t index)
+{
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_MEASURE_DISTANCE,
+    .source = MIVE_SOURCE_TIMER,
+  };
+
+  // Car slowly pulling in, with the odd glitch.
+  mock_ranging_set_distance((index % 50 == 0) ? 0 : 250 - (index % 200));
+  mive_event_queue_send(&program->main_queue, &event, 0);
+}
+
+static void storm_mixed(uint32_t index)
+{
+  switch (index % 4)
+  {
+    case 0:
+      storm_mqtt_commands(index / 4);
+      break;
+    case 1:
+      storm_nfc_taps(index / 4);
+      break;
+    case 2:
+      storm_espnow(index / 4);
+      break;
+    default:
+      storm_telemetry(index / 4);
+      break;
+  }
+}
+
+// ==== Functional checks ====
+
+static void bench_wait_door_settled(void)
+{
+  for(uint32_t i = 0; i < 100; ++i)
+  {
+    uint8_t state = mock_i2c_get_door_state();
+    if(state != GARAGE_OPENING && state != GARAGE_CLOSING && program->garage_state == state)
+    {
+      return;
+    }
+    vTaskDelay(pdMS_TO_TICKS(50));
+  }
+}
+
+static uint32_t bench_total_drops(void)
+{
+  struct mive_event_lane_stats lane_stats;
+  uint32_t dropped = 0;
+
+  for(uint32_t lane = 0; lane < MIVE_LANE_MAX; ++lane)
+  {
+    mive_event_queue_get_stats(&program->main_queue, lane, &lane_stats);
+    dropped += lane_stats.dropped;
+  }
+
+  return dropped;
+}
+
+// History replies as the broker got them, filled in on the net task.
+static struct
+{
+  uint32_t replies;
+  uint32_t records;
+  uint32_t first_seq;
+  uint32_t last_seq;
+  // header.next of the last reply, the next page starts there.
+  uint32_t cursor;
+  // A reply with next 0 came, the query is over.
+  bool done;
+  bool broken;
+} history_replies;
+
+static void bench_on_publish(const char* topic, const char* data, int len, void* arg)
+{
+  const mive_history_header_t* header = (const mive_history_header_t*)data;
+  const mive_history_record_t* records = (const mive_history_record_t*)(data + sizeof(*header));
+
+  if(strcmp(topic, MQTT_HISTORY_PATH) != 0)
+  {
+    return;
+  }
+
+  if(len < (int)sizeof(*header) || header->magic != MIVE_HISTORY_MAGIC || history_replies.done ||
+     len != (int)(sizeof(*header) + header->count * sizeof(*records)))
+  {
+    history_replies.broken = true;
+    return;
+  }
+
+  for(uint32_t i = 0; i < header->count; ++i)
+  {
+    // Oldest first, nothing from before where the previous page ended.
+    if(records[i].seq < history_replies.cursor || (history_replies.records + i > 0 && records[i].seq <= history_replies.last_seq))
+    {
+      history_replies.broken = true;
+    }
+    if(history_replies.records + i == 0)
+    {
+      history_replies.first_seq = records[i].seq;
+    }
+    history_replies.last_seq = records[i].seq;
+  }
+  if(header->next != 0 && (header->next <= history_replies.cursor || (header->count > 0 && header->next <= history_replies.last_seq)))
+  {
+    history_replies.broken = true;
+  }
+
+  history_replies.cursor = header->next;
+  history_replies.done = (header->next == 0);
+  history_replies.replies++;
+  history_replies.records += header->count;
+}
+
+// Rejected cards through main_task, it owns the history.
+static void bench_history_fill(uint32_t count)
+{
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_CARD_REJECTED,
+    .source = MIVE_SOURCE_INTERNAL,
+  };
+
+  for(uint32_t i = 0; i < count; ++i)
+  {
+    bench_check(mive_event_queue_send(&program->main_queue, &event, pdMS_TO_TICKS(100)) == pdTRUE, "history record dropped");
+  }
+  bench_drain_queue();
+}
+
+// Records appended from here on carry a new time_s.
+static void bench_history_wait_second(void)
+{
+  time_t start = time(NULL);
+
+  while(time(NULL) == start)
+  {
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+}
+
+static void bench_history_reset(void)
+{
+  bench_drain();
+  memset(&history_replies, 0, sizeof(history_replies));
+}
+
+// Duty decisions at points in time the bench can't wait for.
+static void bench_duty(void)
+{
+  mive_duty_t duty;
+  mive_presence_t presence;
+  mive_ranging_result_t sample = {
+    .status = MIVE_RANGING_OK,
+  };
+  int64_t start_us = 1000000;
+  int64_t now_us = 0;
+
+  mive_duty_init(&duty, start_us);
+  mive_presence_init(&presence, BENCH_MAX_DISTANCE_CM);
+
+  bench_check(mive_duty_nfc_mode(&duty, &presence, false, false, start_us + 1000) == MIVE_DUTY_FAST, "reader not fast after activity");
+  bench_check(mive_duty_nfc_mode(&duty, &presence, false, false, start_us + MIVE_DUTY_ACTIVE_HOLD_MS * 1000LL) == MIVE_DUTY_SLOW,
+    "reader still fast after the hold");
+  bench_check(mive_duty_nfc_mode(&duty, &presence, true, false, start_us + MIVE_DUTY_QUIET_MS * 1000LL) == MIVE_DUTY_FAST,
+    "reader not fast while the door moves");
+  bench_check(mive_duty_nfc_mode(&duty, &presence, false, true, start_us + MIVE_DUTY_QUIET_MS * 1000LL) == MIVE_DUTY_FAST,
+    "reader not fast during a registration");
+  bench_check(mive_duty_ranging_period_ms(&duty, &presence, false, start_us + MIVE_DUTY_QUIET_MS * 1000LL) == MIVE_DUTY_RANGING_QUIET_PERIOD_MS,
+    "ranging not slowed down in a quiet garage");
+
+  presence.last_motion_us = start_us + MIVE_DUTY_QUIET_MS * 1000LL;
+  bench_check(mive_duty_nfc_mode(&duty, &presence, false, false, presence.last_motion_us + 1000) == MIVE_DUTY_FAST,
+    "reader not fast when something moves in front of the sensor");
+
+  // An empty spot, then a car pulls in: the first sample has to wake
+  // everything up, the state waits for the median to agree.
+  now_us = start_us + 2 * MIVE_DUTY_QUIET_MS * 1000LL;
+  mive_presence_init(&presence, BENCH_MAX_DISTANCE_CM);
+  sample.distance_cm = BENCH_MAX_DISTANCE_CM - 20;
+  for(uint32_t i = 0; i < MIVE_PRESENCE_MEDIAN_WINDOW; ++i)
+  {
+    mive_presence_update(&presence, &sample, now_us - MIVE_DUTY_QUIET_MS * 1000LL);
+  }
+  bench_check(mive_duty_nfc_mode(&duty, &presence, false, false, now_us) == MIVE_DUTY_SLOW, "reader not slow in a quiet garage");
+  sample.distance_cm = MIVE_PRESENCE_OCCUPIED_CM / 2;
+  mive_presence_update(&presence, &sample, now_us);
+  bench_check(mive_duty_nfc_mode(&duty, &presence, false, false, now_us + 1000) == MIVE_DUTY_FAST,
+    "reader not fast after one sample of a car pulling in");
+  bench_check(mive_duty_ranging_period_ms(&duty, &presence, false, now_us + 1000) == MIVE_PRESENCE_FAST_PERIOD_MS,
+    "ranging not fast after one sample of a car pulling in");
+  bench_check(mive_presence_get_state(&presence) == MIVE_PRESENCE_VACANT, "state changed on a single sample");
+}
+
+static void bench_functional(void)
+{
+  uint32_t actuations = 0;
+  uint32_t acks = 0;
+  uint32_t publishes = 0;
+  uint32_t enqueued = 0;
+  uint32_t history = 0;
+  uint32_t resets = 0;
+  uint32_t reinits = 0;
+  uint32_t refused = 0;
+  uint32_t first_seq = 0;
+  uint32_t from_s = 0;
+  uint32_t to_s = 0;
+  char query[24];
+  mive_espnow_frame_t ack = {0};
+  mive_espnow_frame_t stranger = {
+    .magic = MIVE_ESPNOW_MAGIC,
+    .version = MIVE_ESPNOW_VERSION,
+    .type = MIVE_ESPNOW_TYPE_COMMAND,
+    .seq = 1,
+  };
+  uint32_t dropped = bench_total_drops();
+
+  mock_i2c_set_door_state(GARAGE_CLOSED);
+  bench_wait_door_settled();
+
+  actuations = mock_i2c_get_actuations();
+  mock_mqtt_inject("/garage/door/1/set", "CLOSE", 5, 0, false);
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations, "CLOSE actuated a closed door");
+
+  mock_mqtt_inject("/garage/door/1/set", "OPEN", 4, 0, true);
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations, "retained OPEN was not ignored");
+
+  mock_mqtt_inject("/garage/door/1/set", "open", 4, 1, false);
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "fragmented OPEN didn't actuate");
+  bench_wait_door_settled();
+  bench_check(mock_i2c_get_door_state() == GARAGE_OPEN, "door didn't end up open");
+
+  actuations = mock_i2c_get_actuations();
+  mock_rc522_tap(unknown_card, sizeof(unknown_card));
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations, "unknown card actuated");
+
+  mock_rc522_tap(known_card, sizeof(known_card));
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "known card didn't actuate");
+  bench_check(program->duty.nfc_mode == MIVE_DUTY_FAST && (MIVE_NFC_IRQ_MODE || mock_rc522_is_scanning()),
+    "reader not fast right after a tap");
+  bench_wait_door_settled();
+
+  // Like a tap right after boot, before the card list came out of NVS.
+  actuations = mock_i2c_get_actuations();
+  program->nfc_loaded = false;
+  mock_rc522_tap(known_card, sizeof(known_card));
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "known card didn't actuate before the list was loaded");
+  bench_check(program->nfc_loaded, "card list not loaded on the first tap");
+  bench_wait_door_settled();
+
+  actuations = mock_i2c_get_actuations();
+  acks = mock_espnow_get_sent_count();
+  bench_espnow_press(1, 0);
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "ESP-NOW press didn't actuate");
+  bench_check(mock_espnow_get_sent_count() == acks + 1, "ESP-NOW press wasn't acknowledged");
+  mock_espnow_get_last_sent((uint8_t*)&ack, sizeof(ack));
+  bench_check(ack.type == MIVE_ESPNOW_TYPE_ACK && ack.seq == 1 && ack.result == MIVE_ESPNOW_RESULT_ACTUATED, "ESP-NOW ACK doesn't match the press");
+
+  bench_espnow_press(1, 1);
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "ESP-NOW retransmission actuated again");
+  bench_check(mock_espnow_get_sent_count() == acks + 2, "ESP-NOW retransmission wasn't acknowledged");
+  mock_espnow_get_last_sent((uint8_t*)&ack, sizeof(ack));
+  bench_check(ack.attempt == 1, "ESP-NOW ACK doesn't echo the attempt");
+
+  remote_counter--;
+  bench_espnow_press(2, 0);
+  bench_drain();
+  remote_counter++;
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "ESP-NOW press from an older boot actuated");
+  bench_wait_door_settled();
+
+  // A pulse the door never got is answered BUSY, the same press goes
+  // through when the remote sends it again.
+  actuations = mock_i2c_get_actuations();
+  mock_i2c_fail_next(1);
+  bench_espnow_press(2, 0);
+  bench_drain();
+  mock_espnow_get_last_sent((uint8_t*)&ack, sizeof(ack));
+  bench_check(mock_i2c_get_actuations() == actuations && ack.seq == 2 && ack.result == MIVE_ESPNOW_RESULT_BUSY,
+    "failed relay pulse not reported as BUSY");
+  bench_espnow_press(2, 1);
+  bench_drain();
+  mock_espnow_get_last_sent((uint8_t*)&ack, sizeof(ack));
+  bench_check(mock_i2c_get_actuations() == actuations + 1 && ack.seq == 2 && ack.result == MIVE_ESPNOW_RESULT_ACTUATED,
+    "ESP-NOW press not carried out on the retry after a failed pulse");
+  bench_wait_door_settled();
+
+  // Anybody in range can send an unencrypted frame, one with the highest
+  // counter must not lock the remote out.
+  stranger.counter = UINT32_MAX;
+  acks = mock_espnow_get_sent_count();
+  mive_control_espnow_received(program, stranger_mac, (uint8_t*)&stranger, sizeof(stranger));
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1 && mock_espnow_get_sent_count() == acks, "frame from an unknown peer was accepted");
+  bench_espnow_press(3, 0);
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 2, "ESP-NOW press refused after a frame from an unknown peer");
+  bench_wait_door_settled();
+
+  // Two door cycles while the broker is away.
+  publishes = mock_mqtt_get_publish_count();
+  enqueued = mock_mqtt_get_enqueue_count();
+  mock_mqtt_disconnect();
+  for(uint32_t i = 0; i < 2; ++i)
+  {
+    mock_rc522_tap(known_card, sizeof(known_card));
+    bench_drain();
+    bench_wait_door_settled();
+  }
+  bench_check(mock_mqtt_get_publish_count() == publishes, "published while offline");
+  bench_check(program->outbox.history_count >= 4, "door cycles missing from the outbox history");
+
+  // The local endpoint takes the same commands without the broker.
+  actuations = mock_i2c_get_actuations();
+  if(mock_i2c_get_door_state() == GARAGE_OPEN)
+  {
+    mive_control_on_local_message("/garage/door/1/set", 18, "CLOSE", 5, program);
+  }
+  else
+  {
+    mive_control_on_local_message("/garage/door/1/set", 18, "OPEN", 4, program);
+  }
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "local command didn't actuate while offline");
+  bench_wait_door_settled();
+
+  // Nothing to ack when the command can't reach main_task.
+  bench_check(!mive_control_on_local_message("/garage/door/1/set", 18, "AJAR", 4, program), "unknown local command accepted");
+  vTaskSuspend(program->main_task_handle);
+  for(uint32_t i = 0; i < MIVE_LANE_ACTUATION_DEPTH; ++i)
+  {
+    mive_event_t tap = {
+      .event_type = MIVE_EVENT_CHECK_CARD,
+      .source = MIVE_SOURCE_NFC,
+      .event_data.nfc_card.length = sizeof(unknown_card),
+    };
+    memcpy(tap.event_data.nfc_card.uid, unknown_card, sizeof(unknown_card));
+    mive_event_queue_send(&program->main_queue, &tap, 0);
+  }
+  bench_check(!mive_control_on_local_message("/garage/door/1/set", 18, "STOP", 4, program),
+    "local command accepted with the actuation lane full");
+  dropped = bench_total_drops();
+  vTaskResume(program->main_task_handle);
+  bench_drain();
+
+  history = program->outbox.history_count;
+  mock_mqtt_connect();
+  bench_drain();
+  bench_check(mock_mqtt_get_enqueue_count() > enqueued + history, "outbox wasn't flushed on reconnect");
+  bench_check(program->outbox.latest[MIVE_TOPIC_STATE].pending == 0, "door state still pending after the flush");
+
+  // The broker drops out again before main_task got to the connect, the
+  // late flush must not put the outbox back online.
+  vTaskPrioritySet(NULL, BENCH_PRODUCER_PRIO);
+  mock_mqtt_disconnect();
+  mock_mqtt_connect();
+  mock_mqtt_disconnect();
+  vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+  bench_drain();
+  bench_check(!program->outbox.online, "outbox online after a connect that already dropped");
+  mock_mqtt_connect();
+  bench_drain();
+  bench_check(program->outbox.online, "outbox not back online after reconnecting");
+
+  bench_check(bench_total_drops() == dropped, "events dropped without any load");
+
+  bench_duty();
+
+  // Enrollment runs through main_task, the card has to open the door once
+  // the registration is over.
+  mock_mqtt_inject(MQTT_REGISTER_NFC, "", 0, 0, false);
+  bench_drain();
+  mock_rc522_tap(new_card, sizeof(new_card));
+  bench_drain();
+  bench_check(program->nfc_state == NFC_STATE_SUCCESS, "registration didn't succeed");
+  vTaskDelay(pdMS_TO_TICKS(MIVE_AUTH_IDLE_DELAY_MS + 100));
+  bench_check(program->nfc_state == NFC_STATE_IDLE, "registration didn't end");
+  actuations = mock_i2c_get_actuations();
+  mock_rc522_tap(new_card, sizeof(new_card));
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "enrolled card didn't actuate");
+  bench_wait_door_settled();
+
+  // A broker that can't keep up, the door has to work regardless and bulk
+  // payloads give way to state.
+  mock_mqtt_set_publish_delay_ms(100);
+  refused = program->net.stats.refused;
+  for(uint32_t i = 0; i < 4; ++i)
+  {
+    mock_mqtt_inject(MQTT_TRACE_DUMP_PATH, "MQTT", 4, 0, false);
+  }
+  bench_drain_queue();
+  bench_check(program->net.stats.refused > refused, "trace dumps not refused while the broker is behind");
+  actuations = mock_i2c_get_actuations();
+  mock_rc522_tap(known_card, sizeof(known_card));
+  bench_drain_queue();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "known card didn't actuate while the broker is behind");
+  mock_mqtt_set_publish_delay_ms(0);
+  bench_drain();
+  bench_wait_door_settled();
+  bench_check(program->outbox.latest[MIVE_TOPIC_STATE].pending == 0, "door state still pending once the broker caught up");
+
+  // Everything above left a trail, it has to come back over MQTT.
+  bench_history_reset();
+  mock_mqtt_inject(MQTT_HISTORY_GET_PATH, "", 0, 0, false);
+  bench_drain();
+  bench_check(history_replies.replies > 0, "no history reply");
+  bench_check(program->history.next_seq > 4, "door cycles missing from the history");
+
+  // Enough pages to outgrow the net ring while the broker is behind,
+  // refused pages go out once it drains instead of being skipped.
+  bench_history_fill(BENCH_HISTORY_PAGES * MIVE_HISTORY_QUERY_RECORDS);
+  bench_history_reset();
+  mock_mqtt_set_publish_delay_ms(100);
+  refused = program->net.stats.refused;
+  mock_mqtt_inject(MQTT_HISTORY_GET_PATH, "", 0, 0, false);
+  bench_drain_queue();
+  mock_mqtt_set_publish_delay_ms(0);
+  bench_drain();
+  bench_check(!history_replies.broken && history_replies.done, "history reply malformed, out of order or unfinished");
+  bench_check(program->net.stats.refused > refused, "history pages not refused while the broker is behind");
+  bench_check(history_replies.records == program->history.next_seq - history_replies.first_seq,
+    "history records lost while the broker was behind");
+
+  // A range that needs more than one page, nothing from before or after it
+  // may show up and the pages have to chain up in order.
+  bench_history_wait_second();
+  from_s = (uint32_t)time(NULL);
+  bench_history_reset();
+  first_seq = program->history.next_seq;
+  bench_history_fill(MIVE_HISTORY_QUERY_RECORDS + MIVE_HISTORY_QUERY_RECORDS / 2);
+  to_s = (uint32_t)time(NULL);
+  bench_history_wait_second();
+  bench_history_fill(4);
+  snprintf(query, sizeof(query), "%lu %lu", (unsigned long)from_s, (unsigned long)to_s);
+  mock_mqtt_inject(MQTT_HISTORY_GET_PATH, query, strlen(query), 0, false);
+  bench_drain();
+  bench_check(!history_replies.broken && history_replies.done, "history range reply malformed, out of order or unfinished");
+  bench_check(history_replies.replies > 1, "history range not split in pages");
+  bench_check(history_replies.first_seq == first_seq &&
+              history_replies.last_seq == first_seq + MIVE_HISTORY_QUERY_RECORDS + MIVE_HISTORY_QUERY_RECORDS / 2 - 1 &&
+              history_replies.records == MIVE_HISTORY_QUERY_RECORDS + MIVE_HISTORY_QUERY_RECORDS / 2,
+    "history range returned the wrong records");
+
+  // Offline, the query waits for the broker.
+  bench_history_reset();
+  mock_mqtt_disconnect();
+  mock_mqtt_inject(MQTT_HISTORY_GET_PATH, "", 0, 0, false);
+  bench_drain();
+  bench_check(history_replies.replies == 0, "history published while offline");
+  mock_mqtt_connect();
+  bench_drain();
+  bench_check(!history_replies.broken && history_replies.done &&
+              history_replies.records == program->history.next_seq - history_replies.first_seq,
+    "history query lost while offline");
+
+  // A wedged ATmega, the bus has to come back on its own.
+  resets = mock_i2c_get_bus_resets();
+  mock_i2c_fail_next(MIVE_GARAGE_REINIT_AFTER);
+  vTaskDelay(pdMS_TO_TICKS(MIVE_GARAGE_BACKOFF_MIN_MS * ((1 << MIVE_GARAGE_REINIT_AFTER) + 2)));
+  bench_check(mock_i2c_get_bus_resets() >= resets + MIVE_GARAGE_REINIT_AFTER, "bus not reset after failed transfers");
+  bench_check(program->garage_handle.stats.reinits > 0, "bus not re-initialized after repeated failures");
+  bench_check(program->garage_handle.failures == 0 && program->garage_state == mock_i2c_get_door_state(),
+    "door state not back after the bus recovered");
+
+  // A transfer that never completes, the ring must not lose track of which
+  // completion belongs to which transfer and the door has to keep working.
+  reinits = program->garage_handle.stats.reinits;
+  mock_i2c_hang_next(1);
+  vTaskDelay(pdMS_TO_TICKS(MIVE_GARAGE_STUCK_MS + MIVE_GARAGE_BACKOFF_MIN_MS * ((1 << MIVE_GARAGE_REINIT_AFTER) + 2)));
+  bench_check(program->garage_handle.stats.reinits > reinits, "bus not re-initialized after a transfer never completed");
+  bench_check(program->garage_handle.failures == 0 && program->garage_state == mock_i2c_get_door_state(),
+    "door state not back after a transfer never completed");
+  actuations = mock_i2c_get_actuations();
+  mock_rc522_tap(known_card, sizeof(known_card));
+  bench_drain();
+  bench_check(mock_i2c_get_actuations() == actuations + 1, "known card didn't actuate after a transfer never completed");
+  bench_wait_door_settled();
+
+#if MIVE_NFC_IRQ_MODE
+  mive_control_on_nfc_irq(program);
+  bench_drain();
+  bench_check(mock_rc522_is_scanning(), "reader not resumed when a card answered");
+  vTaskDelay(pdMS_TO_TICKS(MIVE_NFC_IRQ_SESSION_MS + 4 * MIVE_NFC_POLL_MS));
+  bench_check(!mock_rc522_is_scanning(), "reader still running after the session");
+  bench_check(mock_nfc_irq_get_probes() > 0, "reader never probed for a card");
+#endif
+
+  // Far more repeats than the telemetry lane holds, they have to merge.
+  vTaskPrioritySet(NULL, BENCH_PRODUCER_PRIO);
+  for(uint32_t i = 0; i < 8 * MIVE_LANE_TELEMETRY_DEPTH; ++i)
+  {
+    mive_event_t event = {
+      .event_type = MIVE_EVENT_SEND_PRESENCE,
+      .source = MIVE_SOURCE_INTERNAL,
+    };
+    bench_check(mive_event_queue_send(&program->main_queue, &event, 0) == pdTRUE, "coalesced send failed");
+  }
+  vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+  bench_drain();
+  bench_check(bench_total_drops() == dropped, "repeated requests dropped instead of coalescing");
+}
+
+void app_main(void)
+{
+  i2c_master_bus_config_t bus_config = {
+    .i2c_port = -1,
+  };
+  i2c_device_config_t dev_config = {
+    .device_address = 0x20,
+  };
+  rc522_config_t scanner_config = {0};
+
+  mive_boot_init();
+  mive_dlog_init();
+
+  program = calloc(1, sizeof(*program));
+  ESP_ERROR_CHECK(mive_event_queue_init(&program->main_queue));
+  mive_espnow_link_init(&program->espnow);
+  ESP_ERROR_CHECK(mive_espnow_link_add_peer(&program->espnow, remote_mac));
+  program->nfc_state = NFC_STATE_IDLE;
+  mive_seqlock_init(&program->nfc_lock);
+
+  program->nfc_uuids = calloc(1, NFC_MAX_UIDS * sizeof(*program->nfc_uuids));
+  memcpy(program->nfc_uuids[0].value, known_card, sizeof(known_card));
+  program->nfc_uuids[0].length = sizeof(known_card);
+  program->num_uuids = 1;
+
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mive_history_init(&program->history));
+  mive_history_append(&program->history, MIVE_HISTORY_BOOT, MIVE_SOURCE_INTERNAL, MIVE_HISTORY_NO_CREDENTIAL,
+                      MIVE_HISTORY_RESULT_OK, 0);
+
+  mock_i2c_set_latency_us(BENCH_I2C_LATENCY_US);
+  ESP_ERROR_CHECK(mive_garage_init(&program->garage_handle, &bus_config, &dev_config, mive_control_on_garage_done, program));
+
+  ESP_ERROR_CHECK(mive_ranging_init(&program->ranging, &(mive_ranging_config_t){
+    .max_distance_cm = BENCH_MAX_DISTANCE_CM,
+    .on_done = mive_control_on_ranging_done,
+    .arg = program,
+  }));
+
+  xTaskCreate(bench_control_task, "MainTask", 16384, program, BENCH_CONTROL_PRIO, &program->main_task_handle);
+
+  rc522_create(&scanner_config, &program->nfc_scanner);
+  rc522_register_events(program->nfc_scanner, RC522_EVENT_PICC_STATE_CHANGED, mive_nfc_on_picc_state_changed, program);
+  rc522_start(program->nfc_scanner);
+#if MIVE_NFC_IRQ_MODE
+  ESP_ERROR_CHECK(mive_nfc_irq_init(&program->nfc_irq, program->nfc_driver, 0, mive_control_on_nfc_irq, program));
+#endif
+
+  mive_control_mqtt_start(program);
+  mive_control_local_start(program);
+  mock_mqtt_set_publish_cb(bench_on_publish, NULL);
+  mock_mqtt_connect();
+  bench_drain();
+  bench_check(mock_mqtt_get_subscribe_count() > 0, "no subscriptions on connect");
+  bench_check(program->nfc_loaded, "card list not loaded after boot");
+  bench_check(program->outbox.latest[MIVE_TOPIC_BOOT].len > 0, "boot markers not published on connect");
+
+  bench_functional();
+
+  bench_storm("mqtt commands", storm_mqtt_commands);
+  bench_storm("nfc taps", storm_nfc_taps);
+  bench_storm("espnow", storm_espnow);
+  bench_storm("telemetry", storm_telemetry);
+  bench_storm("mixed", storm_mixed);
+
+  printf("\n%lu publishes, %lu relay pulses, %lu pings\n", (unsigned long)mock_mqtt_get_publish_count(),
+    (unsigned long)mock_i2c_get_actuations(), (unsigned long)mock_ranging_get_pings());
+  printf("%s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+
+  fflush(stdout);
+  exit(failures ? 1 : 0);
+}
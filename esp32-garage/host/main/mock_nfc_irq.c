@@ -0,0 +1,30 @@
+#include "include/nfc_irq.h"
+#include "mock_nfc_irq.h"
+
+static uint32_t probes = 0;
+
+uint32_t mock_nfc_irq_get_probes(void)
+{
+  return probes;
+}
+
+esp_err_t mive_nfc_irq_init(mive_nfc_irq_t* irq, rc522_driver_handle_t driver, gpio_num_t irq_pin, mive_nfc_irq_cb_t on_card, void* arg)
+{
+  irq->driver = driver;
+  irq->irq_pin = irq_pin;
+  irq->on_card = on_card;
+  irq->arg = arg;
+
+  return ESP_OK;
+}
+
+esp_err_t mive_nfc_irq_probe(mive_nfc_irq_t* irq)
+{
+  probes++;
+  return ESP_OK;
+}
+
+esp_err_t mive_nfc_irq_disarm(mive_nfc_irq_t* irq)
+{
+  return ESP_OK;
+}
@@ -0,0 +1,11 @@
+#ifndef _MOCK_NFC_IRQ_H
+#define _MOCK_NFC_IRQ_H
+
+#include <stdint.h>
+
+// The host build replaces nfc_irq.c, probes are only counted. A card
+// answering one is simulated by calling the on_card callback directly.
+
+uint32_t mock_nfc_irq_get_probes(void);
+
+#endif // _MOCK_NFC_IRQ_H
\ No newline at end of file
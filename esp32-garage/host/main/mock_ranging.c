@@ -0,0 +1,95 @@
+#include <string.h>
+#include "esp_timer.h"
+
+#include "include/ranging.h"
+#include "mock_ranging.h"
+
+static esp_timer_handle_t echo_timer = NULL;
+static uint32_t distance_cm = 250;
+static uint32_t pings = 0;
+
+static const char* ranging_status_str[] = {
+  [MIVE_RANGING_OK] = "OK",
+  [MIVE_RANGING_PING_TIMEOUT] = "PING_TIMEOUT",
+  [MIVE_RANGING_ECHO_TIMEOUT] = "ECHO_TIMEOUT",
+};
+
+void mock_ranging_set_distance(uint32_t cm)
+{
+  distance_cm = cm;
+}
+
+uint32_t mock_ranging_get_pings(void)
+{
+  return pings;
+}
+
+static void echo_timer_callback(void* arg)
+{
+  mive_ranging_t* ranging = (mive_ranging_t*)arg;
+  mive_ranging_result_t result = {
+    .status = MIVE_RANGING_OK,
+    .distance_cm = distance_cm,
+  };
+
+  if(distance_cm == 0)
+  {
+    result.status = MIVE_RANGING_PING_TIMEOUT;
+  }
+  else if(distance_cm > ranging->config.max_distance_cm)
+  {
+    result.status = MIVE_RANGING_ECHO_TIMEOUT;
+    result.distance_cm = 0;
+  }
+
+  ranging->state = MIVE_RANGING_IDLE;
+  ranging->config.on_done(&result, ranging->config.arg);
+}
+
+esp_err_t mive_ranging_init(mive_ranging_t* ranging, const mive_ranging_config_t* config)
+{
+  const esp_timer_create_args_t echo_timer_args = {
+    .callback = echo_timer_callback,
+    .name = "mock_echo",
+    .arg = ranging,
+  };
+
+  memset(ranging, 0, sizeof(*ranging));
+  ranging->config = *config;
+
+  return esp_timer_create(&echo_timer_args, &echo_timer);
+}
+
+esp_err_t mive_ranging_trigger(mive_ranging_t* ranging)
+{
+  uint32_t echo_us = MIVE_RANGING_PING_TIMEOUT_US;
+
+  if(ranging->state != MIVE_RANGING_IDLE)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if(distance_cm != 0)
+  {
+    uint32_t cm = (distance_cm > ranging->config.max_distance_cm) ? ranging->config.max_distance_cm : distance_cm;
+    echo_us = cm * MIVE_RANGING_US_PER_CM;
+  }
+
+  ranging->state = MIVE_RANGING_WAIT_FALL;
+  pings++;
+  return esp_timer_start_once(echo_timer, echo_us);
+}
+
+const char* mive_ranging_status_str(enum mive_ranging_status_e status)
+{
+  if(status > MIVE_RANGING_ECHO_TIMEOUT)
+  {
+    return NULL;
+  }
+
+  return ranging_status_str[status];
+}
+
+void mive_ranging_release(mive_ranging_t* ranging)
+{
+}
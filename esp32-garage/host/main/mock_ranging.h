@@ -0,0 +1,14 @@
+#ifndef _MOCK_RANGING_H
+#define _MOCK_RANGING_H
+
+#include <stdint.h>
+
+// The host build replaces ranging.c, echoes come back from an esp_timer
+// after the time sound would take for the configured distance.
+
+// 0 makes the sensor stay silent (MIVE_RANGING_PING_TIMEOUT).
+void mock_ranging_set_distance(uint32_t distance_cm);
+
+uint32_t mock_ranging_get_pings(void);
+
+#endif // _MOCK_RANGING_H
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "include/boot.h"
+
+typedef struct mive_boot_retained_s
+{
+  uint32_t magic;
+  // Resets since the last power cycle.
+  uint32_t boots;
+  uint8_t valid;
+  uint32_t values[MIVE_STATE_DOC_FIELD_MAX];
+  // Over everything above.
+  uint32_t crc;
+} mive_boot_retained_t;
+
+static RTC_NOINIT_ATTR mive_boot_retained_t boot_retained;
+static bool boot_restored = false;
+static uint32_t boot_marks_ms[MIVE_BOOT_MARK_MAX];
+
+static const char* boot_mark_name[MIVE_BOOT_MARK_MAX] = {
+  [MIVE_BOOT_APP_MAIN] = "app_main",
+  [MIVE_BOOT_MAIN_TASK] = "main_task",
+  [MIVE_BOOT_NFC] = "nfc",
+  [MIVE_BOOT_DOOR] = "door",
+  [MIVE_BOOT_CREDENTIALS] = "credentials",
+  [MIVE_BOOT_WIFI] = "wifi",
+  [MIVE_BOOT_MQTT] = "mqtt",
+};
+
+static uint32_t retained_crc(void)
+{
+  return esp_crc32_le(0, (const uint8_t*)&boot_retained, offsetof(mive_boot_retained_t, crc));
+}
+
+bool mive_boot_init(void)
+{
+  mive_boot_mark(MIVE_BOOT_APP_MAIN);
+
+  boot_restored = boot_retained.magic == MIVE_BOOT_MAGIC && boot_retained.crc == retained_crc();
+  if(!boot_restored)
+  {
+    memset(&boot_retained, 0, sizeof(boot_retained));
+    boot_retained.magic = MIVE_BOOT_MAGIC;
+  }
+  boot_retained.boots++;
+  boot_retained.crc = retained_crc();
+
+  return boot_restored;
+}
+
+void mive_boot_mark(enum mive_boot_mark_e mark)
+{
+  uint32_t expected = 0;
+  uint32_t now_ms = esp_timer_get_time() / 1000;
+
+  if(mark >= MIVE_BOOT_MARK_MAX)
+  {
+    return;
+  }
+
+  // 0 is taken for "not yet".
+  __atomic_compare_exchange_n(&boot_marks_ms[mark], &expected, (now_ms > 0) ? now_ms : 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+void mive_boot_retain(enum mive_state_doc_field_e field, uint32_t value, bool valid)
+{
+  uint8_t bit = 1 << field;
+
+  if(field >= MIVE_STATE_DOC_FIELD_MAX)
+  {
+    return;
+  }
+
+  if(boot_retained.values[field] == value && ((boot_retained.valid & bit) != 0) == valid)
+  {
+    return;
+  }
+
+  boot_retained.values[field] = value;
+  boot_retained.valid = valid ? (boot_retained.valid | bit) : (boot_retained.valid & ~bit);
+  boot_retained.crc = retained_crc();
+}
+
+bool mive_boot_retained(enum mive_state_doc_field_e field, uint32_t* value)
+{
+  if(!boot_restored || field >= MIVE_STATE_DOC_FIELD_MAX || !(boot_retained.valid & (1 << field)))
+  {
+    return false;
+  }
+
+  *value = boot_retained.values[field];
+  return true;
+}
+
+int mive_boot_json(char* buf, size_t buf_len)
+{
+  size_t pos = 0;
+  int written = 0;
+  bool first = true;
+
+#define APPEND(...) \
+  do { \
+    written = snprintf(buf + pos, buf_len - pos, __VA_ARGS__); \
+    if(written < 0 || (size_t)written >= buf_len - pos) { return -1; } \
+    pos += written; \
+  } while(0)
+
+  APPEND("{\"reason\":%d,\"boots\":%lu,\"retained\":%d,\"ms\":{", (int)esp_reset_reason(), (unsigned long)boot_retained.boots,
+         boot_restored);
+  for(uint32_t mark = 0; mark < MIVE_BOOT_MARK_MAX; ++mark)
+  {
+    uint32_t ms = __atomic_load_n(&boot_marks_ms[mark], __ATOMIC_RELAXED);
+    if(ms == 0)
+    {
+      continue;
+    }
+    APPEND("%s\"%s\":%lu", first ? "" : ",", boot_mark_name[mark], (unsigned long)ms);
+    first = false;
+  }
+  APPEND("}}");
+
+#undef APPEND
+
+  return pos;
+}
@@ -0,0 +1,1047 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+
+#include "include/control.h"
+#include "include/program.h"
+#include "include/garage.h"
+#include "include/events.h"
+#include "include/event_queue.h"
+#include "include/nfc.h"
+#include "include/mqtt_publish.h"
+#include "include/mqtt_router.h"
+#include "include/state_doc.h"
+#include "include/presence.h"
+#include "include/metrics.h"
+#include "include/trace.h"
+#include "include/dlog.h"
+#include "include/scheduler.h"
+#include "include/power.h"
+#include "include/duty.h"
+#include "include/nfc_irq.h"
+#include "include/history.h"
+#include "include/boot.h"
+
+static const char *TAG = "control";
+
+// Event each job turns into when it comes due.
+static const uint8_t job_event[MIVE_JOB_MAX] = {
+  [MIVE_JOB_POLL_GARAGE] = MIVE_EVENT_GET_GARAGE_INFO,
+  [MIVE_JOB_RANGING] = MIVE_EVENT_MEASURE_DISTANCE,
+  [MIVE_JOB_AUTH_IDLE] = MIVE_EVENT_SEND_AUTH_STATE,
+  [MIVE_JOB_SWITCH_RESET] = MIVE_EVENT_RESET_GARAGE_SWITCH,
+  [MIVE_JOB_STATE_DOC] = MIVE_EVENT_SEND_STATE_DOC,
+  [MIVE_JOB_METRICS] = MIVE_EVENT_PUBLISH_METRICS,
+  [MIVE_JOB_NFC_DUTY] = MIVE_EVENT_NFC_DUTY,
+  [MIVE_JOB_HISTORY_FLUSH] = MIVE_EVENT_HISTORY_FLUSH,
+};
+
+bool mive_control_on_nfc_irq(void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+  BaseType_t higher_prio_woken = pdFALSE;
+
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_NFC_FIELD,
+    .source = MIVE_SOURCE_NFC,
+  };
+  mive_event_queue_send_from_isr(&program->main_queue, &event, &higher_prio_woken);
+
+  return higher_prio_woken == pdTRUE;
+}
+
+void mive_control_on_net_drained(void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_NET_DRAINED,
+    .source = MIVE_SOURCE_MQTT,
+  };
+  mive_event_queue_send(&program->main_queue, &event, 0);
+}
+
+bool mive_control_on_garage_done(const mive_garage_result_t* result, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+  BaseType_t higher_prio_woken = pdFALSE;
+
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_GARAGE_DONE,
+    .source = result->tag,
+    .event_data.garage_done = {
+      .op = result->op,
+      .state = result->state,
+      .status = result->status,
+      .elapsed_us = result->elapsed_us,
+    },
+  };
+  mive_event_queue_send_from_isr(&program->main_queue, &event, &higher_prio_woken);
+
+  return higher_prio_woken == pdTRUE;
+}
+
+bool mive_control_on_ranging_done(const mive_ranging_result_t* result, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+  BaseType_t higher_prio_woken = pdFALSE;
+
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_DISTANCE_READY,
+    .source = MIVE_SOURCE_SENSOR,
+    .event_data.distance_ready = {
+      .status = result->status,
+      .distance_cm = result->distance_cm,
+    },
+  };
+  mive_event_queue_send_from_isr(&program->main_queue, &event, &higher_prio_woken);
+
+  return higher_prio_woken == pdTRUE;
+}
+
+// (Re)arms the ranging job. Safe to call while it's already pending.
+static void schedule_ranging(mive_program_t* program, uint32_t period_ms)
+{
+  mive_scheduler_arm(&program->scheduler, MIVE_JOB_RANGING, esp_timer_get_time(), period_ms * 1000, 0);
+}
+
+// Buffers a history record, the flush comes once a page is full or the
+// oldest record waited MIVE_HISTORY_FLUSH_MS.
+static void history_add(mive_program_t* program, uint8_t kind, uint8_t source, uint8_t credential, uint8_t result, uint16_t arg)
+{
+  int64_t now_us = esp_timer_get_time();
+
+  if(mive_history_append(&program->history, kind, source, credential, result, arg))
+  {
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_HISTORY_FLUSH, now_us, 0, 0);
+  }
+  else if(!mive_scheduler_is_armed(&program->scheduler, MIVE_JOB_HISTORY_FLUSH))
+  {
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_HISTORY_FLUSH, now_us, MIVE_HISTORY_FLUSH_MS * 1000, 0);
+  }
+}
+
+// Parks a history query where it stopped, only the latest one is kept.
+static void history_park(mive_program_t* program, const struct mive_event_history_query* query)
+{
+  program->history_parked = *query;
+  program->history_parked_valid = true;
+}
+
+static void history_resume(mive_program_t* program)
+{
+  if(!program->history_parked_valid)
+  {
+    return;
+  }
+
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_HISTORY_QUERY,
+    .source = MIVE_SOURCE_MQTT,
+    .event_data.history_query = program->history_parked,
+  };
+  if(mive_event_queue_send(&program->main_queue, &event, 0) == pdTRUE)
+  {
+    program->history_parked_valid = false;
+  }
+}
+
+// Records a state change in the aggregated document and opens a coalescing
+// window if one isn't already running.
+static void state_doc_update(mive_program_t* program, enum mive_state_doc_field_e field, uint32_t value, bool valid)
+{
+  mive_boot_retain(field, value, valid);
+#if MIVE_STATE_DOC_ENABLE
+  if(mive_state_doc_set(&program->state_doc, field, value, valid) && !mive_scheduler_is_armed(&program->scheduler, MIVE_JOB_STATE_DOC))
+  {
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_STATE_DOC, esp_timer_get_time(), MIVE_STATE_DOC_COALESCE_MS * 1000, 0);
+  }
+#endif
+}
+
+// Puts the state from before the reset in the outbox, so the first connect
+// publishes it before the door and the sensor have been read. The logic
+// itself still starts from GARAGE_INVALID, the readings replace these.
+static void restore_retained(mive_program_t* program)
+{
+  uint32_t value = 0;
+  uint8_t state_doc_buf[MIVE_STATE_DOC_MAX_LEN];
+  int state_doc_len = 0;
+  char buf[12] = {0};
+
+  if(mive_boot_retained(MIVE_STATE_DOC_GARAGE, &value) && value <= GARAGE_STATE_MAX)
+  {
+    mive_state_doc_set(&program->state_doc, MIVE_STATE_DOC_GARAGE, value, true);
+    mive_publish_seed(program, MIVE_TOPIC_STATE, mive_garage_get_state_str(value), 0);
+  }
+  if(mive_boot_retained(MIVE_STATE_DOC_DISTANCE, &value))
+  {
+    mive_state_doc_set(&program->state_doc, MIVE_STATE_DOC_DISTANCE, value, true);
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)value);
+    mive_publish_seed(program, MIVE_TOPIC_PRESENCE, buf, 0);
+  }
+  if(mive_boot_retained(MIVE_STATE_DOC_PRESENCE, &value))
+  {
+    mive_state_doc_set(&program->state_doc, MIVE_STATE_DOC_PRESENCE, value, true);
+    mive_publish_seed(program, MIVE_TOPIC_PRESENCE_STATE, mive_presence_state_str(value), 0);
+  }
+
+  // A registration doesn't survive the reset and the relay pulse is long
+  // over, both start from their idle values.
+  mive_state_doc_set(&program->state_doc, MIVE_STATE_DOC_AUTH, NFC_STATE_IDLE, true);
+  mive_state_doc_set(&program->state_doc, MIVE_STATE_DOC_SWITCH, 0, true);
+  mive_publish_seed(program, MIVE_TOPIC_SWITCH_STATE, "OFF", 0);
+
+#if MIVE_STATE_DOC_ENABLE
+  state_doc_len = mive_state_doc_take(&program->state_doc, state_doc_buf, sizeof(state_doc_buf));
+  if(state_doc_len > 0)
+  {
+    mive_publish_seed(program, MIVE_TOPIC_STATUS, (char*)state_doc_buf, state_doc_len);
+  }
+#endif
+}
+
+// Re-evaluates how hard the NFC reader works, see duty.h.
+static void update_duty(mive_program_t* program)
+{
+  int64_t now_us = esp_timer_get_time();
+  enum mive_duty_mode_e mode = mive_duty_nfc_mode(&program->duty, &program->presence, mive_garage_is_moving(program->garage_state),
+                                                  program->nfc_state != NFC_STATE_IDLE, now_us);
+
+  if(mode == program->duty.nfc_mode)
+  {
+    return;
+  }
+
+  MIVE_DLOGI(TAG, "NFC %s -> %s", mive_duty_mode_str(program->duty.nfc_mode), mive_duty_mode_str(mode));
+  program->duty.nfc_mode = mode;
+
+  switch (mode)
+  {
+  case MIVE_DUTY_FAST:
+#if MIVE_NFC_IRQ_MODE
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, now_us, 0, 0);
+#else
+    mive_scheduler_cancel(&program->scheduler, MIVE_JOB_NFC_DUTY);
+    mive_nfc_set_scanning(program, true);
+#endif
+    break;
+  case MIVE_DUTY_SLOW:
+#if MIVE_NFC_IRQ_MODE
+    // Same as FAST, a probe is a few register writes, so taps are seen
+    // within MIVE_NFC_POLL_MS in either mode.
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, now_us, 0, 0);
+#else
+    // Starts with a scan window, MIVE_EVENT_NFC_DUTY takes it from there.
+    mive_nfc_set_scanning(program, true);
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, now_us, MIVE_DUTY_NFC_SLOW_ON_MS * 1000, 0);
+#endif
+    break;
+  default:
+    mive_scheduler_cancel(&program->scheduler, MIVE_JOB_NFC_DUTY);
+    mive_nfc_set_scanning(program, false);
+    break;
+  }
+}
+
+#if MIVE_NFC_IRQ_MODE
+// Ends a reader session once it ran its course, then probes for the next card.
+static void nfc_irq_tick(mive_program_t* program)
+{
+  int64_t now_us = esp_timer_get_time();
+  mive_nfc_irq_t* irq = &program->nfc_irq;
+
+  if(program->duty.nfc_mode == MIVE_DUTY_OFF)
+  {
+    return;
+  }
+
+  if(program->duty.nfc_scanning)
+  {
+    if(irq->card_present || (now_us - irq->session_us) < MIVE_NFC_IRQ_SESSION_MS * 1000LL)
+    {
+      mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, now_us, MIVE_NFC_IRQ_SESSION_MS * 1000, 0);
+      return;
+    }
+    mive_nfc_set_scanning(program, false);
+  }
+
+  if(mive_nfc_irq_probe(irq) != ESP_OK)
+  {
+    ESP_LOGD(TAG, "Reader not there for a probe");
+  }
+  mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, now_us, MIVE_NFC_POLL_MS * 1000, 0);
+}
+#endif
+
+static void publish_presence(mive_program_t* program, uint8_t changed)
+{
+  uint32_t distance_cm = 0;
+  bool distance_valid = mive_presence_get_distance(&program->presence, &distance_cm);
+  enum mive_presence_state_e presence_state = mive_presence_get_state(&program->presence);
+
+  state_doc_update(program, MIVE_STATE_DOC_DISTANCE, distance_cm, distance_valid);
+  state_doc_update(program, MIVE_STATE_DOC_PRESENCE, presence_state, true);
+
+  if(changed & MIVE_PRESENCE_CHANGED_DISTANCE)
+  {
+    char buf[30] = {0};
+    if(distance_valid)
+    {
+      snprintf(buf, 29, "%lu", (unsigned long)distance_cm);
+    }
+    else
+    {
+      strcpy(buf, "None");
+    }
+    mive_publish(program, MIVE_TOPIC_PRESENCE, buf, 0);
+  }
+
+  if(changed & MIVE_PRESENCE_CHANGED_STATE)
+  {
+    mive_publish(program, MIVE_TOPIC_PRESENCE_STATE, mive_presence_state_str(presence_state), 0);
+  }
+}
+
+static void log_error_if_nonzero(const char *message, int error_code)
+{
+  if (error_code != 0) {
+    ESP_LOGE(TAG, "Last error %s: 0x%x", message, error_code);
+  }
+}
+
+static bool on_mqtt_garage_command(const mive_mqtt_message_t* message, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+
+  if(message->value == MIVE_ROUTER_NO_MATCH)
+  {
+    mive_trace(MIVE_TRACE_MQTT_COMMAND, message->source, message->value, false);
+    ESP_LOGW(TAG, "Unknown command on %s", message->route->filter);
+    return false;
+  }
+
+  if(message->value == MQTT_COMMAND_IGNORE)
+  {
+    mive_trace(MIVE_TRACE_MQTT_COMMAND, message->source, message->value, false);
+    return true;
+  }
+
+  mive_trace(MIVE_TRACE_MQTT_COMMAND, message->source, message->value, true);
+
+  mive_event_t mive_event = {
+    .event_type = MIVE_EVENT_START_GARAGE,
+    .source = message->source,
+    .event_data.start_garage.command = message->value,
+  };
+  return mive_event_queue_send(&program->main_queue, &mive_event, pdMS_TO_TICKS(10)) == pdTRUE;
+}
+
+static bool on_mqtt_register_card(const mive_mqtt_message_t* message, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+
+  mive_event_t mive_event = {
+    .event_type = MIVE_EVENT_REGISTER_CARD,
+    .source = message->source,
+  };
+  return mive_event_queue_send(&program->main_queue, &mive_event, pdMS_TO_TICKS(10)) == pdTRUE;
+}
+
+static bool on_mqtt_history_get(const mive_mqtt_message_t* message, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+
+  mive_event_t mive_event = {
+    .event_type = MIVE_EVENT_HISTORY_QUERY,
+    .source = message->source,
+    .event_data.history_query = {
+      .from_s = (message->num_numbers > 0) ? message->numbers[0] : 0,
+      .to_s = (message->num_numbers > 1) ? message->numbers[1] : 0,
+    },
+  };
+  return mive_event_queue_send(&program->main_queue, &mive_event, pdMS_TO_TICKS(10)) == pdTRUE;
+}
+
+static bool on_mqtt_trace_dump(const mive_mqtt_message_t* message, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+
+  mive_event_t mive_event = {
+    .event_type = MIVE_EVENT_DUMP_TRACE,
+    .source = message->source,
+    .event_data.dump_trace.console = (message->value == 1),
+  };
+  return mive_event_queue_send(&program->main_queue, &mive_event, pdMS_TO_TICKS(10)) == pdTRUE;
+}
+
+// The switch entity sends ON to press the button and may echo OFF back.
+static const mive_keyword_t switch_keywords[] = {
+  {"ON", MIVE_GARAGE_CMD_TOGGLE},
+  {"PRESS", MIVE_GARAGE_CMD_TOGGLE},
+  {"TOGGLE", MIVE_GARAGE_CMD_TOGGLE},
+  {"1", MIVE_GARAGE_CMD_TOGGLE},
+  {"OFF", MQTT_COMMAND_IGNORE},
+  {"0", MQTT_COMMAND_IGNORE},
+};
+
+static const mive_keyword_t trace_keywords[] = {
+  {"MQTT", 0},
+  {"CONSOLE", 1},
+};
+
+static const mive_keyword_t door_keywords[] = {
+  {"OPEN", MIVE_GARAGE_CMD_OPEN},
+  {"CLOSE", MIVE_GARAGE_CMD_CLOSE},
+  {"STOP", MIVE_GARAGE_CMD_STOP},
+  {"TOGGLE", MIVE_GARAGE_CMD_TOGGLE},
+};
+
+// arg is filled in with the program when the routes are registered.
+static mive_route_t mqtt_routes[] = {
+  {
+    .filter = MQTT_SWTICH_PATH,
+    .keywords = switch_keywords,
+    .num_keywords = sizeof(switch_keywords) / sizeof(switch_keywords[0]),
+    .handler = on_mqtt_garage_command,
+  },
+  {
+    .filter = MQTT_DOOR_SET_PATH,
+    .keywords = door_keywords,
+    .num_keywords = sizeof(door_keywords) / sizeof(door_keywords[0]),
+    .handler = on_mqtt_garage_command,
+  },
+  {
+    .filter = MQTT_REGISTER_NFC,
+    .handler = on_mqtt_register_card,
+  },
+  {
+    .filter = MQTT_TRACE_DUMP_PATH,
+    .keywords = trace_keywords,
+    .num_keywords = sizeof(trace_keywords) / sizeof(trace_keywords[0]),
+    .handler = on_mqtt_trace_dump,
+  },
+  {
+    .filter = MQTT_HISTORY_GET_PATH,
+    .numbers = true,
+    .handler = on_mqtt_history_get,
+  },
+};
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+  mive_program_t* program = (mive_program_t*)handler_args;
+  esp_mqtt_event_handle_t event = event_data;
+  esp_mqtt_client_handle_t client = event->client;
+  mive_event_t mive_event = {.source = MIVE_SOURCE_MQTT};
+  MIVE_DLOG(MIVE_DLOG_VERBOSE, TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
+  switch ((esp_mqtt_event_id_t)event_id) {
+  case MQTT_EVENT_CONNECTED:
+    MIVE_DLOGI(TAG, "MQTT_EVENT_CONNECTED");
+    mive_boot_mark(MIVE_BOOT_MQTT);
+    mive_trace(MIVE_TRACE_MQTT_CONNECTION, MIVE_SOURCE_MQTT, 1, 0);
+    mive_publish_set_connected(program);
+    mive_event.event_type = MIVE_EVENT_MQTT_CONNECTED;
+    mive_event_queue_send(&program->main_queue, &mive_event, pdMS_TO_TICKS(100));
+
+    mive_mqtt_router_subscribe(&program->mqtt_router, client);
+
+    break;
+  case MQTT_EVENT_DISCONNECTED:
+    MIVE_DLOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+    mive_publish_set_offline(program);
+    mive_trace(MIVE_TRACE_MQTT_CONNECTION, MIVE_SOURCE_MQTT, 0, 0);
+    break;
+
+  case MQTT_EVENT_SUBSCRIBED:
+    MIVE_DLOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+    break;
+  case MQTT_EVENT_UNSUBSCRIBED:
+    MIVE_DLOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+    break;
+  case MQTT_EVENT_PUBLISHED:
+    MIVE_DLOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+    break;
+  case MQTT_EVENT_DATA:
+    // Topic and payload belong to the client, copy them into the record.
+    MIVE_DLOG_DATA(MIVE_DLOG_INFO, TAG, MIVE_DLOG_DATA_TEXT, event->topic, event->topic_len, "MQTT_EVENT_DATA, %d bytes on", event->data_len);
+    MIVE_DLOG_DATA(MIVE_DLOG_DEBUG, TAG, MIVE_DLOG_DATA_TEXT, event->data, event->data_len, "DATA=");
+    mive_mqtt_router_dispatch(&program->mqtt_router, event);
+    break;
+  case MQTT_EVENT_ERROR:
+    MIVE_DLOGI(TAG, "MQTT_EVENT_ERROR");
+    if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+      log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
+      log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
+      log_error_if_nonzero("captured as transport's socket errno",  event->error_handle->esp_transport_sock_errno);
+      ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
+
+    }
+    break;
+  default:
+    MIVE_DLOGI(TAG, "Other event id:%d", event->event_id);
+    break;
+  }
+}
+
+void mive_control_mqtt_start(mive_program_t* program)
+{
+  esp_mqtt_client_config_t mqtt_cfg = {
+    .broker.address.uri = MQTT_BROKER_URL,
+  };
+
+  mive_mqtt_router_init(&program->mqtt_router, MIVE_SOURCE_MQTT);
+  for(uint32_t i = 0; i < sizeof(mqtt_routes) / sizeof(mqtt_routes[0]); ++i)
+  {
+    mqtt_routes[i].arg = program;
+    ESP_ERROR_CHECK(mive_mqtt_router_add(&program->mqtt_router, &mqtt_routes[i]));
+  }
+
+  program->mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+  // Nothing gets published before the client connects.
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mive_net_init(&program->net, program->mqtt_client, mive_control_on_net_drained, program));
+  /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
+  esp_mqtt_client_register_event(program->mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, program);
+  esp_mqtt_client_start(program->mqtt_client);
+}
+
+void mive_control_local_start(mive_program_t* program)
+{
+  mive_mqtt_router_init(&program->local_router, MIVE_SOURCE_LOCAL);
+  for(uint32_t i = 0; i < sizeof(mqtt_routes) / sizeof(mqtt_routes[0]); ++i)
+  {
+    mqtt_routes[i].arg = program;
+    ESP_ERROR_CHECK(mive_mqtt_router_add(&program->local_router, &mqtt_routes[i]));
+  }
+
+#if MIVE_WS_ENABLE
+  // Commands keep working with the broker down, only needs the LAN.
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mive_ws_init(&program->ws, mive_control_on_local_message, program));
+#endif
+}
+
+bool mive_control_on_local_message(const char* topic, size_t topic_len, const char* data, size_t data_len, void* arg)
+{
+  mive_program_t* program = (mive_program_t*)arg;
+
+  // A WebSocket frame is always complete.
+  return mive_mqtt_router_feed(&program->local_router, topic, topic_len, data, data_len, 0, data_len, false);
+}
+
+void mive_control_init(mive_program_t* program, uint32_t max_distance_cm)
+{
+  int64_t now_us = 0;
+
+  mive_presence_init(&program->presence, max_distance_cm);
+  mive_state_doc_init(&program->state_doc);
+  restore_retained(program);
+  mive_metrics_init(&program->metrics);
+  mive_duty_init(&program->duty, esp_timer_get_time());
+  program->garage_state = GARAGE_INVALID;
+
+  mive_scheduler_init(&program->scheduler);
+
+  now_us = esp_timer_get_time();
+#if MIVE_NFC_IRQ_MODE
+  // app_main starts the reader component so it sets up the chip, the first
+  // tick pauses it and starts probing.
+  mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, now_us, MIVE_NFC_IRQ_SESSION_MS * 1000, 0);
+#endif
+  // app_main logs the boot before handing the history over.
+  if(program->history.num_pending > 0)
+  {
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_HISTORY_FLUSH, now_us, MIVE_HISTORY_FLUSH_MS * 1000, 0);
+  }
+  mive_scheduler_arm(&program->scheduler, MIVE_JOB_POLL_GARAGE, now_us, MIVE_GARAGE_POLL_PERIOD_MS * 1000, MIVE_GARAGE_POLL_PERIOD_MS * 1000);
+  mive_scheduler_arm(&program->scheduler, MIVE_JOB_METRICS, now_us, MIVE_METRICS_PUBLISH_PERIOD_MS * 1000, MIVE_METRICS_PUBLISH_PERIOD_MS * 1000);
+  // Ranging reschedules itself after every reading, see MIVE_EVENT_DISTANCE_READY.
+  schedule_ranging(program, MIVE_PRESENCE_SLOW_PERIOD_MS);
+
+  // Nothing else publishes the registration state before a card gets
+  // registered, this gets it into the outbox for the first connect.
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_SEND_AUTH_STATE,
+    .source = MIVE_SOURCE_INTERNAL,
+  };
+  mive_event_queue_send(&program->main_queue, &event, 0);
+
+  // Behind everything else, a card tapped before this runs gets looked up
+  // with MIVE_EVENT_CHECK_CARD.
+  event.event_type = MIVE_EVENT_LOAD_CREDENTIALS;
+  mive_event_queue_send(&program->main_queue, &event, 0);
+}
+
+// Follow-up events are posted without waiting. main_task is the only reader,
+// blocking on its own full queue would only stall it.
+void mive_control_handle_event(mive_program_t* program, mive_event_t* event)
+{
+  esp_err_t retval = ESP_OK;
+  mive_ranging_result_t ranging_result = {0};
+  uint8_t presence_changed = 0;
+  uint8_t state_doc_buf[MIVE_STATE_DOC_MAX_LEN];
+  int state_doc_len = 0;
+  enum garage_state_e new_garage_state = GARAGE_INVALID;
+  static char metrics_buf[MIVE_METRICS_MAX_LEN];
+  int metrics_len = 0;
+  static uint8_t trace_buf[MIVE_TRACE_DUMP_MAX_LEN];
+  int trace_len = 0;
+  static uint8_t history_buf[MIVE_HISTORY_REPLY_MAX_LEN];
+  int history_len = 0;
+  char boot_buf[MIVE_BOOT_JSON_MAX_LEN];
+  int boot_len = 0;
+  int32_t credential = -1;
+  bool applies = false;
+  enum mive_event_source_e source = event->source;
+  mive_garage_result_t garage_result = {0};
+  uint8_t espnow_result = MIVE_ESPNOW_RESULT_NOT_APPLICABLE;
+
+  switch (event->event_type)
+  {
+  case MIVE_EVENT_MQTT_CONNECTED:
+    // The outbox holds the latest value of every state topic, published or
+    // not, so this brings the broker up to date in one burst.
+    mive_publish_flush(program);
+    // Markers reached so far, later ones show up with the next connect.
+    boot_len = mive_boot_json(boot_buf, sizeof(boot_buf));
+    if(boot_len > 0)
+    {
+      mive_publish(program, MIVE_TOPIC_BOOT, boot_buf, boot_len);
+    }
+    history_resume(program);
+    break;
+  case MIVE_EVENT_NET_DRAINED:
+    // The broker fell behind, whatever got parked meanwhile goes out now.
+    if(__atomic_load_n(&program->outbox.online, __ATOMIC_ACQUIRE))
+    {
+      mive_publish_flush(program);
+      history_resume(program);
+    }
+    break;
+  case MIVE_EVENT_SEND_AUTH_STATE:
+    mive_publish(program, MIVE_TOPIC_REGISTER_NFC_STATE, mive_nfc_get_state_str(program->nfc_state), 0);
+    state_doc_update(program, MIVE_STATE_DOC_AUTH, program->nfc_state, true);
+    if(program->nfc_state >= NFC_STATE_SUCCESS)
+    {
+      mive_scheduler_arm(&program->scheduler, MIVE_JOB_AUTH_IDLE, esp_timer_get_time(), MIVE_AUTH_IDLE_DELAY_MS * 1000, 0);
+    }
+    update_duty(program);
+    break;
+  case MIVE_EVENT_GET_GARAGE_INFO:
+    // Only queues the read, the result comes back as MIVE_EVENT_GARAGE_DONE.
+    retval = mive_garage_read_async(&program->garage_handle, source);
+    if(retval != ESP_OK && retval != ESP_ERR_NOT_ALLOWED)
+    {
+      ESP_LOGD(TAG, "Door not read (%s)", esp_err_to_name(retval));
+    }
+    break;
+  case MIVE_EVENT_GARAGE_DONE:
+    garage_result.op = event->event_data.garage_done.op;
+    garage_result.tag = source;
+    garage_result.state = event->event_data.garage_done.state;
+    garage_result.status = event->event_data.garage_done.status;
+    garage_result.elapsed_us = event->event_data.garage_done.elapsed_us;
+    mive_garage_complete(&program->garage_handle, &garage_result);
+    mive_metrics_record(&program->metrics, source, MIVE_STAGE_I2C, garage_result.elapsed_us);
+
+    if(garage_result.op == MIVE_GARAGE_OP_ACTUATE)
+    {
+      if(garage_result.status != ESP_OK)
+      {
+        ESP_LOGE(TAG, "Error (%s) sending the relay pulse", esp_err_to_name(garage_result.status));
+      }
+      if(source == MIVE_SOURCE_ESPNOW)
+      {
+        // Only now the remote learns whether the door got the pulse.
+        mive_espnow_link_pulse_done(&program->espnow, garage_result.status == ESP_OK,
+                                    (garage_result.status == ESP_OK) ? mive_garage_next_state(program->garage_state) : program->garage_state);
+      }
+      break;
+    }
+
+    if(garage_result.status == ESP_OK)
+    {
+      new_garage_state = garage_result.state;
+      mive_boot_mark(MIVE_BOOT_DOOR);
+    }
+    else if(program->garage_handle.failures < MIVE_GARAGE_REINIT_AFTER)
+    {
+      // A glitch, keep the last state while the bus gets reset.
+      break;
+    }
+    else if(program->garage_handle.failures == MIVE_GARAGE_REINIT_AFTER)
+    {
+      history_add(program, MIVE_HISTORY_FAULT, source, MIVE_HISTORY_NO_CREDENTIAL, 0, program->garage_handle.failures);
+    }
+
+    if(new_garage_state != program->garage_state)
+    {
+      program->garage_state = new_garage_state;
+      mive_trace(MIVE_TRACE_DOOR_STATE, source, program->garage_state, 0);
+      history_add(program, MIVE_HISTORY_DOOR, source, MIVE_HISTORY_NO_CREDENTIAL, 0, program->garage_state);
+      mive_duty_activity(&program->duty, esp_timer_get_time());
+      update_duty(program);
+      mive_metrics_actuation_confirmed(&program->metrics, esp_timer_get_time());
+      event->event_type = MIVE_EVENT_SEND_GARAGE_INFO;
+      mive_event_queue_send(&program->main_queue, event, 0);
+      if(mive_garage_is_moving(program->garage_state))
+      {
+        // Don't sit out a slow period while the door is moving.
+        schedule_ranging(program, MIVE_PRESENCE_FAST_PERIOD_MS);
+      }
+    }
+    break;
+  case MIVE_EVENT_START_GARAGE:
+    if(source == MIVE_SOURCE_NFC)
+    {
+      // Whoever tapped may tap again (to stop the door), keep the reader fast.
+      mive_duty_activity(&program->duty, esp_timer_get_time());
+      update_duty(program);
+    }
+    applies = mive_garage_command_applies(program->garage_state, event->event_data.start_garage.command);
+    mive_trace(MIVE_TRACE_ACTUATE, source, event->event_data.start_garage.command, applies);
+    if(applies)
+    {
+      retval = mive_garage_actuate_async(&program->garage_handle, source);
+      if(retval == ESP_OK)
+      {
+        espnow_result = MIVE_ESPNOW_RESULT_ACTUATED;
+        mive_metrics_actuation_started(&program->metrics, source, event->ingress_us);
+        if(source == MIVE_SOURCE_ESPNOW)
+        {
+          mive_espnow_link_pulse_queued(&program->espnow, event->event_data.start_garage.espnow_ack, event->event_data.start_garage.espnow_peer,
+                                        event->event_data.start_garage.espnow_counter, event->event_data.start_garage.espnow_seq,
+                                        event->event_data.start_garage.command);
+        }
+      }
+      else
+      {
+        ESP_LOGE(TAG, "Error (%s) queueing the relay pulse", esp_err_to_name(retval));
+        espnow_result = MIVE_ESPNOW_RESULT_BUSY;
+      }
+    }
+    else
+    {
+      MIVE_DLOGI(TAG, "Command %d doesn't apply in %s", event->event_data.start_garage.command, mive_garage_get_state_str(program->garage_state));
+    }
+    history_add(program, MIVE_HISTORY_COMMAND, source,
+                (source == MIVE_SOURCE_NFC) ? event->event_data.start_garage.credential : MIVE_HISTORY_NO_CREDENTIAL,
+                (espnow_result == MIVE_ESPNOW_RESULT_ACTUATED) ? MIVE_HISTORY_RESULT_OK :
+                (espnow_result == MIVE_ESPNOW_RESULT_BUSY) ? MIVE_HISTORY_RESULT_BUSY : MIVE_HISTORY_RESULT_NOT_APPLICABLE,
+                event->event_data.start_garage.command);
+    // An actuated press gets its ACK with the pulse's MIVE_EVENT_GARAGE_DONE.
+    if(event->event_data.start_garage.espnow_ack && espnow_result == MIVE_ESPNOW_RESULT_NOT_APPLICABLE)
+    {
+      mive_espnow_link_ack(&program->espnow, event->event_data.start_garage.espnow_peer, event->event_data.start_garage.espnow_counter,
+                           event->event_data.start_garage.espnow_seq, event->event_data.start_garage.command, espnow_result, program->garage_state);
+    }
+    else if(event->event_data.start_garage.espnow_ack && espnow_result == MIVE_ESPNOW_RESULT_BUSY)
+    {
+      mive_espnow_link_busy(&program->espnow, event->event_data.start_garage.espnow_peer, event->event_data.start_garage.espnow_counter,
+                            event->event_data.start_garage.espnow_seq, event->event_data.start_garage.command, program->garage_state);
+    }
+    event->event_type = MIVE_EVENT_GET_GARAGE_INFO;
+    mive_event_queue_send(&program->main_queue, event, 0);
+    break;
+  case MIVE_EVENT_SEND_GARAGE_INFO:
+    mive_publish(program, MIVE_TOPIC_STATE, mive_garage_get_state_str(program->garage_state), 0);
+    state_doc_update(program, MIVE_STATE_DOC_GARAGE, program->garage_state, true);
+    break;
+  case MIVE_EVENT_MEASURE_DISTANCE:
+    // Only fires the ping, the result comes back as MIVE_EVENT_DISTANCE_READY.
+    retval = mive_ranging_trigger(&program->ranging);
+    if(retval != ESP_OK)
+    {
+      ESP_LOGD(TAG, "Previous ping still in flight");
+    }
+    // Fallback in case the result gets lost, the reading re-arms this.
+    schedule_ranging(program, MIVE_PRESENCE_SLOW_PERIOD_MS);
+    break;
+  case MIVE_EVENT_DISTANCE_READY:
+    // Lets the capture and timeout timers go, they keep the chip out of light sleep.
+    mive_ranging_release(&program->ranging);
+    ranging_result.status = event->event_data.distance_ready.status;
+    ranging_result.distance_cm = event->event_data.distance_ready.distance_cm;
+    if(ranging_result.status == MIVE_RANGING_PING_TIMEOUT)
+    {
+      MIVE_DLOGW(TAG, "Ranging error: %s", mive_ranging_status_str(ranging_result.status));
+    }
+
+    presence_changed = mive_presence_update(&program->presence, &ranging_result, esp_timer_get_time());
+    if(presence_changed)
+    {
+      publish_presence(program, presence_changed);
+    }
+
+    schedule_ranging(program, mive_duty_ranging_period_ms(&program->duty, &program->presence, mive_garage_is_moving(program->garage_state),
+                                                          esp_timer_get_time()));
+    update_duty(program);
+    break;
+  case MIVE_EVENT_SEND_PRESENCE:
+    publish_presence(program, MIVE_PRESENCE_CHANGED_DISTANCE | MIVE_PRESENCE_CHANGED_STATE);
+    break;
+  case MIVE_EVENT_REGISTER_CARD:
+    mive_nfc_set_state(program, NFC_STATE_WAITING_FOR_CARD);
+    update_duty(program);
+    event->event_type = MIVE_EVENT_SEND_AUTH_STATE;
+    mive_event_queue_send(&program->main_queue, event, 0);
+    break;
+  case MIVE_EVENT_SAVE_UUID:
+    mive_nfc_ensure_loaded(program);
+    mive_nfc_save_uuids(program);
+    break;
+  case MIVE_EVENT_LOAD_CREDENTIALS:
+    mive_nfc_ensure_loaded(program);
+    break;
+  case MIVE_EVENT_CHECK_CARD:
+    // Tapped before the card list was loaded, see mive_nfc_on_picc_state_changed.
+    mive_nfc_ensure_loaded(program);
+    credential = mive_nfc_find(program, event->event_data.nfc_card.uid, event->event_data.nfc_card.length);
+    mive_trace(MIVE_TRACE_NFC_CARD, source, NFC_STATE_IDLE, credential >= 0);
+    if(credential >= 0)
+    {
+      event->event_type = MIVE_EVENT_START_GARAGE;
+      memset(&event->event_data.start_garage, 0, sizeof(event->event_data.start_garage));
+      event->event_data.start_garage.credential = credential;
+    }
+    else
+    {
+      event->event_type = MIVE_EVENT_CARD_REJECTED;
+    }
+    mive_event_queue_send(&program->main_queue, event, 0);
+    break;
+  case MIVE_EVENT_ENROLL_CARD:
+    // The registration may have timed out since the card was read.
+    if(program->nfc_state != NFC_STATE_WAITING_FOR_CARD)
+    {
+      break;
+    }
+    mive_nfc_ensure_loaded(program);
+    if(mive_nfc_enroll(program, event->event_data.nfc_card.uid, event->event_data.nfc_card.length))
+    {
+      mive_nfc_set_state(program, NFC_STATE_REMOVE_CARD);
+      event->event_type = MIVE_EVENT_SAVE_UUID;
+      mive_event_queue_send(&program->main_queue, event, 0);
+    }
+    else
+    {
+      mive_nfc_set_state(program, NFC_STATE_FAIL);
+    }
+    event->event_type = MIVE_EVENT_SEND_AUTH_STATE;
+    mive_event_queue_send(&program->main_queue, event, 0);
+    break;
+  case MIVE_EVENT_CARD_REMOVED:
+    if(program->nfc_state == NFC_STATE_REMOVE_CARD)
+    {
+      mive_nfc_set_state(program, NFC_STATE_SUCCESS);
+      event->event_type = MIVE_EVENT_SEND_AUTH_STATE;
+      mive_event_queue_send(&program->main_queue, event, 0);
+    }
+    break;
+  case MIVE_EVENT_RESET_GARAGE_SWITCH:
+    program->switch_state = 0;
+    mive_publish(program, MIVE_TOPIC_SWITCH_STATE, "OFF", 0);
+    state_doc_update(program, MIVE_STATE_DOC_SWITCH, program->switch_state, true);
+    break;
+  case MIVE_EVENT_SEND_STATE_DOC:
+    state_doc_len = mive_state_doc_take(&program->state_doc, state_doc_buf, sizeof(state_doc_buf));
+    if(state_doc_len > 0)
+    {
+      mive_publish(program, MIVE_TOPIC_STATUS, (char*)state_doc_buf, state_doc_len);
+#if MIVE_WS_ENABLE
+      mive_ws_push_state(&program->ws, state_doc_buf, state_doc_len);
+#endif
+    }
+    else if(state_doc_len < 0)
+    {
+      ESP_LOGE(TAG, "State document doesn't fit in %u bytes", (unsigned)sizeof(state_doc_buf));
+    }
+    break;
+  case MIVE_EVENT_PUBLISH_METRICS:
+    metrics_len = mive_metrics_take_json(&program->metrics, &program->main_queue, &program->garage_handle.stats, &program->net.stats, metrics_buf, sizeof(metrics_buf));
+    if(metrics_len > 0)
+    {
+      mive_publish(program, MIVE_TOPIC_METRICS, metrics_buf, metrics_len);
+    }
+    else
+    {
+      ESP_LOGE(TAG, "Metrics don't fit in %u bytes", (unsigned)sizeof(metrics_buf));
+    }
+    break;
+  case MIVE_EVENT_NFC_DUTY:
+#if MIVE_NFC_IRQ_MODE
+    nfc_irq_tick(program);
+    break;
+#endif
+    if(program->duty.nfc_mode != MIVE_DUTY_SLOW)
+    {
+      break;
+    }
+    mive_nfc_set_scanning(program, !program->duty.nfc_scanning);
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, esp_timer_get_time(),
+                       (program->duty.nfc_scanning ? MIVE_DUTY_NFC_SLOW_ON_MS : MIVE_DUTY_NFC_SLOW_PERIOD_MS - MIVE_DUTY_NFC_SLOW_ON_MS) * 1000, 0);
+    break;
+#if MIVE_NFC_IRQ_MODE
+  case MIVE_EVENT_NFC_FIELD:
+    if(program->duty.nfc_mode == MIVE_DUTY_OFF)
+    {
+      break;
+    }
+    // A card answered a probe, the reader component selects and reports it.
+    program->nfc_irq.session_us = esp_timer_get_time();
+    mive_nfc_irq_disarm(&program->nfc_irq);
+    mive_nfc_set_scanning(program, true);
+    mive_scheduler_arm(&program->scheduler, MIVE_JOB_NFC_DUTY, program->nfc_irq.session_us, MIVE_NFC_IRQ_SESSION_MS * 1000, 0);
+    break;
+#endif
+  case MIVE_EVENT_CARD_REJECTED:
+    history_add(program, MIVE_HISTORY_CARD_REJECTED, source, MIVE_HISTORY_NO_CREDENTIAL, 0, program->nfc_state);
+    break;
+  case MIVE_EVENT_HISTORY_FLUSH:
+    mive_scheduler_cancel(&program->scheduler, MIVE_JOB_HISTORY_FLUSH);
+    mive_history_flush(&program->history);
+    break;
+  case MIVE_EVENT_HISTORY_QUERY:
+    history_len = mive_history_query(&program->history, event->event_data.history_query.from_s, event->event_data.history_query.to_s,
+                                     event->event_data.history_query.cursor, history_buf, sizeof(history_buf));
+    if(history_len < 0)
+    {
+      break;
+    }
+    // Replies are bulk and get dropped when the broker is behind, the same
+    // page goes out again once it drains.
+    if(mive_publish(program, MIVE_TOPIC_HISTORY, (char*)history_buf, history_len) != 1)
+    {
+      history_park(program, &event->event_data.history_query);
+      break;
+    }
+    // One reply per event, the rest of the range follows behind whatever
+    // else is queued.
+    event->event_data.history_query.cursor = ((mive_history_header_t*)history_buf)->next;
+    if(event->event_data.history_query.cursor != 0 && mive_event_queue_send(&program->main_queue, event, 0) != pdTRUE)
+    {
+      history_park(program, &event->event_data.history_query);
+    }
+    break;
+  case MIVE_EVENT_DUMP_TRACE:
+    trace_len = mive_trace_dump(trace_buf, sizeof(trace_buf));
+    if(trace_len < 0)
+    {
+      break;
+    }
+    if(event->event_data.dump_trace.console)
+    {
+      mive_trace_dump_console(trace_buf, trace_len);
+    }
+    else
+    {
+      mive_publish(program, MIVE_TOPIC_TRACE, (char*)trace_buf, trace_len);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+bool mive_control_take_due(mive_program_t* program, mive_event_t* event)
+{
+  int64_t due_us = 0;
+  int job = mive_scheduler_take_due(&program->scheduler, esp_timer_get_time(), &due_us);
+
+  if(job < 0)
+  {
+    return false;
+  }
+
+  if(job == MIVE_JOB_AUTH_IDLE)
+  {
+    mive_nfc_set_state(program, NFC_STATE_IDLE);
+  }
+
+  memset(event, 0, sizeof(*event));
+  event->event_type = job_event[job];
+  event->source = MIVE_SOURCE_TIMER;
+  // Queue time of a job is how late it ran.
+  event->ingress_us = due_us;
+  event->enqueued_us = due_us;
+  return true;
+}
+
+TickType_t mive_control_timeout(mive_program_t* program)
+{
+  return mive_scheduler_timeout(&program->scheduler, esp_timer_get_time());
+}
+
+static void dispatch(mive_program_t* program, mive_event_t* event)
+{
+  int64_t dequeued_us = esp_timer_get_time();
+  enum mive_event_source_e source = event->source;
+  unsigned int event_type = event->event_type;
+
+  program->metrics.current_source = source;
+  mive_metrics_record(&program->metrics, source, MIVE_STAGE_QUEUE, dequeued_us - event->enqueued_us);
+  mive_trace(MIVE_TRACE_EVENT_BEGIN, source, event_type, 0);
+
+  mive_power_hold();
+  mive_control_handle_event(program, event);
+  mive_power_release();
+
+  mive_trace(MIVE_TRACE_EVENT_END, source, event_type, 0);
+  mive_metrics_record(&program->metrics, source, MIVE_STAGE_HANDLER, esp_timer_get_time() - dequeued_us);
+}
+
+void mive_control_run(mive_program_t* program)
+{
+  mive_event_t event = {0};
+
+  while(1)
+  {
+    while(mive_control_take_due(program, &event))
+    {
+      dispatch(program, &event);
+    }
+
+    if (mive_event_queue_receive(&program->main_queue, &event, mive_control_timeout(program)) == pdTRUE)
+    {
+      dispatch(program, &event);
+    }
+  }
+}
+
+void mive_control_espnow_received(mive_program_t* program, const uint8_t* mac, const uint8_t* data, int len)
+{
+  mive_espnow_frame_t frame;
+  uint8_t peer = 0;
+  enum mive_espnow_rx_e rx = mive_espnow_link_receive(&program->espnow, mac, data, len, &frame, &peer);
+  mive_event_t event = {
+    .event_type = MIVE_EVENT_START_GARAGE,
+    .source = MIVE_SOURCE_ESPNOW,
+  };
+
+  mive_trace(MIVE_TRACE_ESPNOW_RX, MIVE_SOURCE_ESPNOW, len, rx);
+
+  switch (rx)
+  {
+  case MIVE_ESPNOW_RX_LEGACY:
+    mive_event_queue_send(&program->main_queue, &event, 0);
+    break;
+  case MIVE_ESPNOW_RX_NEW:
+    event.event_data.start_garage.command = frame.command;
+    event.event_data.start_garage.espnow_ack = 1;
+    event.event_data.start_garage.espnow_seq = frame.seq;
+    event.event_data.start_garage.espnow_counter = frame.counter;
+    event.event_data.start_garage.espnow_peer = peer;
+    // Don't block the Wi-Fi task, the remote retries on BUSY.
+    if(mive_event_queue_send(&program->main_queue, &event, 0) != pdTRUE)
+    {
+      mive_espnow_link_cancel(&program->espnow, peer, &frame);
+      mive_espnow_link_reply(mac, &frame, MIVE_ESPNOW_RESULT_BUSY, program->garage_state);
+    }
+    break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+#include "include/dlog.h"
+#include "include/sysmon.h"
+
+static QueueHandle_t dlog_queue = NULL;
+#if MIVE_STATIC_ALLOC
+static StaticQueue_t dlog_queue_buffer;
+static uint8_t dlog_queue_storage[MIVE_DLOG_QUEUE_LEN * sizeof(mive_dlog_record_t)];
+static StaticTask_t dlog_task_buffer;
+static StackType_t dlog_task_stack[MIVE_DLOG_TASK_STACK];
+#endif
+static uint32_t dlog_dropped = 0;
+
+static const char dlog_level_char[] = {
+  [MIVE_DLOG_NONE] = '-',
+  [MIVE_DLOG_ERROR] = 'E',
+  [MIVE_DLOG_WARN] = 'W',
+  [MIVE_DLOG_INFO] = 'I',
+  [MIVE_DLOG_DEBUG] = 'D',
+  [MIVE_DLOG_VERBOSE] = 'V',
+};
+
+void mive_dlog_write(mive_dlog_site_t* site, uint8_t level, const char* tag, uint8_t data_kind, const void* data, size_t data_len, uint8_t nargs, const char* fmt, ...)
+{
+  mive_dlog_record_t record;
+  int64_t now = esp_timer_get_time();
+  va_list args;
+
+  // Races between two tasks logging from the same site only make the limit
+  // a little less exact.
+  if(now - site->window_start_us >= (int64_t)MIVE_DLOG_RATE_WINDOW_MS * 1000)
+  {
+    site->window_start_us = now;
+    site->count = 0;
+  }
+
+  if(site->count >= MIVE_DLOG_RATE_BURST)
+  {
+    if(site->suppressed < UINT16_MAX)
+    {
+      site->suppressed++;
+    }
+    return;
+  }
+  site->count++;
+
+  record.time_us = now;
+  record.tag = tag;
+  record.fmt = fmt;
+  record.level = level;
+  record.suppressed = site->suppressed;
+  site->suppressed = 0;
+
+  va_start(args, fmt);
+  for(uint8_t i = 0; i < MIVE_DLOG_MAX_ARGS; ++i)
+  {
+    record.args[i] = (i < nargs) ? va_arg(args, uintptr_t) : 0;
+  }
+  va_end(args);
+
+  record.data_kind = (data != NULL) ? data_kind : MIVE_DLOG_DATA_NONE;
+  record.data_total = (data_len > UINT16_MAX) ? UINT16_MAX : data_len;
+  record.data_len = (data_len > MIVE_DLOG_DATA_LEN) ? MIVE_DLOG_DATA_LEN : data_len;
+  if(record.data_kind != MIVE_DLOG_DATA_NONE)
+  {
+    memcpy(record.data, data, record.data_len);
+  }
+
+  if(dlog_queue == NULL || xQueueSend(dlog_queue, &record, 0) != pdTRUE)
+  {
+    __atomic_fetch_add(&dlog_dropped, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static void dlog_print(const mive_dlog_record_t* record)
+{
+  char line[MIVE_DLOG_LINE_LEN];
+  size_t pos = 0;
+  char level = (record->level <= MIVE_DLOG_VERBOSE) ? dlog_level_char[record->level] : '?';
+
+  pos += snprintf(line, sizeof(line), "%c (%lu) %s: ", level, (unsigned long)(record->time_us / 1000), record->tag);
+  if(pos < sizeof(line))
+  {
+    pos += snprintf(line + pos, sizeof(line) - pos, record->fmt,
+                    record->args[0], record->args[1], record->args[2],
+                    record->args[3], record->args[4], record->args[5]);
+  }
+
+  if(record->data_kind == MIVE_DLOG_DATA_TEXT && pos < sizeof(line))
+  {
+    pos += snprintf(line + pos, sizeof(line) - pos, " %.*s", record->data_len, (const char*)record->data);
+  }
+  else if(record->data_kind == MIVE_DLOG_DATA_HEX)
+  {
+    for(uint8_t i = 0; i < record->data_len && pos < sizeof(line); ++i)
+    {
+      pos += snprintf(line + pos, sizeof(line) - pos, " %02x", record->data[i]);
+    }
+  }
+
+  if(record->data_total > record->data_len && pos < sizeof(line))
+  {
+    pos += snprintf(line + pos, sizeof(line) - pos, " ... (%u bytes)", record->data_total);
+  }
+
+  if(record->suppressed && pos < sizeof(line))
+  {
+    pos += snprintf(line + pos, sizeof(line) - pos, " (%u suppressed)", record->suppressed);
+  }
+
+  puts(line);
+}
+
+static void dlog_task(void* context)
+{
+  mive_dlog_record_t record;
+  uint32_t reported = 0;
+
+  while(1)
+  {
+    if(xQueueReceive(dlog_queue, &record, portMAX_DELAY) == pdTRUE)
+    {
+      dlog_print(&record);
+    }
+
+    uint32_t dropped = __atomic_load_n(&dlog_dropped, __ATOMIC_RELAXED);
+    if(dropped != reported)
+    {
+      printf("W dlog: %lu records dropped\n", (unsigned long)(dropped - reported));
+      reported = dropped;
+    }
+  }
+}
+
+void mive_dlog_init(void)
+{
+  if(dlog_queue != NULL)
+  {
+    return;
+  }
+
+#if MIVE_STATIC_ALLOC
+  dlog_queue = xQueueCreateStatic(MIVE_DLOG_QUEUE_LEN, sizeof(mive_dlog_record_t), dlog_queue_storage, &dlog_queue_buffer);
+  xTaskCreateStaticPinnedToCore(dlog_task, "dlog", MIVE_DLOG_TASK_STACK, NULL, MIVE_DLOG_TASK_PRIO, dlog_task_stack, &dlog_task_buffer,
+                                MIVE_NET_CORE);
+#else
+  dlog_queue = xQueueCreate(MIVE_DLOG_QUEUE_LEN, sizeof(mive_dlog_record_t));
+  if(dlog_queue == NULL)
+  {
+    return;
+  }
+
+  xTaskCreatePinnedToCore(dlog_task, "dlog", MIVE_DLOG_TASK_STACK, NULL, MIVE_DLOG_TASK_PRIO, NULL, MIVE_NET_CORE);
+#endif
+}
+
+uint32_t mive_dlog_dropped(void)
+{
+  return __atomic_load_n(&dlog_dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "include/duty.h"
+
+static const char* duty_mode_str[] = {
+  [MIVE_DUTY_OFF] = "OFF",
+  [MIVE_DUTY_SLOW] = "SLOW",
+  [MIVE_DUTY_FAST] = "FAST",
+};
+
+void mive_duty_init(mive_duty_t* duty, int64_t now_us)
+{
+  memset(duty, 0, sizeof(*duty));
+  duty->last_activity_us = now_us;
+  duty->nfc_mode = MIVE_DUTY_FAST;
+  duty->nfc_scanning = true;
+}
+
+void mive_duty_activity(mive_duty_t* duty, int64_t now_us)
+{
+  duty->last_activity_us = now_us;
+}
+
+// Time since anything happened, motion in front of the sensor included.
+static int64_t idle_us(const mive_duty_t* duty, const mive_presence_t* presence, int64_t now_us)
+{
+  int64_t last_us = duty->last_activity_us;
+
+  if(presence->last_motion_us > last_us)
+  {
+    last_us = presence->last_motion_us;
+  }
+
+  return now_us - last_us;
+}
+
+enum mive_duty_mode_e mive_duty_nfc_mode(const mive_duty_t* duty, const mive_presence_t* presence, bool door_moving,
+                                         bool registering, int64_t now_us)
+{
+  int64_t idle = idle_us(duty, presence, now_us);
+
+  if(registering || door_moving || idle < MIVE_DUTY_ACTIVE_HOLD_MS * 1000LL)
+  {
+    return MIVE_DUTY_FAST;
+  }
+
+  if(MIVE_DUTY_NFC_OFF_WHEN_QUIET && idle >= MIVE_DUTY_QUIET_MS * 1000LL)
+  {
+    return MIVE_DUTY_OFF;
+  }
+
+  return MIVE_DUTY_SLOW;
+}
+
+uint32_t mive_duty_ranging_period_ms(const mive_duty_t* duty, mive_presence_t* presence, bool door_moving, int64_t now_us)
+{
+  uint32_t period_ms = mive_presence_next_period_ms(presence, door_moving, now_us);
+
+  if(period_ms == MIVE_PRESENCE_SLOW_PERIOD_MS && idle_us(duty, presence, now_us) >= MIVE_DUTY_QUIET_MS * 1000LL)
+  {
+    return MIVE_DUTY_RANGING_QUIET_PERIOD_MS;
+  }
+
+  return period_ms;
+}
+
+const char* mive_duty_mode_str(enum mive_duty_mode_e mode)
+{
+  if(mode > MIVE_DUTY_FAST)
+  {
+    return NULL;
+  }
+
+  return duty_mode_str[mode];
+}
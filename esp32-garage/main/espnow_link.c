@@ -0,0 +1,255 @@
+#include <string.h>
+#include "esp_now.h"
+#include "esp_timer.h"
+
+#include "include/espnow_link.h"
+#include "include/dlog.h"
+
+static const char *TAG = "espnow_link";
+
+static void send_frame(const uint8_t* mac, const mive_espnow_frame_t* frame)
+{
+  esp_err_t retval = esp_now_send(mac, (const uint8_t*)frame, sizeof(*frame));
+
+  if(retval != ESP_OK)
+  {
+    MIVE_DLOGW(TAG, "ACK for seq %u not sent (0x%x)", frame->seq, retval);
+  }
+}
+
+static void fill_ack(mive_espnow_frame_t* ack, uint32_t counter, uint16_t seq, uint8_t command, uint8_t result, uint8_t state)
+{
+  memset(ack, 0, sizeof(*ack));
+  ack->magic = MIVE_ESPNOW_MAGIC;
+  ack->version = MIVE_ESPNOW_VERSION;
+  ack->type = MIVE_ESPNOW_TYPE_ACK;
+  ack->command = command;
+  ack->result = result;
+  ack->counter = counter;
+  ack->seq = seq;
+  ack->state = state;
+}
+
+void mive_espnow_link_init(mive_espnow_link_t* link)
+{
+  memset(link, 0, sizeof(*link));
+  portMUX_INITIALIZE(&link->lock);
+}
+
+esp_err_t mive_espnow_link_add_peer(mive_espnow_link_t* link, const uint8_t* mac)
+{
+  for(uint32_t i = 0; i < MIVE_ESPNOW_MAX_PEERS; ++i)
+  {
+    if(!link->peers[i].used)
+    {
+      memcpy(link->peers[i].mac, mac, MIVE_ESPNOW_ADDR_LEN);
+      link->peers[i].used = true;
+      return ESP_OK;
+    }
+  }
+
+  return ESP_ERR_NO_MEM;
+}
+
+static int peer_find(mive_espnow_link_t* link, const uint8_t* mac)
+{
+  for(uint32_t i = 0; i < MIVE_ESPNOW_MAX_PEERS; ++i)
+  {
+    if(link->peers[i].used && memcmp(link->peers[i].mac, mac, MIVE_ESPNOW_ADDR_LEN) == 0)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+enum mive_espnow_rx_e mive_espnow_link_receive(mive_espnow_link_t* link, const uint8_t* mac, const uint8_t* data, int len, mive_espnow_frame_t* frame, uint8_t* peer)
+{
+  enum mive_espnow_rx_e retval = MIVE_ESPNOW_RX_NEW;
+  struct mive_espnow_press* last = NULL;
+  mive_espnow_frame_t ack;
+  uint32_t magic_val = 0;
+  int index = peer_find(link, mac);
+
+  if(index < 0)
+  {
+    return MIVE_ESPNOW_RX_UNKNOWN_PEER;
+  }
+  *peer = index;
+  last = &link->peers[index].last;
+
+  if(len == (int)sizeof(magic_val))
+  {
+    memcpy(&magic_val, data, sizeof(magic_val));
+    return (magic_val == MIVE_ESPNOW_MAGIC) ? MIVE_ESPNOW_RX_LEGACY : MIVE_ESPNOW_RX_INVALID;
+  }
+
+  if(!mive_espnow_frame_parse(data, len, frame) || frame->type != MIVE_ESPNOW_TYPE_COMMAND)
+  {
+    return MIVE_ESPNOW_RX_INVALID;
+  }
+
+  // Accepted here already, main_task may ACK before this task runs again.
+  taskENTER_CRITICAL(&link->lock);
+  if(last->seen)
+  {
+    if(frame->counter == last->counter && frame->seq == last->seq)
+    {
+      retval = MIVE_ESPNOW_RX_DUPLICATE;
+    }
+    else if(frame->counter < last->counter ||
+            (frame->counter == last->counter && !mive_espnow_seq_after(frame->seq, last->seq)))
+    {
+      retval = MIVE_ESPNOW_RX_STALE;
+    }
+  }
+  ack = last->ack;
+  if(retval == MIVE_ESPNOW_RX_NEW)
+  {
+    link->peers[index].undo = *last;
+    last->seen = true;
+    last->counter = frame->counter;
+    last->seq = frame->seq;
+    memset(&last->ack, 0, sizeof(last->ack));
+    // The ACK goes out for the first transmission's attempt number.
+    last->ack.attempt = frame->attempt;
+  }
+  taskEXIT_CRITICAL(&link->lock);
+
+  if(retval == MIVE_ESPNOW_RX_DUPLICATE && ack.type == MIVE_ESPNOW_TYPE_ACK)
+  {
+    // The first ACK got lost, the press has been carried out already.
+    ack.attempt = frame->attempt;
+    send_frame(mac, &ack);
+  }
+
+  return retval;
+}
+
+// Back to the press before if counter and seq are still the last one,
+// attempt is what its ACK would have carried.
+static bool press_cancel(mive_espnow_link_t* link, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t* attempt)
+{
+  struct mive_espnow_peer* entry = &link->peers[peer];
+  bool current = false;
+
+  taskENTER_CRITICAL(&link->lock);
+  if(entry->last.seen && entry->last.counter == counter && entry->last.seq == seq)
+  {
+    *attempt = entry->last.ack.attempt;
+    entry->last = entry->undo;
+    current = true;
+  }
+  taskEXIT_CRITICAL(&link->lock);
+
+  return current;
+}
+
+void mive_espnow_link_cancel(mive_espnow_link_t* link, uint8_t peer, const mive_espnow_frame_t* frame)
+{
+  uint8_t attempt = 0;
+
+  press_cancel(link, peer, frame->counter, frame->seq, &attempt);
+}
+
+void mive_espnow_link_busy(mive_espnow_link_t* link, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t command, uint8_t state)
+{
+  mive_espnow_frame_t ack;
+  uint8_t attempt = 0;
+
+  if(press_cancel(link, peer, counter, seq, &attempt))
+  {
+    fill_ack(&ack, counter, seq, command, MIVE_ESPNOW_RESULT_BUSY, state);
+    ack.attempt = attempt;
+    send_frame(link->peers[peer].mac, &ack);
+  }
+}
+
+void mive_espnow_link_reply(const uint8_t* mac, const mive_espnow_frame_t* frame, uint8_t result, uint8_t state)
+{
+  mive_espnow_frame_t ack;
+
+  fill_ack(&ack, frame->counter, frame->seq, frame->command, result, state);
+  ack.attempt = frame->attempt;
+  send_frame(mac, &ack);
+}
+
+void mive_espnow_link_ack(mive_espnow_link_t* link, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t command, uint8_t result, uint8_t state)
+{
+  struct mive_espnow_press* last = &link->peers[peer].last;
+  mive_espnow_frame_t ack;
+  bool current = false;
+
+  taskENTER_CRITICAL(&link->lock);
+  if(last->seen && last->counter == counter && last->seq == seq)
+  {
+    uint8_t attempt = last->ack.attempt;
+
+    fill_ack(&last->ack, counter, seq, command, result, state);
+    last->ack.attempt = attempt;
+    ack = last->ack;
+    current = true;
+  }
+  taskEXIT_CRITICAL(&link->lock);
+
+  if(current)
+  {
+    send_frame(link->peers[peer].mac, &ack);
+  }
+}
+
+void mive_espnow_link_pulse_queued(mive_espnow_link_t* link, bool ack, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t command)
+{
+  int64_t now_us = esp_timer_get_time();
+
+  // A transfer flushed as stuck never completes, long after the remote's
+  // deadline nothing can still be in flight.
+  if(now_us - link->queued_us > MIVE_ESPNOW_DEADLINE_MS * 1000LL)
+  {
+    link->pulses = 0;
+    link->waiting = false;
+  }
+  link->queued_us = now_us;
+
+  if(ack)
+  {
+    // Whatever waited before is superseded, mive_espnow_link_ack would drop it.
+    link->waiting = true;
+    link->skip = link->pulses;
+    link->wait_peer = peer;
+    link->wait_counter = counter;
+    link->wait_seq = seq;
+    link->wait_command = command;
+  }
+  link->pulses++;
+}
+
+void mive_espnow_link_pulse_done(mive_espnow_link_t* link, bool ok, uint8_t state)
+{
+  if(link->pulses > 0)
+  {
+    link->pulses--;
+  }
+
+  if(!link->waiting)
+  {
+    return;
+  }
+  if(link->skip > 0)
+  {
+    link->skip--;
+    return;
+  }
+
+  link->waiting = false;
+  if(ok)
+  {
+    mive_espnow_link_ack(link, link->wait_peer, link->wait_counter, link->wait_seq, link->wait_command, MIVE_ESPNOW_RESULT_ACTUATED, state);
+  }
+  else
+  {
+    // The door didn't get the pulse, the remote may send the press again.
+    mive_espnow_link_busy(link, link->wait_peer, link->wait_counter, link->wait_seq, link->wait_command, state);
+  }
+}
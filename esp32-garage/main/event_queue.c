@@ -0,0 +1,318 @@
+#include <string.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "include/event_queue.h"
+#include "include/trace.h"
+#include "include/dlog.h"
+
+static const char *TAG = "event_queue";
+
+static const uint8_t lane_depth[MIVE_LANE_MAX] = {
+  [MIVE_LANE_ACTUATION] = MIVE_LANE_ACTUATION_DEPTH,
+  [MIVE_LANE_CONTROL] = MIVE_LANE_CONTROL_DEPTH,
+  [MIVE_LANE_TELEMETRY] = MIVE_LANE_TELEMETRY_DEPTH,
+  [MIVE_LANE_HOUSEKEEPING] = MIVE_LANE_HOUSEKEEPING_DEPTH,
+};
+
+static const uint8_t event_lane[] = {
+  [MIVE_EVENT_NONE] = MIVE_LANE_HOUSEKEEPING,
+  [MIVE_EVENT_GET_GARAGE_INFO] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_SEND_GARAGE_INFO] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_SEND_AUTH_STATE] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_START_GARAGE] = MIVE_LANE_ACTUATION,
+  [MIVE_EVENT_MEASURE_DISTANCE] = MIVE_LANE_TELEMETRY,
+  [MIVE_EVENT_REGISTER_CARD] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_MQTT_CONNECTED] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_SAVE_UUID] = MIVE_LANE_HOUSEKEEPING,
+  [MIVE_EVENT_RESET_GARAGE_SWITCH] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_DISTANCE_READY] = MIVE_LANE_TELEMETRY,
+  [MIVE_EVENT_SEND_PRESENCE] = MIVE_LANE_TELEMETRY,
+  [MIVE_EVENT_SEND_STATE_DOC] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_PUBLISH_METRICS] = MIVE_LANE_HOUSEKEEPING,
+  [MIVE_EVENT_DUMP_TRACE] = MIVE_LANE_HOUSEKEEPING,
+  [MIVE_EVENT_NFC_DUTY] = MIVE_LANE_TELEMETRY,
+  [MIVE_EVENT_NFC_FIELD] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_GARAGE_DONE] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_CARD_REJECTED] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_HISTORY_FLUSH] = MIVE_LANE_HOUSEKEEPING,
+  [MIVE_EVENT_HISTORY_QUERY] = MIVE_LANE_HOUSEKEEPING,
+  [MIVE_EVENT_ENROLL_CARD] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_CARD_REMOVED] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_NET_DRAINED] = MIVE_LANE_CONTROL,
+  [MIVE_EVENT_CHECK_CARD] = MIVE_LANE_ACTUATION,
+  [MIVE_EVENT_LOAD_CREDENTIALS] = MIVE_LANE_HOUSEKEEPING,
+};
+
+_Static_assert(MIVE_EVENT_MAX <= 32, "coalesced events are tracked in a 32 bit mask");
+
+// Coalesced event types of every lane, filled in on init.
+static uint32_t lane_coalesced[MIVE_LANE_MAX];
+
+esp_err_t mive_event_queue_init(mive_event_queue_t* queue)
+{
+  UBaseType_t total_depth = 0;
+
+  memset(queue, 0, sizeof(*queue));
+  portMUX_INITIALIZE(&queue->lock);
+
+  memset(lane_coalesced, 0, sizeof(lane_coalesced));
+  for(uint32_t type = 0; type < MIVE_EVENT_MAX; ++type)
+  {
+    if(MIVE_EVENT_COALESCED & (1UL << type))
+    {
+      lane_coalesced[mive_event_get_lane(type)] |= (1UL << type);
+    }
+  }
+
+  for(uint32_t i = 0; i < MIVE_LANE_MAX; ++i)
+  {
+#if MIVE_STATIC_ALLOC
+    // Lanes sit back to back in lane_storage.
+    queue->lanes[i] = xQueueCreateStatic(lane_depth[i], sizeof(mive_event_t),
+                                         &queue->lane_storage[total_depth * sizeof(mive_event_t)], &queue->lane_buffers[i]);
+#else
+    queue->lanes[i] = xQueueCreate(lane_depth[i], sizeof(mive_event_t));
+#endif
+    if(queue->lanes[i] == NULL)
+    {
+      goto fail;
+    }
+    total_depth += lane_depth[i];
+  }
+
+  // Every coalesced type holds at most one count.
+  total_depth += __builtin_popcount(MIVE_EVENT_COALESCED);
+
+#if MIVE_STATIC_ALLOC
+  queue->pending = xSemaphoreCreateCountingStatic(total_depth, 0, &queue->pending_buffer);
+#else
+  queue->pending = xSemaphoreCreateCounting(total_depth, 0);
+#endif
+  if(queue->pending == NULL)
+  {
+    goto fail;
+  }
+
+  return ESP_OK;
+
+fail:
+  for(uint32_t i = 0; i < MIVE_LANE_MAX; ++i)
+  {
+    if(queue->lanes[i] != NULL)
+    {
+      vQueueDelete(queue->lanes[i]);
+      queue->lanes[i] = NULL;
+    }
+  }
+  return ESP_ERR_NO_MEM;
+}
+
+enum mive_event_lane_e mive_event_get_lane(unsigned int event_type)
+{
+  if(event_type >= sizeof(event_lane) / sizeof(event_lane[0]))
+  {
+    return MIVE_LANE_CONTROL;
+  }
+
+  return (enum mive_event_lane_e)event_lane[event_type];
+}
+
+// Depth is claimed before the event goes into its lane, so a receiver that
+// picks the event up early can never push the count below zero.
+static void account_claim(mive_event_queue_t* queue, enum mive_event_lane_e lane)
+{
+  queue->stats[lane].depth++;
+}
+
+// Events posted without an ingress time start their own chain.
+static void stamp_event(mive_event_t* stamped, const mive_event_t* event)
+{
+  *stamped = *event;
+  stamped->enqueued_us = esp_timer_get_time();
+  if(stamped->ingress_us == 0)
+  {
+    stamped->ingress_us = stamped->enqueued_us;
+  }
+}
+
+static void account_send(mive_event_queue_t* queue, enum mive_event_lane_e lane, BaseType_t sent)
+{
+  struct mive_event_lane_stats* stats = &queue->stats[lane];
+
+  if(sent == pdTRUE)
+  {
+    stats->sent++;
+    if(stats->depth > stats->high_water)
+    {
+      stats->high_water = stats->depth;
+    }
+  }
+  else
+  {
+    stats->depth--;
+    stats->dropped++;
+  }
+}
+
+static bool is_coalesced(unsigned int event_type)
+{
+  return event_type < MIVE_EVENT_MAX && (MIVE_EVENT_COALESCED & (1UL << event_type));
+}
+
+// Flags the event, or merges it into the one already flagged. Must be called
+// with the lock held. Returns true if the receiver needs a new count.
+static bool flag_event(mive_event_queue_t* queue, enum mive_event_lane_e lane, const mive_event_t* stamped)
+{
+  uint32_t bit = 1UL << stamped->event_type;
+  struct mive_event_lane_stats* stats = &queue->stats[lane];
+
+  if(queue->flagged & bit)
+  {
+    stats->coalesced++;
+    return false;
+  }
+
+  queue->flagged |= bit;
+  queue->flagged_events[stamped->event_type] = *stamped;
+  stats->depth++;
+  stats->sent++;
+  if(stats->depth > stats->high_water)
+  {
+    stats->high_water = stats->depth;
+  }
+  return true;
+}
+
+BaseType_t mive_event_queue_send(mive_event_queue_t* queue, const mive_event_t* event, TickType_t ticks_to_wait)
+{
+  enum mive_event_lane_e lane = mive_event_get_lane(event->event_type);
+  BaseType_t retval = pdFALSE;
+  mive_event_t stamped;
+  bool flagged = false;
+
+  stamp_event(&stamped, event);
+
+  if(is_coalesced(event->event_type))
+  {
+    taskENTER_CRITICAL(&queue->lock);
+    flagged = flag_event(queue, lane, &stamped);
+    taskEXIT_CRITICAL(&queue->lock);
+
+    mive_trace(MIVE_TRACE_EVENT_SENT, stamped.source, stamped.event_type, 1);
+    if(flagged)
+    {
+      xSemaphoreGive(queue->pending);
+    }
+    return pdTRUE;
+  }
+
+  taskENTER_CRITICAL(&queue->lock);
+  account_claim(queue, lane);
+  taskEXIT_CRITICAL(&queue->lock);
+
+  retval = xQueueSend(queue->lanes[lane], &stamped, ticks_to_wait);
+  mive_trace(MIVE_TRACE_EVENT_SENT, stamped.source, stamped.event_type, retval == pdTRUE);
+
+  taskENTER_CRITICAL(&queue->lock);
+  account_send(queue, lane, retval);
+  taskEXIT_CRITICAL(&queue->lock);
+
+  if(retval != pdTRUE)
+  {
+    MIVE_DLOGW(TAG, "Lane %d full, dropped event %u", lane, event->event_type);
+    return retval;
+  }
+
+  xSemaphoreGive(queue->pending);
+  return retval;
+}
+
+BaseType_t mive_event_queue_send_from_isr(mive_event_queue_t* queue, const mive_event_t* event, BaseType_t* higher_prio_woken)
+{
+  enum mive_event_lane_e lane = mive_event_get_lane(event->event_type);
+  BaseType_t retval = pdFALSE;
+  mive_event_t stamped;
+  bool flagged = false;
+
+  stamp_event(&stamped, event);
+
+  if(is_coalesced(event->event_type))
+  {
+    taskENTER_CRITICAL_ISR(&queue->lock);
+    flagged = flag_event(queue, lane, &stamped);
+    taskEXIT_CRITICAL_ISR(&queue->lock);
+
+    mive_trace(MIVE_TRACE_EVENT_SENT, stamped.source, stamped.event_type, 1);
+    if(flagged)
+    {
+      xSemaphoreGiveFromISR(queue->pending, higher_prio_woken);
+    }
+    return pdTRUE;
+  }
+
+  taskENTER_CRITICAL_ISR(&queue->lock);
+  account_claim(queue, lane);
+  taskEXIT_CRITICAL_ISR(&queue->lock);
+
+  retval = xQueueSendFromISR(queue->lanes[lane], &stamped, higher_prio_woken);
+  mive_trace(MIVE_TRACE_EVENT_SENT, stamped.source, stamped.event_type, retval == pdTRUE);
+
+  taskENTER_CRITICAL_ISR(&queue->lock);
+  account_send(queue, lane, retval);
+  taskEXIT_CRITICAL_ISR(&queue->lock);
+
+  if(retval == pdTRUE)
+  {
+    xSemaphoreGiveFromISR(queue->pending, higher_prio_woken);
+  }
+
+  return retval;
+}
+
+BaseType_t mive_event_queue_receive(mive_event_queue_t* queue, mive_event_t* event, TickType_t ticks_to_wait)
+{
+  if(xSemaphoreTake(queue->pending, ticks_to_wait) != pdTRUE)
+  {
+    return pdFALSE;
+  }
+
+  // Every count on the semaphore was given after its event landed in a lane
+  // or got flagged, so one of the lanes is guaranteed to hold something.
+  for(uint32_t i = 0; i < MIVE_LANE_MAX; ++i)
+  {
+    uint32_t bits = 0;
+
+    taskENTER_CRITICAL(&queue->lock);
+    bits = queue->flagged & lane_coalesced[i];
+    if(bits)
+    {
+      bits &= -bits;
+      queue->flagged &= ~bits;
+      *event = queue->flagged_events[__builtin_ctz(bits)];
+      queue->stats[i].depth--;
+    }
+    taskEXIT_CRITICAL(&queue->lock);
+    if(bits)
+    {
+      return pdTRUE;
+    }
+
+    if(xQueueReceive(queue->lanes[i], event, 0) == pdTRUE)
+    {
+      taskENTER_CRITICAL(&queue->lock);
+      queue->stats[i].depth--;
+      taskEXIT_CRITICAL(&queue->lock);
+      return pdTRUE;
+    }
+  }
+
+  return pdFALSE;
+}
+
+void mive_event_queue_get_stats(mive_event_queue_t* queue, enum mive_event_lane_e lane, struct mive_event_lane_stats* stats)
+{
+  taskENTER_CRITICAL(&queue->lock);
+  *stats = queue->stats[lane];
+  taskEXIT_CRITICAL(&queue->lock);
+}
@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/i2c_master.h"
 #include "include/garage.h"
 
+static const char *TAG = "garage";
+
+#define XFER_INDEX(i) ((i) % MIVE_GARAGE_QUEUE_DEPTH)
+
 static char* garage_state_str[] = {
     [GARAGE_INVALID] = "GARAGE_INVALID",
     [GARAGE_CLOSED] = "GARAGE_CLOSED",
@@ -23,27 +28,137 @@ char* mive_garage_get_state_str(enum garage_state_e state)
   return garage_state_str[state];
 }
 
-esp_err_t mive_garage_init(mive_garage_t* garage, i2c_master_bus_config_t* bus_config, i2c_device_config_t* dev_config)
+bool mive_garage_is_moving(enum garage_state_e state)
 {
-  esp_err_t retval = ESP_OK;
+  return state == GARAGE_OPENING || state == GARAGE_CLOSING;
+}
+
+enum garage_state_e mive_garage_next_state(enum garage_state_e state)
+{
+  switch (state)
+  {
+    case GARAGE_CLOSED:
+    case GARAGE_CLOSING_STOPPED:
+      return GARAGE_OPENING;
+    case GARAGE_OPEN:
+    case GARAGE_OPENING_STOPPED:
+      return GARAGE_CLOSING;
+    case GARAGE_OPENING:
+      return GARAGE_OPENING_STOPPED;
+    case GARAGE_CLOSING:
+      return GARAGE_CLOSING_STOPPED;
+    default:
+      return GARAGE_INVALID;
+  }
+}
+
+bool mive_garage_command_applies(enum garage_state_e state, enum mive_garage_command_e command)
+{
+  switch (command)
+  {
+    case MIVE_GARAGE_CMD_TOGGLE:
+      return true;
+    case MIVE_GARAGE_CMD_OPEN:
+      return state == GARAGE_CLOSED || state == GARAGE_CLOSING_STOPPED;
+    case MIVE_GARAGE_CMD_CLOSE:
+      return state == GARAGE_OPEN || state == GARAGE_OPENING_STOPPED;
+    case MIVE_GARAGE_CMD_STOP:
+      return mive_garage_is_moving(state);
+    default:
+      return false;
+  }
+}
+
+// Runs in the driver's ISR. Transfers complete in the order they were
+// queued, so the oldest one in xfers is the one this is about.
+// Only the current device's transfers are in xfers, a completion from a
+// device torn down as stuck would take someone else's place.
+static bool garage_on_trans_done(i2c_master_dev_handle_t dev, const i2c_master_event_data_t* edata, void* user_data)
+{
+  mive_garage_t* garage = (mive_garage_t*)user_data;
+  mive_garage_result_t result = {0};
+  union garage_i2c_reg reg;
+  int64_t started_us = 0;
+  bool found = false;
+
+  switch (edata->event)
+  {
+    case I2C_EVENT_DONE:
+      result.status = ESP_OK;
+      break;
+    case I2C_EVENT_NACK:
+      result.status = ESP_ERR_INVALID_RESPONSE;
+      break;
+    case I2C_EVENT_TIMEOUT:
+      result.status = ESP_ERR_TIMEOUT;
+      break;
+    default:
+      // Still going.
+      return false;
+  }
 
-  retval = i2c_new_master_bus(bus_config, &garage->bus_master);
+  portENTER_CRITICAL_ISR(&garage->lock);
+  if(dev == garage->dev_handle && garage->head != garage->tail)
+  {
+    struct mive_garage_xfer_s* xfer = &garage->xfers[XFER_INDEX(garage->head)];
+    result.op = xfer->op;
+    result.tag = xfer->tag;
+    reg.reg = xfer->rx;
+    started_us = xfer->started_us;
+    garage->head++;
+    found = true;
+  }
+  portEXIT_CRITICAL_ISR(&garage->lock);
 
+  if(!found)
+  {
+    // Left behind by a torn down device, see garage_check_stuck.
+    return false;
+  }
+
+  if(result.op == MIVE_GARAGE_OP_READ && result.status == ESP_OK)
+  {
+    result.state = reg.s.state;
+  }
+  result.elapsed_us = (uint32_t)(esp_timer_get_time() - started_us);
+
+  return garage->on_done(&result, garage->arg);
+}
+
+static esp_err_t garage_bus_open(mive_garage_t* garage)
+{
+  esp_err_t retval = ESP_OK;
+  const i2c_master_event_callbacks_t callbacks = {
+    .on_trans_done = garage_on_trans_done,
+  };
+
+  retval = i2c_new_master_bus(&garage->bus_config, &garage->bus_master);
   if(retval != ESP_OK)
   {
     ESP_ERROR_CHECK_WITHOUT_ABORT(retval);
     goto end;
   }
 
-  retval = i2c_master_bus_add_device(garage->bus_master, dev_config, &garage->dev_handle);
+  retval = i2c_master_bus_add_device(garage->bus_master, &garage->dev_config, &garage->dev_handle);
   if(retval != ESP_OK)
   {
     ESP_ERROR_CHECK_WITHOUT_ABORT(retval);
     goto delete_master;
   }
 
+  // Makes every transfer on this device asynchronous.
+  retval = i2c_master_register_event_callbacks(garage->dev_handle, &callbacks, garage);
+  if(retval != ESP_OK)
+  {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(retval);
+    goto remove_device;
+  }
+
   return ESP_OK;
 
+remove_device:
+  i2c_master_bus_rm_device(garage->dev_handle);
+
 delete_master:
   i2c_del_master_bus(garage->bus_master);
 
@@ -54,32 +169,255 @@ end:
   return retval;
 }
 
-enum garage_state_e mive_garage_get_state(mive_garage_t* garage)
+static void garage_bus_close(mive_garage_t* garage)
+{
+  if(garage->dev_handle != NULL)
+  {
+    i2c_master_bus_rm_device(garage->dev_handle);
+    garage->dev_handle = NULL;
+  }
+
+  if(garage->bus_master != NULL)
+  {
+    i2c_del_master_bus(garage->bus_master);
+    garage->bus_master = NULL;
+  }
+}
+
+esp_err_t mive_garage_init(mive_garage_t* garage, i2c_master_bus_config_t* bus_config, i2c_device_config_t* dev_config,
+                           mive_garage_done_cb_t on_done, void* arg)
+{
+  garage->bus_config = *bus_config;
+  garage->bus_config.trans_queue_depth = MIVE_GARAGE_QUEUE_DEPTH;
+  garage->dev_config = *dev_config;
+  garage->on_done = on_done;
+  garage->arg = arg;
+  garage->head = 0;
+  garage->tail = 0;
+  garage->failures = 0;
+  garage->retry_at_us = 0;
+  garage->recover = false;
+  portMUX_INITIALIZE(&garage->lock);
+
+  return garage_bus_open(garage);
+}
+
+static uint32_t garage_in_flight(mive_garage_t* garage)
+{
+  uint32_t in_flight = 0;
+
+  taskENTER_CRITICAL(&garage->lock);
+  in_flight = garage->tail - garage->head;
+  taskEXIT_CRITICAL(&garage->lock);
+
+  return in_flight;
+}
+
+static void garage_backoff(mive_garage_t* garage)
+{
+  uint32_t backoff_ms = MIVE_GARAGE_BACKOFF_MIN_MS;
+
+  for(uint32_t i = 1; i < garage->failures && backoff_ms < MIVE_GARAGE_BACKOFF_MAX_MS; ++i)
+  {
+    backoff_ms *= 2;
+  }
+  if(backoff_ms > MIVE_GARAGE_BACKOFF_MAX_MS)
+  {
+    backoff_ms = MIVE_GARAGE_BACKOFF_MAX_MS;
+  }
+
+  garage->retry_at_us = esp_timer_get_time() + backoff_ms * 1000LL;
+}
+
+// Only with nothing in flight, neither a reset nor a re-init may pull the
+// bus from under a queued transfer.
+static void garage_recover(mive_garage_t* garage)
 {
-  uint8_t data = 0;
   esp_err_t retval = ESP_OK;
-  retval = i2c_master_transmit_receive(garage->dev_handle, &data, 1, &garage->reg.reg, 1, 100);
+
+  if(!garage->recover || garage_in_flight(garage) > 0)
+  {
+    return;
+  }
+  garage->recover = false;
+
+  if(garage->failures >= MIVE_GARAGE_REINIT_AFTER || garage->bus_master == NULL)
+  {
+    ESP_LOGW(TAG, "%lu failures in a row, re-initializing the bus", (unsigned long)garage->failures);
+    garage_bus_close(garage);
+    retval = garage_bus_open(garage);
+    if(retval != ESP_OK)
+    {
+      // Comes back here with the next failure.
+      return;
+    }
+    garage->stats.reinits++;
+  }
+
+  // The ESP32 has no hardware bus clear, the driver clocks SCL by hand until
+  // SDA is released and sends a STOP.
+  retval = i2c_master_bus_reset(garage->bus_master);
   if(retval != ESP_OK)
   {
-    return GARAGE_INVALID;
+    ESP_LOGE(TAG, "Error (%s) resetting the bus", esp_err_to_name(retval));
   }
-  else
+  garage->stats.resets++;
+}
+
+// Nothing came back for the oldest transfer, the bus or the driver is wedged.
+// The ring stays as it is, the driver still owns those transfers. It gets a
+// chance to finish them, each completion is reported as usual. Only a driver
+// that doesn't is torn down with its transfers, the ring is emptied once the
+// device is gone so nothing late can land on a new transfer.
+static void garage_check_stuck(mive_garage_t* garage, int64_t now_us)
+{
+  bool stuck = false;
+  esp_err_t retval = ESP_OK;
+
+  taskENTER_CRITICAL(&garage->lock);
+  stuck = garage->head != garage->tail && now_us - garage->xfers[XFER_INDEX(garage->head)].started_us > MIVE_GARAGE_STUCK_MS * 1000LL;
+  taskEXIT_CRITICAL(&garage->lock);
+
+  if(!stuck)
+  {
+    return;
+  }
+
+  ESP_LOGW(TAG, "Transfer never completed");
+  garage->stats.timeout++;
+  garage->failures = (garage->failures < MIVE_GARAGE_REINIT_AFTER) ? MIVE_GARAGE_REINIT_AFTER : garage->failures + 1;
+  garage_backoff(garage);
+  garage->recover = true;
+
+  retval = i2c_master_bus_wait_all_done(garage->bus_master, MIVE_GARAGE_DRAIN_MS);
+  if(retval == ESP_OK && garage_in_flight(garage) == 0)
   {
-    return (enum garage_state_e)garage->reg.s.state;
+    // Recovers once the completions have been booked.
+    return;
   }
+
+  ESP_LOGE(TAG, "Driver didn't drain (%s), dropping %lu transfers", esp_err_to_name(retval), (unsigned long)garage_in_flight(garage));
+  garage_bus_close(garage);
+  taskENTER_CRITICAL(&garage->lock);
+  garage->head = garage->tail;
+  taskEXIT_CRITICAL(&garage->lock);
+  garage_recover(garage);
 }
 
-esp_err_t mive_garage_actuate(mive_garage_t* garage)
+static esp_err_t garage_submit(mive_garage_t* garage, uint8_t op, uint8_t tag)
 {
-  uint8_t data[2] = {0};
   esp_err_t retval = ESP_OK;
+  struct mive_garage_xfer_s* xfer = NULL;
   union garage_i2c_reg reg = {
     .s.command = 1
   };
 
-  data[1] = reg.reg;
+  if(garage->dev_handle == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // At most as many as the driver queues, so it never blocks on a free slot.
+  taskENTER_CRITICAL(&garage->lock);
+  if(garage->tail - garage->head < MIVE_GARAGE_QUEUE_DEPTH)
+  {
+    xfer = &garage->xfers[XFER_INDEX(garage->tail)];
+    xfer->op = op;
+    xfer->tag = tag;
+    xfer->tx[0] = 0;
+    xfer->tx[1] = reg.reg;
+    xfer->rx = 0;
+    xfer->started_us = esp_timer_get_time();
+    garage->tail++;
+  }
+  taskEXIT_CRITICAL(&garage->lock);
+
+  if(xfer == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if(op == MIVE_GARAGE_OP_READ)
+  {
+    retval = i2c_master_transmit_receive(garage->dev_handle, xfer->tx, 1, &xfer->rx, 1, MIVE_GARAGE_XFER_TIMEOUT_MS);
+  }
+  else
+  {
+    retval = i2c_master_transmit(garage->dev_handle, xfer->tx, 2, MIVE_GARAGE_XFER_TIMEOUT_MS);
+  }
+
+  if(retval != ESP_OK)
+  {
+    // Never made it into the driver's queue, no completion is coming for it.
+    taskENTER_CRITICAL(&garage->lock);
+    garage->tail--;
+    taskEXIT_CRITICAL(&garage->lock);
+  }
+
+  return retval;
+}
+
+esp_err_t mive_garage_read_async(mive_garage_t* garage, uint8_t tag)
+{
+  esp_err_t retval = ESP_OK;
+  int64_t now_us = esp_timer_get_time();
+
+  garage_check_stuck(garage, now_us);
 
-  retval = i2c_master_transmit(garage->dev_handle, data, 2, 100);
+  if(now_us < garage->retry_at_us)
+  {
+    garage->stats.skipped++;
+    return ESP_ERR_NOT_ALLOWED;
+  }
+
+  if(garage->dev_handle == NULL)
+  {
+    // Init or the last re-init didn't get the bus up, try again.
+    garage->failures++;
+    garage_backoff(garage);
+    garage->recover = true;
+    garage_recover(garage);
+  }
+
+  retval = garage_submit(garage, MIVE_GARAGE_OP_READ, tag);
+  if(retval == ESP_ERR_INVALID_STATE)
+  {
+    garage->stats.skipped++;
+  }
 
   return retval;
 }
+
+esp_err_t mive_garage_actuate_async(mive_garage_t* garage, uint8_t tag)
+{
+  garage_check_stuck(garage, esp_timer_get_time());
+
+  return garage_submit(garage, MIVE_GARAGE_OP_ACTUATE, tag);
+}
+
+void mive_garage_complete(mive_garage_t* garage, const mive_garage_result_t* result)
+{
+  if(result->status == ESP_OK)
+  {
+    garage->stats.ok++;
+    garage->failures = 0;
+    garage->retry_at_us = 0;
+    garage->recover = false;
+    return;
+  }
+
+  if(result->status == ESP_ERR_TIMEOUT)
+  {
+    garage->stats.timeout++;
+  }
+  else
+  {
+    garage->stats.nack++;
+  }
+
+  garage->failures++;
+  ESP_LOGW(TAG, "Transfer failed (%s), %lu in a row", esp_err_to_name(result->status), (unsigned long)garage->failures);
+  garage_backoff(garage);
+  garage->recover = true;
+  garage_recover(garage);
+}
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_crc.h"
+
+#include "include/history.h"
+
+static const char *TAG = "history";
+
+#define RECORD_SIZE sizeof(mive_history_record_t)
+#define ERASED_SEQ 0xffffffff
+
+static uint16_t record_crc(const mive_history_record_t* record)
+{
+  return esp_crc16_le(0, (const uint8_t*)record, offsetof(mive_history_record_t, crc));
+}
+
+static bool record_valid(const mive_history_record_t* record)
+{
+  return record->seq != ERASED_SEQ && record->crc == record_crc(record);
+}
+
+// Records the write position can take before it crosses a page boundary.
+static uint32_t page_room(mive_history_t* history)
+{
+  return MIVE_HISTORY_PAGE_RECORDS - (history->write_offset % MIVE_HISTORY_PAGE_SIZE) / RECORD_SIZE;
+}
+
+// Offset of the flash record with sequence number seq.
+static uint32_t record_offset(mive_history_t* history, uint32_t flash_end_seq, uint32_t seq)
+{
+  uint32_t size = history->partition->size;
+
+  return (history->write_offset + size - ((flash_end_seq - seq) * RECORD_SIZE) % size) % size;
+}
+
+esp_err_t mive_history_init(mive_history_t* history)
+{
+  esp_err_t retval = ESP_OK;
+  const esp_partition_t* partition = NULL;
+  mive_history_record_t record;
+  uint32_t sector_size = 0;
+  uint32_t num_sectors = 0;
+  uint32_t sector_records = 0;
+  uint32_t head_sector = 0;
+  uint32_t head_seq = 0;
+  uint32_t valid_sectors = 0;
+  uint32_t in_head = 0;
+
+  memset(history, 0, sizeof(*history));
+
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MIVE_HISTORY_PARTITION_NAME);
+  if(partition == NULL)
+  {
+    ESP_LOGW(TAG, "No %s partition, not keeping a history", MIVE_HISTORY_PARTITION_NAME);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  sector_size = partition->erase_size;
+  num_sectors = partition->size / sector_size;
+  sector_records = sector_size / RECORD_SIZE;
+
+  // The sector holding the newest records starts with the highest sequence
+  // number, every valid sector but that one is full.
+  for(uint32_t sector = 0; sector < num_sectors; ++sector)
+  {
+    retval = esp_partition_read(partition, sector * sector_size, &record, sizeof(record));
+    if(retval != ESP_OK)
+    {
+      goto end;
+    }
+
+    if(!record_valid(&record))
+    {
+      continue;
+    }
+
+    if(valid_sectors == 0 || record.seq > head_seq)
+    {
+      head_sector = sector;
+      head_seq = record.seq;
+    }
+    valid_sectors++;
+  }
+
+  if(valid_sectors > 0)
+  {
+    for(in_head = 1; in_head < sector_records; ++in_head)
+    {
+      retval = esp_partition_read(partition, head_sector * sector_size + in_head * RECORD_SIZE, &record, sizeof(record));
+      if(retval != ESP_OK)
+      {
+        goto end;
+      }
+      if(record.seq == ERASED_SEQ)
+      {
+        break;
+      }
+    }
+
+    history->write_offset = (head_sector * sector_size + in_head * RECORD_SIZE) % partition->size;
+    history->flash_records = (valid_sectors - 1) * sector_records + in_head;
+    history->next_seq = head_seq + in_head;
+  }
+
+  history->partition = partition;
+  ESP_LOGI(TAG, "%lu records, next at 0x%lx", (unsigned long)history->flash_records, (unsigned long)history->write_offset);
+
+end:
+  if(retval != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Error (%s) reading the history", esp_err_to_name(retval));
+  }
+
+  return retval;
+}
+
+bool mive_history_append(mive_history_t* history, uint8_t kind, uint8_t source, uint8_t credential, uint8_t result, uint16_t arg)
+{
+  mive_history_record_t* record = NULL;
+  time_t now = time(NULL);
+
+  if(history->num_pending >= page_room(history))
+  {
+    // The flush didn't come in time.
+    mive_history_flush(history);
+  }
+
+  record = &history->page[history->num_pending++];
+  record->seq = history->next_seq++;
+  record->time_s = (now >= MIVE_HISTORY_MIN_TIME) ? (uint32_t)now : 0;
+  record->kind = kind;
+  record->source = source;
+  record->credential = credential;
+  record->result = result;
+  record->arg = arg;
+  record->crc = record_crc(record);
+
+  return history->num_pending >= page_room(history);
+}
+
+esp_err_t mive_history_flush(mive_history_t* history)
+{
+  esp_err_t retval = ESP_OK;
+  const esp_partition_t* partition = history->partition;
+  uint32_t sector_size = 0;
+
+  if(history->num_pending == 0)
+  {
+    return ESP_OK;
+  }
+
+  if(partition == NULL)
+  {
+    history->num_pending = 0;
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  sector_size = partition->erase_size;
+
+  // Pending records never cross a page, so never a sector either.
+  if(history->write_offset % sector_size == 0)
+  {
+    // Makes room by dropping the oldest sector.
+    retval = esp_partition_erase_range(partition, history->write_offset, sector_size);
+    if(history->flash_records > (partition->size - sector_size) / RECORD_SIZE)
+    {
+      history->flash_records = (partition->size - sector_size) / RECORD_SIZE;
+    }
+  }
+
+  if(retval == ESP_OK)
+  {
+    retval = esp_partition_write(partition, history->write_offset, history->page, history->num_pending * RECORD_SIZE);
+  }
+
+  if(retval != ESP_OK)
+  {
+    // Moves on regardless, the slots read back as invalid records.
+    ESP_LOGE(TAG, "Error (%s) writing %lu records", esp_err_to_name(retval), (unsigned long)history->num_pending);
+  }
+
+  history->write_offset = (history->write_offset + history->num_pending * RECORD_SIZE) % partition->size;
+  history->flash_records += history->num_pending;
+  history->num_pending = 0;
+
+  return retval;
+}
+
+static bool record_matches(const mive_history_record_t* record, uint32_t from_s, uint32_t to_s)
+{
+  return record->time_s >= from_s && (to_s == 0 || record->time_s <= to_s);
+}
+
+int mive_history_query(mive_history_t* history, uint32_t from_s, uint32_t to_s, uint32_t cursor, uint8_t* buf, size_t buf_len)
+{
+  mive_history_header_t* header = (mive_history_header_t*)buf;
+  mive_history_record_t* out = (mive_history_record_t*)(buf + sizeof(*header));
+  mive_history_record_t chunk[MIVE_HISTORY_PAGE_RECORDS];
+  uint32_t flash_end_seq = history->next_seq - history->num_pending;
+  uint32_t seq = flash_end_seq - history->flash_records;
+  uint32_t count = 0;
+  uint32_t scanned = 0;
+
+  if(buf_len < MIVE_HISTORY_REPLY_MAX_LEN)
+  {
+    return -1;
+  }
+
+  if(cursor > seq)
+  {
+    seq = cursor;
+  }
+
+  // Flash first, in chunks that don't wrap around the end of the partition.
+  while(history->partition != NULL && seq < flash_end_seq && count < MIVE_HISTORY_QUERY_RECORDS &&
+        scanned < MIVE_HISTORY_QUERY_SCAN)
+  {
+    uint32_t offset = record_offset(history, flash_end_seq, seq);
+    uint32_t n = flash_end_seq - seq;
+
+    if(n > MIVE_HISTORY_PAGE_RECORDS)
+    {
+      n = MIVE_HISTORY_PAGE_RECORDS;
+    }
+    if(n > (history->partition->size - offset) / RECORD_SIZE)
+    {
+      n = (history->partition->size - offset) / RECORD_SIZE;
+    }
+
+    if(esp_partition_read(history->partition, offset, chunk, n * RECORD_SIZE) != ESP_OK)
+    {
+      memset(chunk, 0xff, n * RECORD_SIZE);
+    }
+    scanned += n;
+
+    for(uint32_t i = 0; i < n && count < MIVE_HISTORY_QUERY_RECORDS; ++i, ++seq)
+    {
+      if(record_valid(&chunk[i]) && chunk[i].seq == seq && record_matches(&chunk[i], from_s, to_s))
+      {
+        out[count++] = chunk[i];
+      }
+    }
+  }
+
+  // Then whatever hasn't been written yet.
+  for(uint32_t i = 0; i < history->num_pending && count < MIVE_HISTORY_QUERY_RECORDS && seq >= flash_end_seq; ++i)
+  {
+    if(history->page[i].seq < seq)
+    {
+      continue;
+    }
+    seq = history->page[i].seq + 1;
+    if(record_matches(&history->page[i], from_s, to_s))
+    {
+      out[count++] = history->page[i];
+    }
+  }
+
+  header->magic = MIVE_HISTORY_MAGIC;
+  header->version = MIVE_HISTORY_VERSION;
+  header->record_size = RECORD_SIZE;
+  header->count = count;
+  header->next = (seq < history->next_seq) ? seq : 0;
+
+  return sizeof(*header) + count * RECORD_SIZE;
+}
@@ -0,0 +1,61 @@
+#ifndef _MIVE_BOOT_H
+#define _MIVE_BOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "state_doc.h"
+
+// Boot time markers, and the last known state kept across a reset.
+//
+// The state document fields live in RTC memory that software resets,
+// panics and watchdogs leave alone, so the door, auth and presence state
+// can go out the moment MQTT connects instead of after the first readings.
+// A power cycle clears it, the CRC tells. Only main_task updates it.
+//
+// Markers are milliseconds since esp_timer started, the bootloader isn't
+// counted. The first mark of each kind wins, any task may set them.
+
+#define MIVE_BOOT_MAGIC 0x5452564d // "MVRT"
+#define MIVE_BOOT_JSON_MAX_LEN 256
+
+// One-shot task in app_main that starts Wi-Fi and MQTT, deletes itself after.
+#define MIVE_BOOT_NET_TASK_STACK 4096
+#ifndef MIVE_BOOT_NET_TASK_PRIO
+#define MIVE_BOOT_NET_TASK_PRIO 5
+#endif
+
+enum mive_boot_mark_e
+{
+  MIVE_BOOT_APP_MAIN = 0,
+  // Serving events, ESP-NOW and MQTT commands work from here.
+  MIVE_BOOT_MAIN_TASK,
+  // Reader polling, cards work from here.
+  MIVE_BOOT_NFC,
+  // First successful door read.
+  MIVE_BOOT_DOOR,
+  // Card list loaded from NVS.
+  MIVE_BOOT_CREDENTIALS,
+  MIVE_BOOT_WIFI,
+  MIVE_BOOT_MQTT,
+
+  MIVE_BOOT_MARK_MAX,
+};
+
+// First thing in app_main. Returns true if the retained state survived.
+bool mive_boot_init(void);
+
+void mive_boot_mark(enum mive_boot_mark_e mark);
+
+// Keeps a state document field for the next boot.
+void mive_boot_retain(enum mive_state_doc_field_e field, uint32_t value, bool valid);
+
+// Value of a field from before the reset, false if there was none.
+bool mive_boot_retained(enum mive_state_doc_field_e field, uint32_t* value);
+
+// {"reason":<esp_reset_reason_t>,"boots":<since power on>,"retained":<0|1>,"ms":{"<mark>":<ms>,...}}
+// Marks not reached yet are left out. Returns the length or -1 if buf is too small.
+int mive_boot_json(char* buf, size_t buf_len);
+
+#endif // _MIVE_BOOT_H
\ No newline at end of file
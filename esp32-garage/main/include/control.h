@@ -0,0 +1,85 @@
+#ifndef _MIVE_CONTROL_H
+#define _MIVE_CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "program_opaque.h"
+#include "events.h"
+#include "ranging.h"
+#include "garage.h"
+
+// Everything main_task decides, kept apart from the hardware setup in main.c
+// so it also builds for the linux target against mocked peripherals (see ../host).
+
+#define MQTT_BROKER_URL "mqtt://192.168.82.15:1883"
+
+// ==== Subscriber paths ====
+
+// Got command to actuate garage door
+#define MQTT_SWTICH_PATH "/garage/switch"
+// Command to start new NFC card registration
+#define MQTT_REGISTER_NFC "/garage/auth/new"
+// OPEN/CLOSE/STOP/TOGGLE for a door, the level in the middle is the door id.
+#define MQTT_DOOR_SET_PATH "/garage/door/+/set"
+// Dumps the trace ring, payload CONSOLE prints it on the console instead of publishing.
+#define MQTT_TRACE_DUMP_PATH "/garage/trace/dump"
+// Queries the history, payload "<from> <to>" in unix seconds, either may be
+// left out. Replies go to MQTT_HISTORY_PATH.
+#define MQTT_HISTORY_GET_PATH "/garage/history/get"
+
+// Keyword value for payloads that are understood but mean "do nothing".
+#define MQTT_COMMAND_IGNORE (-2)
+
+// Publisher paths live in mqtt_publish.h
+
+#define MIVE_GARAGE_POLL_PERIOD_MS 250
+// How long a finished card registration stays on SUCCESS/FAILED.
+#define MIVE_AUTH_IDLE_DELAY_MS 1000
+
+// Sets up the filters and arms the periodic jobs. Call from the task that will run mive_control_run.
+void mive_control_init(mive_program_t* program, uint32_t max_distance_cm);
+
+// Handles a single event, normally called by mive_control_run.
+void mive_control_handle_event(mive_program_t* program, mive_event_t* event);
+
+// Takes the next job whose deadline passed and turns it into the event it
+// stands for. Call until it returns false, then block on the queue for
+// mive_control_timeout().
+bool mive_control_take_due(mive_program_t* program, mive_event_t* event);
+
+// Ticks until the next job is due.
+TickType_t mive_control_timeout(mive_program_t* program);
+
+// Runs due jobs and serves the event queue forever.
+void mive_control_run(mive_program_t* program);
+
+// Registers the routes and starts the MQTT client.
+void mive_control_mqtt_start(mive_program_t* program);
+
+// Registers the same routes for local clients and starts the WebSocket
+// server if MIVE_WS_ENABLE. After mive_control_mqtt_start.
+void mive_control_local_start(mive_program_t* program);
+
+// mive_ws_message_cb_t callback, arg is the program. Goes through the
+// MQTT routes with MIVE_SOURCE_LOCAL. Returns false if main_task won't see it.
+bool mive_control_on_local_message(const char* topic, size_t topic_len, const char* data, size_t data_len, void* arg);
+
+// mive_nfc_irq_cb_t callback, arg is the program.
+bool mive_control_on_nfc_irq(void* arg);
+
+// mive_net_drained_cb_t callback, arg is the program.
+void mive_control_on_net_drained(void* arg);
+
+// mive_garage_done_cb_t callback, arg is the program.
+bool mive_control_on_garage_done(const mive_garage_result_t* result, void* arg);
+
+// mive_ranging_config_t callback, arg is the program.
+bool mive_control_on_ranging_done(const mive_ranging_result_t* result, void* arg);
+
+// Payload received from an ESP-NOW peer, runs on the Wi-Fi task.
+void mive_control_espnow_received(mive_program_t* program, const uint8_t* mac, const uint8_t* data, int len);
+
+#endif // _MIVE_CONTROL_H
\ No newline at end of file
@@ -0,0 +1,128 @@
+#ifndef _MIVE_DLOG_H
+#define _MIVE_DLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Deferred logging for callbacks that must not block on the console (Wi-Fi,
+// ESP-NOW, MQTT and RC522 handlers).
+// A log call copies the format pointer, up to MIVE_DLOG_MAX_ARGS integer or
+// pointer arguments and an optional data blob into a queue and returns.
+// A low priority task does the formatting and the UART output.
+// The macros convert every argument to uintptr_t, the type the printing
+// task reads back, so stick to values no wider than a pointer (int sized,
+// anything 64 bit fails to build) and pointers to strings that outlive the
+// call (literals, static tables). Anything else (topics, payloads) goes into
+// the data blob.
+
+#define MIVE_DLOG_NONE 0
+#define MIVE_DLOG_ERROR 1
+#define MIVE_DLOG_WARN 2
+#define MIVE_DLOG_INFO 3
+#define MIVE_DLOG_DEBUG 4
+#define MIVE_DLOG_VERBOSE 5
+
+// Calls above this level compile to nothing, format strings included.
+#ifndef MIVE_DLOG_LEVEL
+#define MIVE_DLOG_LEVEL MIVE_DLOG_INFO
+#endif
+
+#define MIVE_DLOG_QUEUE_LEN 32
+#define MIVE_DLOG_MAX_ARGS 6
+#define MIVE_DLOG_DATA_LEN 32
+#define MIVE_DLOG_LINE_LEN 256
+#define MIVE_DLOG_TASK_STACK 3072
+// Runs on MIVE_NET_CORE, the UART never holds up main_task.
+#ifndef MIVE_DLOG_TASK_PRIO
+#define MIVE_DLOG_TASK_PRIO 1
+#endif
+
+// Each call site lets MIVE_DLOG_RATE_BURST records through per window, the
+// rest is counted and reported with the next record that makes it.
+#define MIVE_DLOG_RATE_BURST 5
+#define MIVE_DLOG_RATE_WINDOW_MS 1000
+
+enum mive_dlog_data_e
+{
+  MIVE_DLOG_DATA_NONE = 0,
+  MIVE_DLOG_DATA_HEX,
+  MIVE_DLOG_DATA_TEXT,
+};
+
+// Per call site state, one static instance is created by the macros below.
+typedef struct mive_dlog_site_s
+{
+  int64_t window_start_us;
+  uint16_t count;
+  uint16_t suppressed;
+} mive_dlog_site_t;
+
+typedef struct mive_dlog_record_s
+{
+  int64_t time_us;
+  const char* tag;
+  const char* fmt;
+  uintptr_t args[MIVE_DLOG_MAX_ARGS];
+  uint16_t suppressed;
+  // Length of the original data, data_len may be truncated.
+  uint16_t data_total;
+  uint8_t data_len;
+  uint8_t data_kind;
+  uint8_t level;
+  uint8_t data[MIVE_DLOG_DATA_LEN];
+} mive_dlog_record_t;
+
+// Creates the queue and the printing task. Calls made before this are dropped.
+void mive_dlog_init(void);
+
+// Records dropped because the queue was full or not created yet.
+uint32_t mive_dlog_dropped(void);
+
+// Use the macros. Safe from any task, not from ISRs. The variadic
+// arguments are nargs uintptr_t.
+void mive_dlog_write(mive_dlog_site_t* site, uint8_t level, const char* tag, uint8_t data_kind, const void* data, size_t data_len, uint8_t nargs, const char* fmt, ...);
+
+// Never called, checks the format against the arguments as written.
+static inline __attribute__((format(printf, 1, 2))) void mive_dlog_check(const char* fmt, ...)
+{
+}
+
+#define MIVE_DLOG_NARGS(...) MIVE_DLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define MIVE_DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+// The array size goes negative for arguments wider than uintptr_t.
+#define MIVE_DLOG_ARG(x) ((uintptr_t)(x) + 0 * sizeof(char[(sizeof(x) <= sizeof(uintptr_t)) ? 1 : -1]))
+#define MIVE_DLOG_ARGS(...) MIVE_DLOG_ARGS_N(MIVE_DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define MIVE_DLOG_ARGS_N(n, ...) MIVE_DLOG_CAT(MIVE_DLOG_ARGS_, n)(__VA_ARGS__)
+#define MIVE_DLOG_CAT(a, b) MIVE_DLOG_CAT_(a, b)
+#define MIVE_DLOG_CAT_(a, b) a##b
+#define MIVE_DLOG_ARGS_0()
+#define MIVE_DLOG_ARGS_1(a) , MIVE_DLOG_ARG(a)
+#define MIVE_DLOG_ARGS_2(a, ...) , MIVE_DLOG_ARG(a) MIVE_DLOG_ARGS_1(__VA_ARGS__)
+#define MIVE_DLOG_ARGS_3(a, ...) , MIVE_DLOG_ARG(a) MIVE_DLOG_ARGS_2(__VA_ARGS__)
+#define MIVE_DLOG_ARGS_4(a, ...) , MIVE_DLOG_ARG(a) MIVE_DLOG_ARGS_3(__VA_ARGS__)
+#define MIVE_DLOG_ARGS_5(a, ...) , MIVE_DLOG_ARG(a) MIVE_DLOG_ARGS_4(__VA_ARGS__)
+#define MIVE_DLOG_ARGS_6(a, ...) , MIVE_DLOG_ARG(a) MIVE_DLOG_ARGS_5(__VA_ARGS__)
+
+#define MIVE_DLOG_DATA(level, tag, kind, data, len, fmt, ...) \
+  do { \
+    if((level) <= MIVE_DLOG_LEVEL) \
+    { \
+      static mive_dlog_site_t dlog_site_; \
+      if(0) \
+      { \
+        mive_dlog_check(fmt, ##__VA_ARGS__); \
+      } \
+      mive_dlog_write(&dlog_site_, (level), (tag), (kind), (data), (len), MIVE_DLOG_NARGS(__VA_ARGS__), \
+                      fmt MIVE_DLOG_ARGS(__VA_ARGS__)); \
+    } \
+  } while(0)
+
+#define MIVE_DLOG(level, tag, fmt, ...) MIVE_DLOG_DATA(level, tag, MIVE_DLOG_DATA_NONE, NULL, 0, fmt, ##__VA_ARGS__)
+
+#define MIVE_DLOGE(tag, fmt, ...) MIVE_DLOG(MIVE_DLOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define MIVE_DLOGW(tag, fmt, ...) MIVE_DLOG(MIVE_DLOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define MIVE_DLOGI(tag, fmt, ...) MIVE_DLOG(MIVE_DLOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define MIVE_DLOGD(tag, fmt, ...) MIVE_DLOG(MIVE_DLOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+#endif // _MIVE_DLOG_H
\ No newline at end of file
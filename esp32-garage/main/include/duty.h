@@ -0,0 +1,66 @@
+#ifndef _MIVE_DUTY_H
+#define _MIVE_DUTY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "presence.h"
+
+// Decides how hard the NFC reader and the ultrasonic sensor work, from what
+// the other inputs say about somebody being around: presence motion, the
+// door moving, card taps and a running card registration.
+//
+// NFC   FAST  reader polls all the time, a tap is seen within one poll.
+//       SLOW  reader polls for a short window every period.
+//       OFF   reader paused, only with MIVE_DUTY_NFC_OFF_WHEN_QUIET.
+// Ranging follows the presence filter (fast while something moves) and drops
+// to MIVE_DUTY_RANGING_QUIET_PERIOD_MS once nothing happened for a while.
+
+enum mive_duty_mode_e
+{
+  MIVE_DUTY_OFF = 0,
+  MIVE_DUTY_SLOW,
+  MIVE_DUTY_FAST,
+};
+
+// Poll period of the reader itself, the worst case tap latency in FAST. In
+// IRQ mode (nfc_irq.h) the probes come at this pace instead.
+#define MIVE_NFC_POLL_MS 50
+// Stays FAST for this long after the last sign of somebody around.
+#define MIVE_DUTY_ACTIVE_HOLD_MS 30000
+// SLOW scans for ON_MS out of every PERIOD_MS. A card held to the reader for
+// a second still gets picked up.
+#define MIVE_DUTY_NFC_SLOW_ON_MS 150
+#define MIVE_DUTY_NFC_SLOW_PERIOD_MS 1000
+// Nothing happened for this long, the garage counts as quiet.
+#define MIVE_DUTY_QUIET_MS (5 * 60 * 1000)
+#define MIVE_DUTY_RANGING_QUIET_PERIOD_MS 10000
+// The reader is the way in for people on foot, the sensor doesn't see them
+// coming. Only turn it off in installs that have another way in.
+#define MIVE_DUTY_NFC_OFF_WHEN_QUIET 0
+
+typedef struct mive_duty_s
+{
+  // Last tap, door movement or registration.
+  int64_t last_activity_us;
+  // Mode currently applied to the reader.
+  uint8_t nfc_mode;
+  // Reader polling right now, toggles within SLOW.
+  bool nfc_scanning;
+} mive_duty_t;
+
+// Starts out FAST with the reader running.
+void mive_duty_init(mive_duty_t* duty, int64_t now_us);
+
+// Somebody did something, resets the hold and quiet timers.
+void mive_duty_activity(mive_duty_t* duty, int64_t now_us);
+
+enum mive_duty_mode_e mive_duty_nfc_mode(const mive_duty_t* duty, const mive_presence_t* presence, bool door_moving,
+                                         bool registering, int64_t now_us);
+
+// How long to wait before the next ping.
+uint32_t mive_duty_ranging_period_ms(const mive_duty_t* duty, mive_presence_t* presence, bool door_moving, int64_t now_us);
+
+const char* mive_duty_mode_str(enum mive_duty_mode_e mode);
+
+#endif // _MIVE_DUTY_H
\ No newline at end of file
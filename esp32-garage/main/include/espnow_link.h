@@ -0,0 +1,107 @@
+#ifndef _MIVE_ESPNOW_LINK_H
+#define _MIVE_ESPNOW_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#include "mive_espnow_proto.h"
+
+// Garage end of the ESP-NOW command protocol (see mive_espnow_proto.h).
+// Receive runs on the Wi-Fi task, the ACK for an accepted command is sent
+// by main_task once its relay pulse is done.
+//
+// Frames count only from registered peers. Anybody in range can send an
+// unencrypted frame, a made up counter from them must not lock the real
+// remote out.
+
+#define MIVE_ESPNOW_ADDR_LEN 6
+#define MIVE_ESPNOW_MAX_PEERS 4
+
+enum mive_espnow_rx_e
+{
+  MIVE_ESPNOW_RX_INVALID = 0,
+  // Bare MIVE_ESPNOW_MAGIC from an old remote, toggle without ACK.
+  MIVE_ESPNOW_RX_LEGACY,
+  // New press, already accepted. Carry it out, or mive_espnow_link_cancel
+  // it if that can't even be queued.
+  MIVE_ESPNOW_RX_NEW,
+  // Repeat of the last accepted press, its ACK has been resent if ready.
+  MIVE_ESPNOW_RX_DUPLICATE,
+  // Older than the last accepted press.
+  MIVE_ESPNOW_RX_STALE,
+  // Not from a registered peer, dropped before looking at it.
+  MIVE_ESPNOW_RX_UNKNOWN_PEER,
+};
+
+struct mive_espnow_press
+{
+  bool seen;
+  uint32_t counter;
+  uint16_t seq;
+  // type is 0 until main_task filled it in.
+  mive_espnow_frame_t ack;
+};
+
+struct mive_espnow_peer
+{
+  bool used;
+  uint8_t mac[MIVE_ESPNOW_ADDR_LEN];
+  // Last accepted press, and the one before it to go back to on cancel.
+  struct mive_espnow_press last;
+  struct mive_espnow_press undo;
+};
+
+typedef struct mive_espnow_link_s
+{
+  portMUX_TYPE lock;
+  struct mive_espnow_peer peers[MIVE_ESPNOW_MAX_PEERS];
+
+  // main_task only. ESP-NOW relay pulses queued and not done yet, and the
+  // press whose ACK waits for one of them.
+  uint8_t pulses;
+  int64_t queued_us;
+  bool waiting;
+  // Pulses queued ahead of the waiting one.
+  uint8_t skip;
+  uint8_t wait_peer;
+  uint32_t wait_counter;
+  uint16_t wait_seq;
+  uint8_t wait_command;
+} mive_espnow_link_t;
+
+void mive_espnow_link_init(mive_espnow_link_t* link);
+
+// Before the receive callback is registered.
+esp_err_t mive_espnow_link_add_peer(mive_espnow_link_t* link, const uint8_t* mac);
+
+// Sorts out a received payload, frame and peer are filled in for NEW,
+// DUPLICATE and STALE, peer for LEGACY too.
+enum mive_espnow_rx_e mive_espnow_link_receive(mive_espnow_link_t* link, const uint8_t* mac, const uint8_t* data, int len, mive_espnow_frame_t* frame, uint8_t* peer);
+
+// Takes back a NEW press that couldn't be queued, so its retransmission is
+// NEW again.
+void mive_espnow_link_cancel(mive_espnow_link_t* link, uint8_t peer, const mive_espnow_frame_t* frame);
+
+// main_task, an accepted press couldn't be carried out. Takes it back like
+// mive_espnow_link_cancel and answers BUSY.
+void mive_espnow_link_busy(mive_espnow_link_t* link, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t command, uint8_t state);
+
+// Answers a COMMAND right away without accepting it (BUSY).
+void mive_espnow_link_reply(const uint8_t* mac, const mive_espnow_frame_t* frame, uint8_t result, uint8_t state);
+
+// Stores and sends the ACK for an accepted press, repeats of it get the
+// same ACK. Ignored if a newer press
+// has been accepted in the meantime.
+void mive_espnow_link_ack(mive_espnow_link_t* link, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t command, uint8_t result, uint8_t state);
+
+// main_task, a relay pulse for an ESP-NOW command has been queued. With ack
+// the press gets its ACK from mive_espnow_link_pulse_done.
+void mive_espnow_link_pulse_queued(mive_espnow_link_t* link, bool ack, uint8_t peer, uint32_t counter, uint16_t seq, uint8_t command);
+
+// main_task, the next ESP-NOW relay pulse is done. state is where the door
+// is headed, or where it stays if the pulse failed.
+void mive_espnow_link_pulse_done(mive_espnow_link_t* link, bool ok, uint8_t state);
+
+#endif // _MIVE_ESPNOW_LINK_H
\ No newline at end of file
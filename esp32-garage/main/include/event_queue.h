@@ -0,0 +1,93 @@
+#ifndef _MIVE_EVENT_QUEUE_H
+#define _MIVE_EVENT_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+
+#include "events.h"
+#include "sysmon.h"
+
+// Lanes are served strictly in order, lowest index first.
+// An event waiting in a lower lane is only looked at once all lanes above it are empty.
+enum mive_event_lane_e
+{
+  // Door actuation and safety. Never waits behind anything else.
+  MIVE_LANE_ACTUATION = 0,
+  // State changes somebody is waiting to see (door state, auth state).
+  MIVE_LANE_CONTROL,
+  // Periodic measurements and their publishes.
+  MIVE_LANE_TELEMETRY,
+  // Persistence and anything else that can wait.
+  MIVE_LANE_HOUSEKEEPING,
+
+  MIVE_LANE_MAX,
+};
+
+#define MIVE_LANE_ACTUATION_DEPTH 4
+#define MIVE_LANE_CONTROL_DEPTH 8
+#define MIVE_LANE_TELEMETRY_DEPTH 8
+#define MIVE_LANE_HOUSEKEEPING_DEPTH 4
+// Requests that only say "go look at the current state" and carry no data.
+// Sending one that is already pending merges into it instead of taking a lane
+// slot, so repeats never block the sender and can't crowd real commands out.
+#define MIVE_EVENT_COALESCED ((1UL << MIVE_EVENT_GET_GARAGE_INFO) | (1UL << MIVE_EVENT_SEND_GARAGE_INFO) | \
+                              (1UL << MIVE_EVENT_SEND_AUTH_STATE) | (1UL << MIVE_EVENT_MEASURE_DISTANCE) | \
+                              (1UL << MIVE_EVENT_MQTT_CONNECTED) | (1UL << MIVE_EVENT_SAVE_UUID) | \
+                              (1UL << MIVE_EVENT_RESET_GARAGE_SWITCH) | (1UL << MIVE_EVENT_SEND_PRESENCE) | \
+                              (1UL << MIVE_EVENT_SEND_STATE_DOC) | (1UL << MIVE_EVENT_PUBLISH_METRICS) | \
+                              (1UL << MIVE_EVENT_NFC_DUTY) | (1UL << MIVE_EVENT_NFC_FIELD) | \
+                              (1UL << MIVE_EVENT_HISTORY_FLUSH) | (1UL << MIVE_EVENT_NET_DRAINED) | \
+                              (1UL << MIVE_EVENT_LOAD_CREDENTIALS))
+
+#define MIVE_EVENT_QUEUE_DEPTH (MIVE_LANE_ACTUATION_DEPTH + MIVE_LANE_CONTROL_DEPTH + MIVE_LANE_TELEMETRY_DEPTH + MIVE_LANE_HOUSEKEEPING_DEPTH)
+
+struct mive_event_lane_stats
+{
+  // Events currently waiting in the lane.
+  uint32_t depth;
+  // Deepest the lane has been since boot.
+  uint32_t high_water;
+  uint32_t sent;
+  // Sends that failed because the lane was full.
+  uint32_t dropped;
+  // Sends merged into an already pending coalesced event.
+  uint32_t coalesced;
+};
+
+typedef struct mive_event_queue_s
+{
+  QueueHandle_t lanes[MIVE_LANE_MAX];
+  // Counts events across all lanes, so the receiver has a single thing to block on.
+  SemaphoreHandle_t pending;
+  portMUX_TYPE lock;
+  struct mive_event_lane_stats stats[MIVE_LANE_MAX];
+  // Coalesced events waiting, one bit per event type. Guarded by lock.
+  uint32_t flagged;
+  // First send of every flagged event, keeps its source and timestamps.
+  mive_event_t flagged_events[MIVE_EVENT_MAX];
+#if MIVE_STATIC_ALLOC
+  StaticQueue_t lane_buffers[MIVE_LANE_MAX];
+  StaticSemaphore_t pending_buffer;
+  uint8_t lane_storage[MIVE_EVENT_QUEUE_DEPTH * sizeof(mive_event_t)];
+#endif
+} mive_event_queue_t;
+
+esp_err_t mive_event_queue_init(mive_event_queue_t* queue);
+
+enum mive_event_lane_e mive_event_get_lane(unsigned int event_type);
+
+// Coalesced events (MIVE_EVENT_COALESCED) never wait and always succeed.
+BaseType_t mive_event_queue_send(mive_event_queue_t* queue, const mive_event_t* event, TickType_t ticks_to_wait);
+
+BaseType_t mive_event_queue_send_from_isr(mive_event_queue_t* queue, const mive_event_t* event, BaseType_t* higher_prio_woken);
+
+// Returns the oldest event of the highest priority non-empty lane.
+// Within a lane, pending coalesced events come before queued ones, they read
+// the current state when handled so their order doesn't matter.
+BaseType_t mive_event_queue_receive(mive_event_queue_t* queue, mive_event_t* event, TickType_t ticks_to_wait);
+
+void mive_event_queue_get_stats(mive_event_queue_t* queue, enum mive_event_lane_e lane, struct mive_event_lane_stats* stats);
+
+#endif // _MIVE_EVENT_QUEUE_H
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef _MIVE_EVENTS_H
 #define _MIVE_EVENTS_H
 
+#include <stdint.h>
+
 enum mive_event_e
 {
   MIVE_EVENT_NONE = 0,
@@ -13,6 +15,39 @@ enum mive_event_e
   MIVE_EVENT_MQTT_CONNECTED,
   MIVE_EVENT_SAVE_UUID,
   MIVE_EVENT_RESET_GARAGE_SWITCH,
+  MIVE_EVENT_DISTANCE_READY,
+  MIVE_EVENT_SEND_PRESENCE,
+  MIVE_EVENT_SEND_STATE_DOC,
+  MIVE_EVENT_PUBLISH_METRICS,
+  MIVE_EVENT_DUMP_TRACE,
+  MIVE_EVENT_NFC_DUTY,
+  MIVE_EVENT_NFC_FIELD,
+  MIVE_EVENT_GARAGE_DONE,
+  MIVE_EVENT_CARD_REJECTED,
+  MIVE_EVENT_HISTORY_FLUSH,
+  MIVE_EVENT_HISTORY_QUERY,
+  MIVE_EVENT_ENROLL_CARD,
+  MIVE_EVENT_CARD_REMOVED,
+  MIVE_EVENT_NET_DRAINED,
+  MIVE_EVENT_CHECK_CARD,
+  MIVE_EVENT_LOAD_CREDENTIALS,
+
+  MIVE_EVENT_MAX,
+};
+
+// Where an event (or the chain of events it started) came from.
+enum mive_event_source_e
+{
+  MIVE_SOURCE_INTERNAL = 0,
+  MIVE_SOURCE_TIMER,
+  MIVE_SOURCE_SENSOR,
+  MIVE_SOURCE_NFC,
+  MIVE_SOURCE_MQTT,
+  MIVE_SOURCE_ESPNOW,
+  // WebSocket client on the LAN, see ws_server.h.
+  MIVE_SOURCE_LOCAL,
+
+  MIVE_SOURCE_MAX,
 };
 
 struct mive_event_send_garage_info
@@ -25,12 +60,77 @@ struct mive_event_send_auth_state
   uint8_t auth_state;
 };
 
+struct mive_event_start_garage
+{
+  // enum mive_garage_command_e, zero is a plain toggle.
+  uint8_t command;
+  // ESP-NOW press to ACK once the command has been carried out.
+  uint8_t espnow_ack;
+  uint16_t espnow_seq;
+  uint32_t espnow_counter;
+  // Index of the remote in mive_espnow_link_t.
+  uint8_t espnow_peer;
+  // Index of the card for NFC, goes into the history.
+  uint8_t credential;
+};
+
+struct mive_event_dump_trace
+{
+  // Print to the console instead of publishing over MQTT.
+  uint8_t console;
+};
+
+struct mive_event_distance_ready
+{
+  uint8_t status;
+  uint32_t distance_cm;
+};
+
+// mive_garage_result_t, the tag goes into the event's source.
+struct mive_event_garage_done
+{
+  uint8_t op;
+  uint8_t state;
+  int32_t status;
+  uint32_t elapsed_us;
+};
+
+// Same as rc522_picc_uid_t, without pulling the driver in here.
+#define MIVE_EVENT_UID_MAX 10
+
+struct mive_event_nfc_card
+{
+  uint8_t uid[MIVE_EVENT_UID_MAX];
+  uint8_t length;
+};
+
+struct mive_event_history_query
+{
+  uint32_t from_s;
+  // 0 for no upper limit.
+  uint32_t to_s;
+  // Where to continue, see mive_history_query.
+  uint32_t cursor;
+};
+
 struct mive_event_s
 {
   unsigned int event_type;
+  uint8_t source;
+  // When the outside world asked for this. Stamped by the first send and
+  // carried along when main_task reposts the event as a follow-up.
+  int64_t ingress_us;
+  // When this particular event went into the queue, stamped on every send.
+  int64_t enqueued_us;
   union {
     struct mive_event_send_garage_info send_garage_info;
     struct mive_event_send_auth_state send_auth_state;
+    struct mive_event_distance_ready distance_ready;
+    struct mive_event_start_garage start_garage;
+    struct mive_event_dump_trace dump_trace;
+    struct mive_event_garage_done garage_done;
+    struct mive_event_history_query history_query;
+    struct mive_event_nfc_card nfc_card;
   } event_data;
 };
 
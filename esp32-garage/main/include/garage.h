@@ -1,6 +1,8 @@
 #ifndef _MIVE_GARAGE_H
 #define _MIVE_GARAGE_H
 
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_err.h"
 #include "driver/i2c_master.h"
 
@@ -13,11 +15,86 @@ union garage_i2c_reg
 	} s;
 };
 
+// Transfers go through the driver's transaction queue and complete in its
+// ISR, the caller never waits on the bus. Failed transfers reset the bus
+// (which clocks SCL until a stuck slave lets go of SDA), repeated failures
+// tear the bus down and bring it back up, and polls back off exponentially
+// while the ATmega doesn't answer.
+
+// Transfers in flight at once, also the depth of the driver's queue.
+#define MIVE_GARAGE_QUEUE_DEPTH 4
+// Hardware timeout of a single transfer.
+#define MIVE_GARAGE_XFER_TIMEOUT_MS 20
+// A transfer whose completion never came is given up on after this long.
+#define MIVE_GARAGE_STUCK_MS 200
+// How long a stuck driver gets to finish its queue before it is torn down.
+#define MIVE_GARAGE_DRAIN_MS 50
+// Consecutive failures before the bus gets torn down instead of reset.
+#define MIVE_GARAGE_REINIT_AFTER 3
+// Poll backoff after a failure, doubling up to the max.
+#define MIVE_GARAGE_BACKOFF_MIN_MS 250
+#define MIVE_GARAGE_BACKOFF_MAX_MS 8000
+
+enum mive_garage_op_e
+{
+  MIVE_GARAGE_OP_READ = 0,
+  MIVE_GARAGE_OP_ACTUATE,
+};
+
+typedef struct mive_garage_result_s
+{
+  uint8_t op;
+  // Passed through from the call that started the transfer.
+  uint8_t tag;
+  // enum garage_state_e for a successful read.
+  uint8_t state;
+  esp_err_t status;
+  uint32_t elapsed_us;
+} mive_garage_result_t;
+
+// Called from ISR context once a transfer is done, either way.
+// Return true if a higher priority task was woken.
+typedef bool (*mive_garage_done_cb_t)(const mive_garage_result_t* result, void* arg);
+
+typedef struct mive_garage_stats_s
+{
+  uint32_t ok;
+  uint32_t nack;
+  uint32_t timeout;
+  // Bus resets, including the ones done as part of a re-init.
+  uint32_t resets;
+  uint32_t reinits;
+  // Polls not sent because of the backoff or a full queue.
+  uint32_t skipped;
+} mive_garage_stats_t;
+
+struct mive_garage_xfer_s
+{
+  uint8_t op;
+  uint8_t tag;
+  uint8_t tx[2];
+  uint8_t rx;
+  int64_t started_us;
+};
+
 typedef struct mive_garage_t 
 {
   i2c_master_bus_handle_t bus_master;
   i2c_master_dev_handle_t dev_handle;
-  union garage_i2c_reg reg;
+  i2c_master_bus_config_t bus_config;
+  i2c_device_config_t dev_config;
+  mive_garage_done_cb_t on_done;
+  void* arg;
+  // Transfers in the driver's queue, in order. The ISR pops, the caller pushes.
+  struct mive_garage_xfer_s xfers[MIVE_GARAGE_QUEUE_DEPTH];
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  portMUX_TYPE lock;
+  // Everything below only touched by the caller's task.
+  uint32_t failures;
+  int64_t retry_at_us;
+  bool recover;
+  mive_garage_stats_t stats;
 } mive_garage_t;
 
 
@@ -40,12 +117,41 @@ enum garage_state_e
   GARAGE_STATE_MAX = GARAGE_CLOSING,
 };
 
-esp_err_t mive_garage_init(mive_garage_t* garage, i2c_master_bus_config_t* bus_config, i2c_device_config_t* dev_config);
+enum mive_garage_command_e
+{
+	// Whatever the button would do next.
+	MIVE_GARAGE_CMD_TOGGLE = 0,
+	MIVE_GARAGE_CMD_OPEN,
+	MIVE_GARAGE_CMD_CLOSE,
+	MIVE_GARAGE_CMD_STOP,
+};
+
+// The bus is always set up for asynchronous transfers, trans_queue_depth
+// in bus_config gets overridden.
+esp_err_t mive_garage_init(mive_garage_t* garage, i2c_master_bus_config_t* bus_config, i2c_device_config_t* dev_config,
+                           mive_garage_done_cb_t on_done, void* arg);
+
+// Queues a read of the door state and returns immediately.
+// Returns ESP_ERR_NOT_ALLOWED while backing off after failures and
+// ESP_ERR_INVALID_STATE if the queue is full.
+esp_err_t mive_garage_read_async(mive_garage_t* garage, uint8_t tag);
 
-enum garage_state_e mive_garage_get_state(mive_garage_t* garage);
+// Queues a relay pulse and returns immediately. Not held back by the
+// backoff, someone asked for it.
+esp_err_t mive_garage_actuate_async(mive_garage_t* garage, uint8_t tag);
 
-esp_err_t mive_garage_actuate(mive_garage_t* garage);
+// Books a result handed to on_done, call from the caller's task. Runs the
+// bus recovery once a failed transfer left the queue empty.
+void mive_garage_complete(mive_garage_t* garage, const mive_garage_result_t* result);
 
 char* mive_garage_get_state_str(enum garage_state_e state);
 
+bool mive_garage_is_moving(enum garage_state_e state);
+
+// Where one relay pulse sends the door from state.
+enum garage_state_e mive_garage_next_state(enum garage_state_e state);
+
+// Whether pressing the button in this state carries out the command.
+bool mive_garage_command_applies(enum garage_state_e state, enum mive_garage_command_e command);
+
 #endif // _MIVE_GARAGE_H
\ No newline at end of file
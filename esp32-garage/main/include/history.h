@@ -0,0 +1,121 @@
+#ifndef _MIVE_HISTORY_H
+#define _MIVE_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+// Audit trail of door cycles, commands and faults in its own data partition.
+// The partition is a circular log of fixed size records, written strictly in
+// order and erased one sector at a time just before the write position gets
+// there, so every sector wears at the same rate. Records collect in RAM and
+// go to flash a whole page at a time, or after MIVE_HISTORY_FLUSH_MS when
+// things are quiet. Only main_task touches it.
+
+#define MIVE_HISTORY_PARTITION_NAME "history"
+#define MIVE_HISTORY_MAGIC 0x4c48564d // "MVHL"
+#define MIVE_HISTORY_VERSION 1
+// Flash program page, the unit records get written in.
+#define MIVE_HISTORY_PAGE_SIZE 256
+// Longest a record waits in RAM before it gets written.
+#define MIVE_HISTORY_FLUSH_MS (60 * 1000)
+// Records per MQTT reply, see mive_history_query.
+#define MIVE_HISTORY_QUERY_RECORDS 64
+// Records read per reply at most, bounds the time a narrow query holds up
+// main_task.
+#define MIVE_HISTORY_QUERY_SCAN 512
+// Times before this are an unset clock, SNTP hasn't synced yet.
+#define MIVE_HISTORY_MIN_TIME 1704067200 // 2024-01-01
+#define MIVE_HISTORY_NO_CREDENTIAL 0xff
+
+enum mive_history_kind_e
+{
+  MIVE_HISTORY_NONE = 0,
+  // arg: esp_reset_reason_t.
+  MIVE_HISTORY_BOOT,
+  // arg: new door state (enum garage_state_e).
+  MIVE_HISTORY_DOOR,
+  // A START_GARAGE from any source. arg: enum mive_garage_command_e,
+  // result: enum mive_history_result_e, credential: card index for NFC.
+  MIVE_HISTORY_COMMAND,
+  // Card that isn't registered. arg: NFC registration state.
+  MIVE_HISTORY_CARD_REJECTED,
+  // The door controller stopped answering. arg: failures in a row.
+  MIVE_HISTORY_FAULT,
+
+  MIVE_HISTORY_KIND_MAX,
+};
+
+enum mive_history_result_e
+{
+  MIVE_HISTORY_RESULT_OK = 0,
+  MIVE_HISTORY_RESULT_NOT_APPLICABLE,
+  MIVE_HISTORY_RESULT_BUSY,
+};
+
+typedef struct __attribute__((packed)) mive_history_record_s
+{
+  // Records written since the log was created, finds the end of the log on boot.
+  uint32_t seq;
+  // Unix time from SNTP, 0 if the clock wasn't set yet.
+  uint32_t time_s;
+  uint8_t kind;
+  // enum mive_event_source_e
+  uint8_t source;
+  uint8_t credential;
+  uint8_t result;
+  uint16_t arg;
+  // CRC-16 over everything above, tells a torn write from a record.
+  uint16_t crc;
+} mive_history_record_t;
+
+#define MIVE_HISTORY_PAGE_RECORDS (MIVE_HISTORY_PAGE_SIZE / sizeof(mive_history_record_t))
+
+typedef struct __attribute__((packed)) mive_history_header_s
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t record_size;
+  // Records following the header.
+  uint16_t count;
+  // Where the next reply of this query continues, 0 for the last one.
+  uint32_t next;
+} mive_history_header_t;
+
+#define MIVE_HISTORY_REPLY_MAX_LEN (sizeof(mive_history_header_t) + MIVE_HISTORY_QUERY_RECORDS * sizeof(mive_history_record_t))
+
+typedef struct mive_history_s
+{
+  // NULL without a history partition, records are then dropped.
+  const esp_partition_t* partition;
+  // Offset of the next record in the partition.
+  uint32_t write_offset;
+  // Records in flash, they end right before write_offset.
+  uint32_t flash_records;
+  // Sequence number the next appended record gets.
+  uint32_t next_seq;
+  // Records not written yet, they go right after the ones in flash.
+  mive_history_record_t page[MIVE_HISTORY_PAGE_RECORDS];
+  uint32_t num_pending;
+} mive_history_t;
+
+// Finds the partition and the end of the log in it.
+esp_err_t mive_history_init(mive_history_t* history);
+
+// Stamps and buffers a record. Returns true once a page worth is waiting,
+// flush then.
+bool mive_history_append(mive_history_t* history, uint8_t kind, uint8_t source, uint8_t credential, uint8_t result, uint16_t arg);
+
+// Writes whatever is buffered.
+esp_err_t mive_history_flush(mive_history_t* history);
+
+// Copies up to MIVE_HISTORY_QUERY_RECORDS records stamped within
+// [from_s, to_s] (to_s 0 for no limit), oldest first, behind a
+// mive_history_header_t. cursor is 0 for the first reply and header.next
+// for the ones after, a reply can come back empty with more to follow.
+// Returns the length or -1 if buf is too small.
+int mive_history_query(mive_history_t* history, uint32_t from_s, uint32_t to_s, uint32_t cursor, uint8_t* buf, size_t buf_len);
+
+#endif // _MIVE_HISTORY_H
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef _MIVE_METRICS_H
+#define _MIVE_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "events.h"
+#include "event_queue.h"
+#include "garage.h"
+#include "net.h"
+
+// Latency histograms per event source and per processing stage.
+// Buckets are powers of two in microseconds, bucket i counts samples in
+// [2^i, 2^(i+1)) us, the last one catches everything above.
+// Only touched from main_task, so no locking.
+
+#define MIVE_METRICS_BUCKETS 24
+#define MIVE_METRICS_PUBLISH_PERIOD_MS 60000
+#define MIVE_METRICS_MAX_LEN 1792
+// An actuation not confirmed by a state change within this long is not counted.
+#define MIVE_METRICS_ACTUATION_TIMEOUT_US 10000000
+
+enum mive_metrics_stage_e
+{
+  // Sitting in the event queue.
+  MIVE_STAGE_QUEUE = 0,
+  // Running the event handler in main_task.
+  MIVE_STAGE_HANDLER,
+  // Talking to the ATmega.
+  MIVE_STAGE_I2C,
+  // Handing a message to the net task.
+  MIVE_STAGE_PUBLISH,
+  // From ingress to the door state actually changing.
+  MIVE_STAGE_ACTUATION,
+
+  MIVE_STAGE_MAX,
+};
+
+typedef struct mive_histogram_s
+{
+  uint32_t buckets[MIVE_METRICS_BUCKETS];
+  uint32_t count;
+  uint32_t max_us;
+} mive_histogram_t;
+
+typedef struct mive_metrics_t
+{
+  mive_histogram_t hist[MIVE_SOURCE_MAX][MIVE_STAGE_MAX];
+  // Source of the event main_task is handling right now, publishes get billed to it.
+  uint8_t current_source;
+  int64_t window_start_us;
+
+  // Actuation waiting for the door to confirm it.
+  uint8_t pending_source;
+  int64_t pending_ingress_us;
+} mive_metrics_t;
+
+void mive_metrics_init(mive_metrics_t* metrics);
+
+void mive_histogram_add(mive_histogram_t* hist, uint32_t elapsed_us);
+
+void mive_metrics_record(mive_metrics_t* metrics, enum mive_event_source_e source, enum mive_metrics_stage_e stage, int64_t elapsed_us);
+
+// Remembers an actuation so the next door state change can close it.
+void mive_metrics_actuation_started(mive_metrics_t* metrics, enum mive_event_source_e source, int64_t ingress_us);
+
+void mive_metrics_actuation_confirmed(mive_metrics_t* metrics, int64_t now_us);
+
+uint32_t mive_histogram_percentile(const mive_histogram_t* hist, uint32_t percentile);
+
+// Encodes all non-empty histograms plus the event queue lane and I2C error
+// stats as JSON and starts a new window. Returns the length or -1 if buf is
+// too small.
+int mive_metrics_take_json(mive_metrics_t* metrics, mive_event_queue_t* queue, const mive_garage_stats_t* i2c, const mive_net_stats_t* net, char* buf, size_t buf_len);
+
+#endif // _MIVE_METRICS_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+#ifndef _MIVE_MQTT_PUBLISH_H
+#define _MIVE_MQTT_PUBLISH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "program_opaque.h"
+#include "state_doc.h"
+
+// ==== Publisher paths ====
+
+// State of garage door.
+#define MQTT_STATE_PATH "/garage/state"
+// State of NFC card registration.
+#define MQTT_REGISTER_NFC_STATE "/garage/auth/state"
+// Presence detection.
+#define MQTT_PRESENCE_PATH "/garage/presence/distance"
+#define MQTT_PRESENCE_STATE_PATH "/garage/presence/state"
+// State of the switch entity, goes back to OFF after a press.
+#define MQTT_SWITCH_STATE_PATH "/garage/switch/state"
+// Everything above in one document, see state_doc.h.
+#define MQTT_STATUS_PATH "/garage/status"
+// Latency histograms, see metrics.h.
+#define MQTT_METRICS_PATH "/garage/metrics"
+// Binary trace dump, see trace.h.
+#define MQTT_TRACE_PATH "/garage/trace"
+// Discrete changes that happened while the broker was unreachable, replayed
+// oldest first on reconnect as {"topic":...,"value":...,"age_ms":...}.
+#define MQTT_EVENTS_PATH "/garage/events"
+// Binary history records answering MQTT_HISTORY_GET_PATH, see history.h.
+#define MQTT_HISTORY_PATH "/garage/history"
+// Boot time markers, see boot.h.
+#define MQTT_BOOT_PATH "/garage/boot"
+
+// Keep publishing every piece of state on its own topic as well.
+// Turn off once all consumers read MQTT_STATUS_PATH.
+#define MIVE_PUBLISH_SINGLE_TOPICS 1
+
+// ==== Per-topic delivery policy ====
+
+#define MQTT_STATE_QOS 1
+#define MQTT_STATE_RETAIN 1
+#define MQTT_REGISTER_NFC_STATE_QOS 1
+#define MQTT_REGISTER_NFC_STATE_RETAIN 1
+// Changes several times a second while something moves, a lost sample doesn't matter.
+#define MQTT_PRESENCE_QOS 0
+#define MQTT_PRESENCE_RETAIN 1
+#define MQTT_PRESENCE_STATE_QOS 1
+#define MQTT_PRESENCE_STATE_RETAIN 1
+#define MQTT_SWITCH_STATE_QOS 1
+#define MQTT_SWITCH_STATE_RETAIN 1
+#define MQTT_STATUS_QOS 1
+#define MQTT_STATUS_RETAIN 1
+#define MQTT_METRICS_QOS 0
+#define MQTT_METRICS_RETAIN 0
+#define MQTT_TRACE_QOS 0
+#define MQTT_TRACE_RETAIN 0
+#define MQTT_EVENTS_QOS 1
+#define MQTT_EVENTS_RETAIN 0
+#define MQTT_HISTORY_QOS 1
+#define MQTT_HISTORY_RETAIN 0
+#define MQTT_BOOT_QOS 1
+#define MQTT_BOOT_RETAIN 1
+
+// ==== Offline outbox ====
+
+// What a topic keeps while the broker is unreachable or can't keep up.
+// MIVE_OFFLINE_DROP topics are bulk for the net task, see net.h.
+enum mive_offline_e
+{
+  // Dropped, the next value replaces it anyway (metrics, dumps).
+  MIVE_OFFLINE_DROP = 0,
+  // Only the latest value, republished on reconnect.
+  MIVE_OFFLINE_LATEST,
+  // Latest value, plus every value in the history ring.
+  MIVE_OFFLINE_HISTORY,
+};
+
+// Largest value the outbox keeps per topic, longer ones are dropped offline.
+#define MIVE_OUTBOX_VALUE_LEN MIVE_STATE_DOC_MAX_LEN
+// Discrete values kept across an outage, the oldest get overwritten.
+#define MIVE_OUTBOX_HISTORY_LEN 16
+#define MIVE_OUTBOX_HISTORY_VALUE_LEN 24
+#define MIVE_OUTBOX_EVENT_MAX_LEN 96
+
+enum mive_topic_e
+{
+  MIVE_TOPIC_STATE = 0,
+  MIVE_TOPIC_REGISTER_NFC_STATE,
+  MIVE_TOPIC_PRESENCE,
+  MIVE_TOPIC_PRESENCE_STATE,
+  MIVE_TOPIC_SWITCH_STATE,
+  MIVE_TOPIC_STATUS,
+  MIVE_TOPIC_METRICS,
+  MIVE_TOPIC_TRACE,
+  MIVE_TOPIC_EVENTS,
+  MIVE_TOPIC_HISTORY,
+  MIVE_TOPIC_BOOT,
+
+  MIVE_TOPIC_MAX,
+};
+
+struct mive_outbox_value
+{
+  // 0 while nothing has been published on the topic.
+  uint16_t len;
+  // Not on the broker yet.
+  uint8_t pending;
+  char data[MIVE_OUTBOX_VALUE_LEN];
+};
+
+struct mive_outbox_history
+{
+  int64_t time_us;
+  uint8_t topic;
+  uint8_t len;
+  char data[MIVE_OUTBOX_HISTORY_VALUE_LEN];
+};
+
+// Owned by main_task, apart from online which the MQTT task clears and
+// connection which only the MQTT task writes.
+typedef struct mive_outbox_s
+{
+  uint8_t online;
+  // Goes up on every connect and disconnect, odd while connected.
+  uint32_t connection;
+  struct mive_outbox_value latest[MIVE_TOPIC_MAX];
+  struct mive_outbox_history history[MIVE_OUTBOX_HISTORY_LEN];
+  // Entries written since the last flush, anything above MIVE_OUTBOX_HISTORY_LEN got overwritten.
+  uint32_t history_count;
+  // Publishes dropped offline or for lack of room since boot.
+  uint32_t dropped;
+} mive_outbox_t;
+
+// Hands the value to the net task with the topic's QoS and retain policy,
+// or parks it in the outbox while offline or while the net task is behind.
+// Never waits on the network.
+// len of 0 means data is a NUL terminated string.
+// Returns 1 once queued, 0 if the topic is turned off or the value was
+// parked or dropped, or -1 on error.
+int mive_publish(mive_program_t* program, enum mive_topic_e topic, const char* data, int len);
+
+// Puts a value from before the reset in the outbox, it goes out with the
+// next flush. Doesn't count as a change while offline.
+void mive_publish_seed(mive_program_t* program, enum mive_topic_e topic, const char* data, int len);
+
+// MQTT task, on MQTT_EVENT_CONNECTED, before main_task hears about it.
+void mive_publish_set_connected(mive_program_t* program);
+
+// MQTT task, on MQTT_EVENT_DISCONNECTED. Publishes go to the outbox from here on.
+void mive_publish_set_offline(mive_program_t* program);
+
+// main_task, once connected or once the net task caught up. Queues the
+// history ring and the latest value of every topic in one go, then goes
+// back to publishing directly, unless the connection dropped meanwhile.
+void mive_publish_flush(mive_program_t* program);
+
+const char* mive_topic_get_path(enum mive_topic_e topic);
+
+#endif // _MIVE_MQTT_PUBLISH_H
\ No newline at end of file
@@ -0,0 +1,130 @@
+#ifndef _MIVE_MQTT_ROUTER_H
+#define _MIVE_MQTT_ROUTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+// Topic router for incoming MQTT messages, and for the same commands coming
+// in over the local WebSocket (see ws_server.h), one router per source.
+// Exact filters are looked up through a hash table, filters with + or #
+// through a trie of topic levels built at registration, so the cost of a
+// lookup doesn't grow with the number of routes.
+// Payloads are parsed as they stream in, fragments of a long message are
+// fed straight from the client buffer and never reassembled.
+
+#define MIVE_ROUTER_MAX_ROUTES 16
+// Must be a power of two.
+#define MIVE_ROUTER_HASH_BUCKETS 32
+#define MIVE_ROUTER_MAX_NODES 32
+// Payloads longer than this can't match any keyword and are dropped early.
+#define MIVE_ROUTER_MAX_KEYWORD_LEN 16
+#define MIVE_ROUTER_MAX_KEYWORDS 32
+// Unsigned decimal numbers picked out of a payload, see mive_route_t.numbers.
+#define MIVE_ROUTER_MAX_NUMBERS 2
+
+// Value reported when the payload didn't match any of the route's keywords.
+#define MIVE_ROUTER_NO_MATCH -1
+
+typedef struct mive_keyword_s
+{
+  const char* word;
+  int32_t value;
+} mive_keyword_t;
+
+struct mive_route_s;
+
+typedef struct mive_mqtt_message_s
+{
+  const struct mive_route_s* route;
+  // enum mive_event_source_e of the router that delivered it.
+  uint8_t source;
+  bool retain;
+  // Value of the matching keyword, MIVE_ROUTER_NO_MATCH if none matched.
+  // Always 0 for routes without keywords.
+  int32_t value;
+  // Numbers in the payload, in order, for routes with numbers set.
+  uint32_t numbers[MIVE_ROUTER_MAX_NUMBERS];
+  uint8_t num_numbers;
+} mive_mqtt_message_t;
+
+// Called from the router's task (MQTT client or HTTP server) once the whole
+// payload went through the parser. Returns false if the message was refused:
+// not understood, or no room for it in main_task's queue.
+typedef bool (*mive_route_handler_t)(const mive_mqtt_message_t* message, void* arg);
+
+typedef struct mive_route_s
+{
+  const char* filter;
+  uint8_t qos;
+  // Retained messages are replays of old commands, most routes want to ignore them.
+  bool accept_retained;
+  // Payload is matched case-insensitively against these, whitespace is ignored.
+  // NULL if the payload doesn't matter.
+  const mive_keyword_t* keywords;
+  uint8_t num_keywords;
+  // Payload is read as up to MIVE_ROUTER_MAX_NUMBERS unsigned numbers split
+  // by anything that isn't a digit, extra ones are ignored.
+  bool numbers;
+  mive_route_handler_t handler;
+  void* arg;
+} mive_route_t;
+
+struct mive_router_node
+{
+  // Points into the route's filter, not NUL terminated.
+  const char* level;
+  uint8_t level_len;
+  int8_t first_child;
+  int8_t next_sibling;
+  int8_t route;
+};
+
+typedef struct mive_mqtt_router_s
+{
+  uint8_t source;
+  const mive_route_t* routes[MIVE_ROUTER_MAX_ROUTES];
+  uint8_t num_routes;
+
+  // Exact filters, chained by index.
+  int8_t buckets[MIVE_ROUTER_HASH_BUCKETS];
+  int8_t bucket_next[MIVE_ROUTER_MAX_ROUTES];
+  uint32_t route_hash[MIVE_ROUTER_MAX_ROUTES];
+
+  // Wildcard filters, node 0 is the root.
+  struct mive_router_node nodes[MIVE_ROUTER_MAX_NODES];
+  uint8_t num_nodes;
+
+  // Message currently being received.
+  const mive_route_t* current;
+  bool current_retain;
+  uint32_t candidates;
+  uint8_t keyword_pos;
+  uint32_t numbers[MIVE_ROUTER_MAX_NUMBERS];
+  uint8_t num_numbers;
+  bool in_number;
+} mive_mqtt_router_t;
+
+// source (enum mive_event_source_e) goes into every message.
+void mive_mqtt_router_init(mive_mqtt_router_t* router, uint8_t source);
+
+// The route has to outlive the router, it isn't copied.
+esp_err_t mive_mqtt_router_add(mive_mqtt_router_t* router, const mive_route_t* route);
+
+const mive_route_t* mive_mqtt_router_match(mive_mqtt_router_t* router, const char* topic, size_t topic_len);
+
+// Subscribes to every registered filter, call on MQTT_EVENT_CONNECTED.
+void mive_mqtt_router_subscribe(mive_mqtt_router_t* router, esp_mqtt_client_handle_t client);
+
+// Feeds one fragment of a message, offset 0 starts a new one and the one
+// that reaches total_len completes it. topic is only read on the first.
+// Returns true once the last fragment went to a handler that took it.
+bool mive_mqtt_router_feed(mive_mqtt_router_t* router, const char* topic, size_t topic_len, const char* data, size_t data_len,
+                           size_t offset, size_t total_len, bool retain);
+
+// Feeds one MQTT_EVENT_DATA event, first fragment or continuation.
+void mive_mqtt_router_dispatch(mive_mqtt_router_t* router, esp_mqtt_event_handle_t event);
+
+#endif // _MIVE_MQTT_ROUTER_H
\ No newline at end of file
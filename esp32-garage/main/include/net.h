@@ -0,0 +1,78 @@
+#ifndef _MIVE_NET_H
+#define _MIVE_NET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+// Outbound MQTT without main_task ever waiting on TCP or the client lock.
+// main_task copies each preformatted payload into a lock-free single
+// producer, single consumer byte ring and moves on. The net task publishes
+// from there and may block as long as the broker makes it. Payloads stay
+// contiguous in the ring, so they go to the client without another copy.
+//
+// What happens when the ring is full is up to the caller, see the offline
+// policies in mqtt_publish.h.
+
+// Bytes, a power of two. Holds a full trace dump.
+#define MIVE_NET_RING_SIZE 8192
+// Kept free for state updates, bulk payloads are refused past this.
+#define MIVE_NET_RESERVE 1024
+#define MIVE_NET_TASK_STACK 4096
+// Below main_task, above the MQTT client's own task. Runs on MIVE_NET_CORE.
+#ifndef MIVE_NET_TASK_PRIO
+#define MIVE_NET_TASK_PRIO 6
+#endif
+
+#define MIVE_NET_FLAG_RETAIN (1 << 0)
+// esp_mqtt_client_enqueue instead of publish, the client sends the whole
+// batch back to back.
+#define MIVE_NET_FLAG_STORE (1 << 1)
+
+typedef struct mive_net_stats_s
+{
+  // Net task.
+  uint32_t sent;
+  uint32_t failed;
+  uint32_t max_publish_us;
+  // main_task.
+  uint32_t refused;
+  uint32_t high_water;
+} mive_net_stats_t;
+
+// Net task, once the ring is empty after a push didn't fit.
+typedef void (*mive_net_drained_cb_t)(void* arg);
+
+typedef struct mive_net_s
+{
+  uint8_t ring[MIVE_NET_RING_SIZE];
+  // Free running byte counts. head only moves in main_task, tail only in
+  // the net task and only after the message was handed to the client.
+  uint32_t head;
+  uint32_t tail;
+  uint8_t congested;
+  esp_mqtt_client_handle_t client;
+  SemaphoreHandle_t wake;
+  StaticSemaphore_t wake_buffer;
+  mive_net_drained_cb_t on_drained;
+  void* arg;
+  mive_net_stats_t stats;
+} mive_net_t;
+
+// Starts the net task, publishing on client.
+esp_err_t mive_net_init(mive_net_t* net, esp_mqtt_client_handle_t client, mive_net_drained_cb_t on_drained, void* arg);
+
+// main_task only. Copies the message into the ring, path has to outlive it.
+// A bulk message is refused when it would eat into MIVE_NET_RESERVE. A
+// message that doesn't fit marks the ring congested, on_drained follows once
+// the net task caught up. Returns false if it wasn't queued.
+bool mive_net_push(mive_net_t* net, const char* path, const char* data, int len, uint8_t qos, uint8_t flags, bool bulk);
+
+// Bytes waiting to be published.
+uint32_t mive_net_pending(mive_net_t* net);
+
+#endif // _MIVE_NET_H
\ No newline at end of file
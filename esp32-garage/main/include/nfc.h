@@ -0,0 +1,55 @@
+#ifndef _MIVE_NFC_H
+#define _MIVE_NFC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+#include "program_opaque.h"
+
+#define NFC_MAX_UIDS 100
+#define NFC_PARTITION_NAME "nvs_rfid"
+#define NFC_STORAGE_NAMESPACE "uuids"
+
+enum mive_nfc_state
+{
+  NFC_STATE_IDLE = 0,
+  NFC_STATE_WAITING_FOR_CARD,
+  NFC_STATE_REMOVE_CARD,
+  NFC_STATE_SUCCESS,
+  NFC_STATE_FAIL,
+
+  NFC_STATE_MAX = NFC_STATE_FAIL,
+};
+
+char* mive_nfc_get_state_str(enum mive_nfc_state state);
+
+esp_err_t mive_nfc_load_uuids(mive_program_t* program);
+
+void mive_nfc_save_uuids(mive_program_t* program);
+
+// main_task owns the registration state and the card list, these are the
+// only writers once it runs. The RC522 callback reads both through
+// program->nfc_lock.
+void mive_nfc_set_state(mive_program_t* program, enum mive_nfc_state state);
+
+// Opens the card partition and reads the list on first use, so boot doesn't
+// wait for it. Anything touching the list calls this first.
+void mive_nfc_ensure_loaded(mive_program_t* program);
+
+// Index of a card in the list, -1 if it isn't registered.
+int32_t mive_nfc_find(mive_program_t* program, const uint8_t* uid, uint8_t length);
+
+// Adds a card, a known one is left as is. False if the list is full.
+bool mive_nfc_enroll(mive_program_t* program, const uint8_t* uid, uint8_t length);
+
+// Resumes or pauses the reader's polling task. main_task only.
+void mive_nfc_set_scanning(mive_program_t* program, bool on);
+
+// RC522_EVENT_PICC_STATE_CHANGED handler, arg is the program.
+// Opens the door for known cards, or hands the card to main_task while a
+// registration is running.
+void mive_nfc_on_picc_state_changed(void *arg, esp_event_base_t base, int32_t event_id, void *data);
+
+#endif // _MIVE_NFC_H
\ No newline at end of file
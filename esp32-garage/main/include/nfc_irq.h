@@ -0,0 +1,54 @@
+#ifndef _MIVE_NFC_IRQ_H
+#define _MIVE_NFC_IRQ_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "rc522.h"
+
+// Card detection through the RC522 IRQ line instead of the reader
+// component's SPI polling.
+// The MFRC522 has no autonomous card detection, so a card still has to be
+// asked for. A probe is a REQA sent with only RxIRq routed to the IRQ pin: a
+// few register writes and no status polling. Nothing comes back unless a card
+// answers, in which case the pin interrupt fires and the reader component is
+// resumed to select the card and report it as usual.
+
+// 0 goes back to letting the reader component poll.
+#ifndef MIVE_NFC_IRQ_MODE
+#define MIVE_NFC_IRQ_MODE 1
+#endif
+
+// The reader component runs for at least this long after an answer, and
+// until the card has left.
+#define MIVE_NFC_IRQ_SESSION_MS 2000
+
+// Called from the GPIO ISR when a card answered a probe.
+// Return true if a higher priority task was woken.
+typedef bool (*mive_nfc_irq_cb_t)(void* arg);
+
+typedef struct mive_nfc_irq_s
+{
+  rc522_driver_handle_t driver;
+  gpio_num_t irq_pin;
+  mive_nfc_irq_cb_t on_card;
+  void* arg;
+  // Set by the PICC event handler while a card is selected.
+  volatile bool card_present;
+  // When the reader component got resumed for the last answer.
+  int64_t session_us;
+} mive_nfc_irq_t;
+
+// Sets up the pin only, the reader registers are written by every probe
+// since the reader component may reset the chip in between.
+esp_err_t mive_nfc_irq_init(mive_nfc_irq_t* irq, rc522_driver_handle_t driver, gpio_num_t irq_pin, mive_nfc_irq_cb_t on_card, void* arg);
+
+// Sends a REQA and arms the IRQ line for the answer. The reader component
+// must be paused, both talk to the same registers.
+esp_err_t mive_nfc_irq_probe(mive_nfc_irq_t* irq);
+
+// Masks the reader interrupt and releases the line, call before resuming
+// the reader component.
+esp_err_t mive_nfc_irq_disarm(mive_nfc_irq_t* irq);
+
+#endif // _MIVE_NFC_IRQ_H
\ No newline at end of file
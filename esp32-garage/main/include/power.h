@@ -0,0 +1,39 @@
+#ifndef _MIVE_POWER_H
+#define _MIVE_POWER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Dynamic frequency scaling and automatic light sleep, needs CONFIG_PM_ENABLE
+// and CONFIG_FREERTOS_USE_TICKLESS_IDLE (see sdkconfig.defaults). Without
+// them everything here is a no-op and the chip stays at full clock.
+//
+// Who keeps the chip awake:
+// - main_task holds the CPU lock while it handles an event, so I2C to the
+//   door and the publishes run at full clock and never sleep halfway.
+// - Ranging only enables its capture and timeout timers for the length of a
+//   ping, their drivers block light sleep while enabled.
+// - The I2C, SPI (RC522 polling) and Wi-Fi drivers take their own locks for
+//   each transfer, the RC522 task sleeps between polls.
+
+#define MIVE_PM_MAX_FREQ_MHZ 240
+// XTAL frequency, the lowest the APB can go without breaking Wi-Fi.
+#define MIVE_PM_MIN_FREQ_MHZ 40
+#define MIVE_PM_LIGHT_SLEEP 1
+
+esp_err_t mive_power_init(void);
+
+// Keeps the CPU at MIVE_PM_MAX_FREQ_MHZ and out of light sleep until
+// mive_power_release(). main_task only, doesn't nest.
+void mive_power_hold(void);
+void mive_power_release(void);
+
+// Appends ,"pm":{"sleep":[count,ms],"busy_ms":ms,"idle_ms":ms} for the time
+// since the previous call and starts a new window. The three add up to the
+// window: light sleep, main_task holding the CPU lock at full clock, and the
+// rest, where DFS picks the clock from the driver locks.
+// Returns the length written, or -1 if buf is too small.
+int mive_power_take_json(char* buf, size_t buf_len);
+
+#endif // _MIVE_POWER_H
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef _MIVE_PRESENCE_H
+#define _MIVE_PRESENCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_bit_defs.h"
+
+#include "ranging.h"
+
+// Raw readings go through a median window (kills single-ping outliers),
+// then an exponential filter (smooths what's left).
+#define MIVE_PRESENCE_MEDIAN_WINDOW 5
+// Filter weight of a new sample is 1 / (1 << MIVE_PRESENCE_EMA_SHIFT).
+#define MIVE_PRESENCE_EMA_SHIFT 2
+
+// Filtered distance has to move this far from the last reported one to be reported again.
+#define MIVE_PRESENCE_DEADBAND_CM 5
+// Something closer than OCCUPIED is a car, farther than VACANT is an empty spot.
+// The gap between the two keeps the state from flapping.
+#define MIVE_PRESENCE_OCCUPIED_CM 150
+#define MIVE_PRESENCE_VACANT_CM 180
+// Consecutive failed pings before the distance is reported as unknown.
+#define MIVE_PRESENCE_MAX_ERRORS 5
+
+// Filtered distance moving this much between two samples counts as motion.
+#define MIVE_PRESENCE_MOTION_CM 3
+// A raw sample this far from the filtered distance counts as motion right
+// away, the median takes a few samples to follow. The state still waits for it.
+#define MIVE_PRESENCE_STEP_CM 20
+// Ranging stays fast for this long after the last motion.
+#define MIVE_PRESENCE_MOTION_HOLD_MS 5000
+// ~15 Hz while something moves or the door is in motion, 0.5 Hz otherwise.
+#define MIVE_PRESENCE_FAST_PERIOD_MS 66
+#define MIVE_PRESENCE_SLOW_PERIOD_MS 2000
+
+enum mive_presence_state_e
+{
+  MIVE_PRESENCE_UNKNOWN = 0,
+  MIVE_PRESENCE_VACANT,
+  MIVE_PRESENCE_OCCUPIED,
+};
+
+// Returned by mive_presence_update, tells what needs to be republished.
+#define MIVE_PRESENCE_CHANGED_DISTANCE BIT0
+#define MIVE_PRESENCE_CHANGED_STATE BIT1
+
+typedef struct mive_presence_t
+{
+  uint32_t max_distance_cm;
+
+  uint32_t window[MIVE_PRESENCE_MEDIAN_WINDOW];
+  uint8_t window_len;
+  uint8_t window_pos;
+
+  // Filter output, scaled by 16 to keep some fraction around.
+  int32_t filtered_x16;
+  bool filtered_valid;
+
+  uint32_t reported_cm;
+  bool reported_valid;
+  uint8_t state;
+
+  uint8_t errors;
+  int64_t last_motion_us;
+} mive_presence_t;
+
+void mive_presence_init(mive_presence_t* presence, uint32_t max_distance_cm);
+
+// Feeds one ranging result, returns a mask of MIVE_PRESENCE_CHANGED_* bits.
+uint8_t mive_presence_update(mive_presence_t* presence, const mive_ranging_result_t* result, int64_t now_us);
+
+// Distance as last reported. Returns false if it's currently unknown.
+bool mive_presence_get_distance(mive_presence_t* presence, uint32_t* distance_cm);
+
+enum mive_presence_state_e mive_presence_get_state(mive_presence_t* presence);
+
+// How long to wait before the next ping.
+uint32_t mive_presence_next_period_ms(mive_presence_t* presence, bool door_moving, int64_t now_us);
+
+const char* mive_presence_state_str(enum mive_presence_state_e state);
+
+#endif // _MIVE_PRESENCE_H
\ No newline at end of file
@@ -13,21 +13,64 @@
 #include "rc522_picc.h"
 
 #include "garage.h"
+#include "event_queue.h"
+#include "ranging.h"
+#include "presence.h"
+#include "state_doc.h"
+#include "mqtt_router.h"
+#include "metrics.h"
+#include "espnow_link.h"
+#include "mqtt_publish.h"
+#include "scheduler.h"
+#include "duty.h"
+#include "nfc_irq.h"
+#include "history.h"
+#include "seqlock.h"
+#include "net.h"
+#include "ws_server.h"
 
 
 struct mive_program_s
 {
-  QueueHandle_t main_queue;
+  mive_event_queue_t main_queue;
   rc522_driver_handle_t nfc_driver;
   rc522_handle_t nfc_scanner;
   esp_mqtt_client_handle_t mqtt_client;
+  mive_mqtt_router_t mqtt_router;
+  // Same routes for the WebSocket, the HTTP server task feeds it.
+  mive_mqtt_router_t local_router;
+  mive_ws_t ws;
   mive_garage_t garage_handle;
+  mive_ranging_t ranging;
+  mive_presence_t presence;
+  mive_state_doc_t state_doc;
+  mive_metrics_t metrics;
+  mive_espnow_link_t espnow;
+  mive_outbox_t outbox;
+  // Everything main_task publishes goes out through here.
+  mive_net_t net;
+  // Deadlines of main_task, only main_task touches it.
+  mive_scheduler_t scheduler;
+  mive_duty_t duty;
+  mive_nfc_irq_t nfc_irq;
+  // Owned by main_task once it runs.
+  mive_history_t history;
+  // Page the broker didn't take, resumed on the next drain or connect.
+  struct mive_event_history_query history_parked;
+  bool history_parked_valid;
   TaskHandle_t main_task_handle;
 
+  // Written by main_task only (app_main before it starts), see
+  // mive_nfc_set_state. Other tasks read them through nfc_lock.
   rc522_picc_uid_t *nfc_uuids;
   uint32_t num_uuids;
   uint8_t nfc_state;
+  // Set once nfc_uuids holds what NVS has, see mive_nfc_ensure_loaded.
+  bool nfc_loaded;
+  mive_seqlock_t nfc_lock;
   uint8_t switch_state;
+  // enum garage_state_e, as last read from the door.
+  uint8_t garage_state;
 };
 
 #endif // _MIVE_PROGRAM_H
\ No newline at end of file
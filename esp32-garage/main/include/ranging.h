@@ -0,0 +1,84 @@
+#ifndef _MIVE_RANGING_H
+#define _MIVE_RANGING_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "driver/mcpwm_cap.h"
+#include "driver/gptimer.h"
+
+// HC-SR04 style ranging driven by hardware.
+// The trigger pulse is fired from the caller, the echo edges are timestamped
+// by an MCPWM capture channel and a one-shot gptimer catches missing echoes.
+// The caller never waits for the echo, the result is handed to on_done.
+
+// Sound travels 1 cm and back in ~58 us.
+#define MIVE_RANGING_US_PER_CM 58
+// How long the sensor may take to raise echo after the trigger pulse.
+#define MIVE_RANGING_PING_TIMEOUT_US 6000
+// The sensor needs this long between pings for the previous echo to die down.
+#define MIVE_RANGING_MIN_INTERVAL_US 50000
+
+enum mive_ranging_status_e
+{
+  MIVE_RANGING_OK = 0,
+  // Echo line never went high (no sensor, or it's in an invalid state).
+  MIVE_RANGING_PING_TIMEOUT,
+  // Echo line never went low again (distance too big).
+  MIVE_RANGING_ECHO_TIMEOUT,
+};
+
+typedef struct mive_ranging_result_s
+{
+  uint8_t status;
+  uint32_t distance_cm;
+} mive_ranging_result_t;
+
+// Called from ISR context once a measurement is done, either way.
+// Return true if a higher priority task was woken.
+typedef bool (*mive_ranging_done_cb_t)(const mive_ranging_result_t* result, void* arg);
+
+typedef struct mive_ranging_config_s
+{
+  gpio_num_t trigger_pin;
+  gpio_num_t echo_pin;
+  uint32_t max_distance_cm;
+  mive_ranging_done_cb_t on_done;
+  void* arg;
+} mive_ranging_config_t;
+
+enum mive_ranging_state_e
+{
+  MIVE_RANGING_IDLE = 0,
+  MIVE_RANGING_WAIT_RISE,
+  MIVE_RANGING_WAIT_FALL,
+};
+
+typedef struct mive_ranging_t
+{
+  mive_ranging_config_t config;
+  mcpwm_cap_timer_handle_t cap_timer;
+  mcpwm_cap_channel_handle_t cap_channel;
+  gptimer_handle_t timeout_timer;
+  uint32_t cap_resolution_hz;
+  uint32_t rise_ticks;
+  volatile uint8_t state;
+  // Capture and timeout timers are running, only touched by the caller's task.
+  bool enabled;
+  portMUX_TYPE lock;
+} mive_ranging_t;
+
+esp_err_t mive_ranging_init(mive_ranging_t* ranging, const mive_ranging_config_t* config);
+
+// Fires a ping and returns immediately.
+// Returns ESP_ERR_INVALID_STATE if the previous ping hasn't finished yet.
+esp_err_t mive_ranging_trigger(mive_ranging_t* ranging);
+
+// Stops the capture and timeout timers once on_done has run. Their drivers
+// hold a power management lock while enabled, this lets the chip light sleep
+// between pings. The next trigger starts them again.
+void mive_ranging_release(mive_ranging_t* ranging);
+
+const char* mive_ranging_status_str(enum mive_ranging_status_e status);
+
+#endif // _MIVE_RANGING_H
\ No newline at end of file
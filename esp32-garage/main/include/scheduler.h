@@ -0,0 +1,71 @@
+#ifndef _MIVE_SCHEDULER_H
+#define _MIVE_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Deadlines for the periodic and delayed work of main_task, kept in a small
+// binary min-heap. main_task blocks on its queue for no longer than the
+// nearest deadline and runs due jobs inline, no esp_timer task in between.
+// Not thread safe, only main_task touches it.
+
+enum mive_job_e
+{
+  // Door state poll, periodic.
+  MIVE_JOB_POLL_GARAGE = 0,
+  // Next ultrasonic ping, re-armed after every reading.
+  MIVE_JOB_RANGING,
+  // Drops a finished card registration back to idle.
+  MIVE_JOB_AUTH_IDLE,
+  MIVE_JOB_SWITCH_RESET,
+  // End of the state document coalescing window.
+  MIVE_JOB_STATE_DOC,
+  MIVE_JOB_METRICS,
+  // Opens and closes the NFC scan windows in SLOW, or paces the probes and
+  // ends reader sessions in IRQ mode.
+  MIVE_JOB_NFC_DUTY,
+  // Writes buffered history records that waited long enough.
+  MIVE_JOB_HISTORY_FLUSH,
+
+  MIVE_JOB_MAX,
+};
+
+typedef struct mive_sched_entry_s
+{
+  int64_t due_us;
+  // Zero for one-shot jobs.
+  uint32_t period_us;
+  uint8_t job;
+} mive_sched_entry_t;
+
+typedef struct mive_scheduler_s
+{
+  mive_sched_entry_t heap[MIVE_JOB_MAX];
+  // Heap slot + 1 of every job, zero while the job isn't armed.
+  uint8_t slot[MIVE_JOB_MAX];
+  uint8_t count;
+} mive_scheduler_t;
+
+void mive_scheduler_init(mive_scheduler_t* sched);
+
+// Arms job to run delay_us after now_us, then every period_us if that isn't
+// zero. Re-arming a pending job moves its deadline.
+void mive_scheduler_arm(mive_scheduler_t* sched, enum mive_job_e job, int64_t now_us, uint32_t delay_us, uint32_t period_us);
+
+void mive_scheduler_cancel(mive_scheduler_t* sched, enum mive_job_e job);
+
+bool mive_scheduler_is_armed(const mive_scheduler_t* sched, enum mive_job_e job);
+
+// Takes the earliest job that is due at now_us, periodic jobs get re-armed
+// one period after the deadline they were due at, so a late run doesn't
+// shift the ones after it.
+// Returns the job or -1 if nothing is due, due_us gets the missed deadline.
+int mive_scheduler_take_due(mive_scheduler_t* sched, int64_t now_us, int64_t* due_us);
+
+// Ticks to block for until the nearest deadline, rounded up so the wakeup
+// never lands before it. portMAX_DELAY if nothing is armed.
+TickType_t mive_scheduler_timeout(const mive_scheduler_t* sched, int64_t now_us);
+
+#endif // _MIVE_SCHEDULER_H
\ No newline at end of file
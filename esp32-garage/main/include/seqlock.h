@@ -0,0 +1,35 @@
+#ifndef _MIVE_SEQLOCK_H
+#define _MIVE_SEQLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+// Sequence lock for state with a single writer and readers that must never
+// block it. The writer bumps the counter to odd, changes the data and bumps
+// it back to even. Readers copy what they need and retry if the counter
+// moved underneath them, they never take a lock.
+//
+// The writer holds a critical section for the few stores in between, so a
+// higher priority reader on the same core can't preempt it and spin on an
+// odd counter forever. Keep the writes short.
+
+typedef struct mive_seqlock_s
+{
+  uint32_t seq;
+  portMUX_TYPE writer;
+} mive_seqlock_t;
+
+void mive_seqlock_init(mive_seqlock_t* lock);
+
+// Single writer only, never nested.
+void mive_seqlock_write_begin(mive_seqlock_t* lock);
+void mive_seqlock_write_end(mive_seqlock_t* lock);
+
+// Returns the counter to hand to mive_seqlock_read_retry, waits out a
+// write in progress.
+uint32_t mive_seqlock_read_begin(const mive_seqlock_t* lock);
+// True if a write ran since read_begin, everything read since is torn.
+bool mive_seqlock_read_retry(const mive_seqlock_t* lock, uint32_t seq);
+
+#endif // _MIVE_SEQLOCK_H
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef _MIVE_STATE_DOC_H
+#define _MIVE_STATE_DOC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Aggregated state document published to MQTT_STATUS_PATH.
+// Carries the whole garage state, a sequence number and a mask of the fields
+// that changed since the previous document. Changes that land within
+// MIVE_STATE_DOC_COALESCE_MS of each other go out as one publish.
+
+#define MIVE_STATE_DOC_ENABLE 1
+
+#define MIVE_STATE_DOC_JSON 0
+#define MIVE_STATE_DOC_CBOR 1
+#define MIVE_STATE_DOC_FORMAT MIVE_STATE_DOC_JSON
+
+#define MIVE_STATE_DOC_COALESCE_MS 50
+// Big enough for the JSON form with every field present.
+#define MIVE_STATE_DOC_MAX_LEN 160
+
+enum mive_state_doc_field_e
+{
+  MIVE_STATE_DOC_GARAGE = 0,
+  MIVE_STATE_DOC_AUTH,
+  MIVE_STATE_DOC_DISTANCE,
+  MIVE_STATE_DOC_PRESENCE,
+  MIVE_STATE_DOC_SWITCH,
+
+  MIVE_STATE_DOC_FIELD_MAX,
+};
+
+#define MIVE_STATE_DOC_ALL_FIELDS ((1 << MIVE_STATE_DOC_FIELD_MAX) - 1)
+
+typedef struct mive_state_doc_t
+{
+  uint32_t seq;
+  // Fields changed since the last document went out.
+  uint8_t changed;
+  // Fields that currently hold a known value, the rest are encoded as null.
+  uint8_t valid;
+  uint32_t values[MIVE_STATE_DOC_FIELD_MAX];
+} mive_state_doc_t;
+
+void mive_state_doc_init(mive_state_doc_t* doc);
+
+// Returns true if this changed the document.
+bool mive_state_doc_set(mive_state_doc_t* doc, enum mive_state_doc_field_e field, uint32_t value, bool valid);
+
+// Marks fields as changed without touching them, e.g. to republish after a reconnect.
+void mive_state_doc_touch(mive_state_doc_t* doc, uint8_t mask);
+
+// Encodes the document in MIVE_STATE_DOC_FORMAT and starts a new change window.
+// Returns the encoded length, 0 if nothing changed, or -1 if buf is too small.
+int mive_state_doc_take(mive_state_doc_t* doc, uint8_t* buf, size_t buf_len);
+
+int mive_state_doc_encode_json(const mive_state_doc_t* doc, uint8_t changed, char* buf, size_t buf_len);
+
+int mive_state_doc_encode_cbor(const mive_state_doc_t* doc, uint8_t changed, uint8_t* buf, size_t buf_len);
+
+#endif // _MIVE_STATE_DOC_H
\ No newline at end of file
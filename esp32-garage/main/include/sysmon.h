@@ -0,0 +1,50 @@
+#ifndef _MIVE_SYSMON_H
+#define _MIVE_SYSMON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+// Memory budgets, core layout and the watermarks and loads that show how
+// much of them is used.
+
+// 1 puts every long-lived object in .bss (program, UID table, event lanes,
+// task stacks) instead of the heap, so the link map shows the real RAM
+// budget and nothing can fail to allocate at boot.
+#ifndef MIVE_STATIC_ALLOC
+#define MIVE_STATIC_ALLOC 1
+#endif
+
+// Bytes, shrink once the high-water marks in the metrics show the headroom.
+#define MIVE_MAIN_TASK_STACK 15000
+#ifndef MIVE_MAIN_TASK_PRIO
+#define MIVE_MAIN_TASK_PRIO 15
+#endif
+
+// main_task and the door's interrupts (I2C, ranging) get the APP core to
+// themselves. Wi-Fi, LwIP, MQTT, the net and log tasks stay on the PRO core,
+// sdkconfig.defaults pins the ESP-IDF ones, so a publish burst never sits
+// between a command and the relay.
+#if CONFIG_FREERTOS_UNICORE
+#define MIVE_CONTROL_CORE 0
+#define MIVE_NET_CORE 0
+#else
+#ifndef MIVE_CONTROL_CORE
+#define MIVE_CONTROL_CORE 1
+#endif
+#ifndef MIVE_NET_CORE
+#define MIVE_NET_CORE 0
+#endif
+#endif
+
+// Tasks reported in the metrics, looked up by name. Missing ones are skipped.
+#define MIVE_SYSMON_TASKS {"MainTask", "dlog", "net", "mqtt_task", "wifi", "esp_timer", "sys_evt", "tiT"}
+
+// Appends ,"mem":{"heap":[free,min_free,largest_block],"stack":{"<task>":min_free,...}},
+// "cpu":{"load":[<core 0 %>,<core 1 %>],"task":{"<task>":<% of one core>,...}}
+// to buf. Loads cover the time since the previous call and need
+// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS, zeros without it.
+// Returns the length written, or -1 if buf is too small.
+int mive_sysmon_json(char* buf, size_t buf_len);
+
+#endif // _MIVE_SYSMON_H
\ No newline at end of file
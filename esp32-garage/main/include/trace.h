@@ -0,0 +1,84 @@
+#ifndef _MIVE_TRACE_H
+#define _MIVE_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed-size trace ring kept in RAM, cheap enough to leave on in the field.
+// Any task or ISR can add a record, writers claim a slot with a single atomic
+// increment and never block or format anything.
+// The ring is dumped as a binary blob (header followed by the records, oldest
+// first, little endian), decode it with tools/trace_decode.py.
+
+// Must be a power of two.
+#define MIVE_TRACE_RECORDS 512
+#define MIVE_TRACE_MAGIC 0x5254564d // "MVTR"
+#define MIVE_TRACE_VERSION 1
+// Bytes per line when dumping to the console.
+#define MIVE_TRACE_CONSOLE_LINE 32
+
+// Keep tools/trace_decode.py in sync when adding kinds.
+enum mive_trace_kind_e
+{
+  MIVE_TRACE_NONE = 0,
+  // arg: event type, result: 1 if it made it into the queue.
+  MIVE_TRACE_EVENT_SENT,
+  // arg: event type. main_task picked the event up.
+  MIVE_TRACE_EVENT_BEGIN,
+  // arg: event type. main_task is done with the event.
+  MIVE_TRACE_EVENT_END,
+  // arg: 1 connected, 0 disconnected.
+  MIVE_TRACE_MQTT_CONNECTION,
+  // arg: keyword value, result: 1 if it was turned into an event.
+  MIVE_TRACE_MQTT_COMMAND,
+  // arg: NFC registration state, result: 1 if the card is known.
+  MIVE_TRACE_NFC_CARD,
+  // arg: payload length, result: enum mive_espnow_rx_e.
+  MIVE_TRACE_ESPNOW_RX,
+  // arg: garage command, result: 1 if the relay was pulsed.
+  MIVE_TRACE_ACTUATE,
+  // arg: new door state.
+  MIVE_TRACE_DOOR_STATE,
+
+  MIVE_TRACE_KIND_MAX,
+};
+
+typedef struct mive_trace_record_s
+{
+  // Low 32 bits of esp_timer_get_time(), wraps every ~71 minutes.
+  uint32_t time_us;
+  uint8_t kind;
+  // enum mive_event_source_e
+  uint8_t source;
+  uint8_t arg;
+  uint8_t result;
+} mive_trace_record_t;
+
+typedef struct mive_trace_header_s
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t record_size;
+  // Records following the header.
+  uint16_t count;
+  // Records written since boot, anything above count got overwritten.
+  uint32_t total;
+  uint32_t reserved;
+  // Full timestamp at the time of the dump, anchors the 32 bit record times.
+  uint64_t dump_us;
+} mive_trace_header_t;
+
+#define MIVE_TRACE_DUMP_MAX_LEN (sizeof(mive_trace_header_t) + MIVE_TRACE_RECORDS * sizeof(mive_trace_record_t))
+
+// Safe from any task and from ISRs.
+void mive_trace(uint8_t kind, uint8_t source, uint8_t arg, uint8_t result);
+
+// Copies the ring into buf. Records written while the copy runs may show up
+// torn, the decoder drops anything out of order.
+// Returns the length, or -1 if buf is smaller than MIVE_TRACE_DUMP_MAX_LEN.
+int mive_trace_dump(uint8_t* buf, size_t buf_len);
+
+// Prints a dump as hex lines prefixed with "TRACE ".
+void mive_trace_dump_console(const uint8_t* buf, size_t len);
+
+#endif // _MIVE_TRACE_H
\ No newline at end of file
@@ -12,6 +12,28 @@
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 
+// Reconnect backoff, doubles per failed attempt up to the max, the actual
+// delay is picked at random from the upper half so a room full of devices
+// doesn't hit a rebooting AP in lockstep.
+#define WIFI_BACKOFF_MIN_MS 250
+#define WIFI_BACKOFF_MAX_MS 8000
+// Failed attempts on the cached BSSID/channel before falling back to a full scan.
+#define WIFI_CACHE_MAX_RETRIES 6
+// Reuse the last DHCP lease as a static IP, saves the DHCP round trips on
+// reconnect. Only safe if the AP reserves the address for this device.
+#define WIFI_STATIC_IP_FROM_CACHE 0
+// 1 lets the modem sleep between DTIM beacons (WIFI_PS_MIN_MODEM), for good:
+// saves current but adds up to a beacon interval to every MQTT command and
+// ESP-NOW only gets the wake window below. 0 keeps the radio on.
+#define WIFI_MODEM_SLEEP 0
+// While sleeping, listen for ESP-NOW for WIFI_ESPNOW_WAKE_WINDOW_MS out of every
+// WIFI_ESPNOW_WAKE_INTERVAL_MS. The remote keeps retrying for longer than the gap.
+#define WIFI_ESPNOW_WAKE_INTERVAL_MS 100
+#define WIFI_ESPNOW_WAKE_WINDOW_MS 50
+// Must match the AP, ESP-NOW peers are pinned to it.
+#define WIFI_CHANNEL 13
+#define WIFI_CACHE_NAMESPACE "wifi_cache"
+
 void wifi_init_sta(mive_program_t* program);
 
 #endif // _MIVE_WIFI_HANDLER_H
\ No newline at end of file
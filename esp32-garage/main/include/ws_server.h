@@ -0,0 +1,102 @@
+#ifndef _MIVE_WS_SERVER_H
+#define _MIVE_WS_SERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#include "state_doc.h"
+
+// Local control endpoint, one hop for LAN clients and independent of the
+// broker. A single WebSocket on MIVE_WS_PATH.
+//
+// The server opens every session with {"nonce":"<hex>"}. Every client frame
+// after that is a text frame
+//   <hex HMAC-SHA256> <seq> <body>
+// with the MAC over the nonce bytes followed by "<seq> <body>", keyed with
+// CONFIG_MIVE_WS_KEY (menuconfig). seq has to go up within the session, a recorded frame is no
+// good on another session or a second time on the same one.
+//
+// body "hello" subscribes to the state document (the MQTT_STATUS_PATH
+// payload): the current one right away, then every change. Text frames for
+// JSON, binary for CBOR. Any other body is "<topic> <payload>" and goes
+// through the same routes as MQTT, e.g. "/garage/door/1/set OPEN".
+// Every frame is answered with {"ack":<seq>} or {"nack":<seq>}.
+//
+// See tools/ws_client.py.
+
+#ifndef MIVE_WS_ENABLE
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+#define MIVE_WS_ENABLE 1
+#else
+#define MIVE_WS_ENABLE 0
+#endif
+#endif
+
+#define MIVE_WS_PORT 80
+#define MIVE_WS_PATH "/ws"
+// Shared with the clients. No key, no endpoint: mive_ws_init refuses to
+// start with a short one or the example key older builds shipped with.
+#ifdef CONFIG_MIVE_WS_KEY
+#define MIVE_WS_KEY CONFIG_MIVE_WS_KEY
+#else
+#define MIVE_WS_KEY ""
+#endif
+#define MIVE_WS_KEY_MIN_LEN 16
+#define MIVE_WS_PUBLISHED_KEY "garage-local-key"
+#define MIVE_WS_MAX_CLIENTS 4
+#define MIVE_WS_NONCE_LEN 16
+#define MIVE_WS_MAC_LEN 32
+// Longest client frame, MAC and seq included.
+#define MIVE_WS_FRAME_MAX_LEN 192
+// The HTTP server task, runs on MIVE_NET_CORE.
+#define MIVE_WS_TASK_STACK 4096
+#ifndef MIVE_WS_TASK_PRIO
+#define MIVE_WS_TASK_PRIO 5
+#endif
+
+// Called from the HTTP server task for every authenticated command. Returns
+// false if it was refused, the client gets a nack.
+typedef bool (*mive_ws_message_cb_t)(const char* topic, size_t topic_len, const char* data, size_t data_len, void* arg);
+
+struct mive_ws_client
+{
+  // -1 for a free slot.
+  int fd;
+  uint8_t nonce[MIVE_WS_NONCE_LEN];
+  // Last accepted seq.
+  uint32_t seq;
+  bool subscribed;
+};
+
+typedef struct mive_ws_s
+{
+  void* server;
+  mive_ws_message_cb_t on_message;
+  void* arg;
+  // HTTP server task only.
+  struct mive_ws_client clients[MIVE_WS_MAX_CLIENTS];
+  uint8_t subscribers;
+
+  // Latest state document, main_task writes it, the server task sends it.
+  portMUX_TYPE lock;
+  uint8_t state[MIVE_STATE_DOC_MAX_LEN];
+  int state_len;
+  bool push_queued;
+
+  uint32_t accepted;
+  uint32_t rejected;
+} mive_ws_t;
+
+// Starts the HTTP server, needs the network stack initialised.
+// ESP_ERR_INVALID_STATE without a usable MIVE_WS_KEY.
+esp_err_t mive_ws_init(mive_ws_t* ws, mive_ws_message_cb_t on_message, void* arg);
+
+// main_task, on every state document. Keeps a copy for new subscribers and
+// hands the send to the server task, never waits on a socket.
+void mive_ws_push_state(mive_ws_t* ws, const uint8_t* data, int len);
+
+#endif // _MIVE_WS_SERVER_H
\ No newline at end of file
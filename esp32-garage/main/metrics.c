@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "include/metrics.h"
+#include "include/sysmon.h"
+#include "include/power.h"
+
+static const char* source_name[MIVE_SOURCE_MAX] = {
+  [MIVE_SOURCE_INTERNAL] = "internal",
+  [MIVE_SOURCE_TIMER] = "timer",
+  [MIVE_SOURCE_SENSOR] = "sensor",
+  [MIVE_SOURCE_NFC] = "nfc",
+  [MIVE_SOURCE_MQTT] = "mqtt",
+  [MIVE_SOURCE_ESPNOW] = "espnow",
+  [MIVE_SOURCE_LOCAL] = "local",
+};
+
+static const char* stage_name[MIVE_STAGE_MAX] = {
+  [MIVE_STAGE_QUEUE] = "queue",
+  [MIVE_STAGE_HANDLER] = "handler",
+  [MIVE_STAGE_I2C] = "i2c",
+  [MIVE_STAGE_PUBLISH] = "publish",
+  [MIVE_STAGE_ACTUATION] = "actuation",
+};
+
+void mive_metrics_init(mive_metrics_t* metrics)
+{
+  memset(metrics, 0, sizeof(*metrics));
+  metrics->window_start_us = esp_timer_get_time();
+}
+
+static uint32_t bucket_index(uint32_t elapsed_us)
+{
+  uint32_t index = 0;
+
+  if(elapsed_us < 2)
+  {
+    return 0;
+  }
+
+  index = 31 - __builtin_clz(elapsed_us);
+  return (index < MIVE_METRICS_BUCKETS) ? index : (MIVE_METRICS_BUCKETS - 1);
+}
+
+void mive_histogram_add(mive_histogram_t* hist, uint32_t elapsed_us)
+{
+  hist->buckets[bucket_index(elapsed_us)]++;
+  hist->count++;
+  if(elapsed_us > hist->max_us)
+  {
+    hist->max_us = elapsed_us;
+  }
+}
+
+void mive_metrics_record(mive_metrics_t* metrics, enum mive_event_source_e source, enum mive_metrics_stage_e stage, int64_t elapsed_us)
+{
+  if(source >= MIVE_SOURCE_MAX || stage >= MIVE_STAGE_MAX || elapsed_us < 0)
+  {
+    return;
+  }
+
+  mive_histogram_add(&metrics->hist[source][stage], (elapsed_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed_us);
+}
+
+void mive_metrics_actuation_started(mive_metrics_t* metrics, enum mive_event_source_e source, int64_t ingress_us)
+{
+  metrics->pending_source = source;
+  metrics->pending_ingress_us = ingress_us;
+}
+
+void mive_metrics_actuation_confirmed(mive_metrics_t* metrics, int64_t now_us)
+{
+  int64_t elapsed_us = now_us - metrics->pending_ingress_us;
+
+  if(metrics->pending_ingress_us == 0)
+  {
+    return;
+  }
+
+  if(elapsed_us <= MIVE_METRICS_ACTUATION_TIMEOUT_US)
+  {
+    mive_metrics_record(metrics, metrics->pending_source, MIVE_STAGE_ACTUATION, elapsed_us);
+  }
+  metrics->pending_ingress_us = 0;
+}
+
+uint32_t mive_histogram_percentile(const mive_histogram_t* hist, uint32_t percentile)
+{
+  uint32_t rank = 0;
+  uint32_t seen = 0;
+
+  if(hist->count == 0)
+  {
+    return 0;
+  }
+
+  rank = (hist->count * percentile + 99) / 100;
+  if(rank == 0)
+  {
+    rank = 1;
+  }
+
+  for(uint32_t i = 0; i < MIVE_METRICS_BUCKETS; ++i)
+  {
+    uint32_t in_bucket = hist->buckets[i];
+    if(seen + in_bucket >= rank)
+    {
+      // Spread the bucket's samples evenly over its range.
+      uint32_t low = (i == 0) ? 0 : (1u << i);
+      uint32_t high = (1u << (i + 1));
+      uint32_t value = low + (uint32_t)(((uint64_t)(high - low) * (rank - seen)) / in_bucket);
+      return (value < hist->max_us) ? value : hist->max_us;
+    }
+    seen += in_bucket;
+  }
+
+  return hist->max_us;
+}
+
+// {"win":<window ms>,
+//  "lat":{"<source>":{"<stage>":[count,p50,p99,max],...},...},
+//  "lanes":[[depth,high_water,sent,dropped,coalesced],...],
+//  "i2c":[ok,nack,timeout,resets,reinits,skipped],
+//  "net":[sent,failed,refused,high_water,max_publish],
+//  "mem":{"heap":[free,min_free,largest_block],"stack":{"<task>":min_free,...}},
+//  "cpu":{"load":[core0,core1],"task":{"<task>":percent,...}},
+//  "pm":{"sleep":[count,ms],"busy_ms":ms,"idle_ms":ms}}
+// All latencies in microseconds, memory in bytes, loads in percent.
+int mive_metrics_take_json(mive_metrics_t* metrics, mive_event_queue_t* queue, const mive_garage_stats_t* i2c, const mive_net_stats_t* net, char* buf, size_t buf_len)
+{
+  int64_t now_us = esp_timer_get_time();
+  size_t pos = 0;
+  int written = 0;
+  struct mive_event_lane_stats lane_stats;
+
+#define APPEND(...) \
+  do { \
+    written = snprintf(buf + pos, buf_len - pos, __VA_ARGS__); \
+    if(written < 0 || (size_t)written >= buf_len - pos) { return -1; } \
+    pos += written; \
+  } while(0)
+
+  APPEND("{\"win\":%lu,\"lat\":{", (unsigned long)((now_us - metrics->window_start_us) / 1000));
+
+  for(uint32_t source = 0; source < MIVE_SOURCE_MAX; ++source)
+  {
+    bool source_open = false;
+
+    for(uint32_t stage = 0; stage < MIVE_STAGE_MAX; ++stage)
+    {
+      const mive_histogram_t* hist = &metrics->hist[source][stage];
+      if(hist->count == 0)
+      {
+        continue;
+      }
+
+      if(!source_open)
+      {
+        APPEND("%s\"%s\":{", (pos > 0 && buf[pos - 1] == '{') ? "" : ",", source_name[source]);
+        source_open = true;
+      }
+      else
+      {
+        APPEND(",");
+      }
+
+      APPEND("\"%s\":[%lu,%lu,%lu,%lu]", stage_name[stage], (unsigned long)hist->count,
+        (unsigned long)mive_histogram_percentile(hist, 50), (unsigned long)mive_histogram_percentile(hist, 99),
+        (unsigned long)hist->max_us);
+    }
+
+    if(source_open)
+    {
+      APPEND("}");
+    }
+  }
+
+  APPEND("},\"lanes\":[");
+  for(uint32_t lane = 0; lane < MIVE_LANE_MAX; ++lane)
+  {
+    mive_event_queue_get_stats(queue, lane, &lane_stats);
+    APPEND("%s[%lu,%lu,%lu,%lu,%lu]", (lane == 0) ? "" : ",", (unsigned long)lane_stats.depth,
+      (unsigned long)lane_stats.high_water, (unsigned long)lane_stats.sent, (unsigned long)lane_stats.dropped,
+      (unsigned long)lane_stats.coalesced);
+  }
+  APPEND("]");
+
+  // Counters since boot, like the lane stats.
+  APPEND(",\"i2c\":[%lu,%lu,%lu,%lu,%lu,%lu]", (unsigned long)i2c->ok, (unsigned long)i2c->nack, (unsigned long)i2c->timeout,
+    (unsigned long)i2c->resets, (unsigned long)i2c->reinits, (unsigned long)i2c->skipped);
+  APPEND(",\"net\":[%lu,%lu,%lu,%lu,%lu]", (unsigned long)net->sent, (unsigned long)net->failed, (unsigned long)net->refused,
+    (unsigned long)net->high_water, (unsigned long)net->max_publish_us);
+
+  written = mive_sysmon_json(buf + pos, buf_len - pos);
+  if(written < 0)
+  {
+    return -1;
+  }
+  pos += written;
+
+  written = mive_power_take_json(buf + pos, buf_len - pos);
+  if(written < 0)
+  {
+    return -1;
+  }
+  pos += written;
+  APPEND("}");
+
+#undef APPEND
+
+  // Every publish covers a fresh window.
+  memset(metrics->hist, 0, sizeof(metrics->hist));
+  metrics->window_start_us = now_us;
+
+  return pos;
+}
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "include/program.h"
+#include "include/mqtt_publish.h"
+#include "include/dlog.h"
+
+static const char *TAG = "mqtt_publish";
+
+struct mive_topic_policy
+{
+  const char* path;
+  uint8_t qos;
+  uint8_t retain;
+  uint8_t enabled;
+  // enum mive_offline_e
+  uint8_t offline;
+};
+
+static const struct mive_topic_policy topic_policy[MIVE_TOPIC_MAX] = {
+  [MIVE_TOPIC_STATE] = {MQTT_STATE_PATH, MQTT_STATE_QOS, MQTT_STATE_RETAIN, MIVE_PUBLISH_SINGLE_TOPICS, MIVE_OFFLINE_HISTORY},
+  [MIVE_TOPIC_REGISTER_NFC_STATE] = {MQTT_REGISTER_NFC_STATE, MQTT_REGISTER_NFC_STATE_QOS, MQTT_REGISTER_NFC_STATE_RETAIN, MIVE_PUBLISH_SINGLE_TOPICS, MIVE_OFFLINE_LATEST},
+  [MIVE_TOPIC_PRESENCE] = {MQTT_PRESENCE_PATH, MQTT_PRESENCE_QOS, MQTT_PRESENCE_RETAIN, MIVE_PUBLISH_SINGLE_TOPICS, MIVE_OFFLINE_LATEST},
+  [MIVE_TOPIC_PRESENCE_STATE] = {MQTT_PRESENCE_STATE_PATH, MQTT_PRESENCE_STATE_QOS, MQTT_PRESENCE_STATE_RETAIN, MIVE_PUBLISH_SINGLE_TOPICS, MIVE_OFFLINE_HISTORY},
+  [MIVE_TOPIC_SWITCH_STATE] = {MQTT_SWITCH_STATE_PATH, MQTT_SWITCH_STATE_QOS, MQTT_SWITCH_STATE_RETAIN, MIVE_PUBLISH_SINGLE_TOPICS, MIVE_OFFLINE_LATEST},
+  [MIVE_TOPIC_STATUS] = {MQTT_STATUS_PATH, MQTT_STATUS_QOS, MQTT_STATUS_RETAIN, true, MIVE_OFFLINE_LATEST},
+  [MIVE_TOPIC_METRICS] = {MQTT_METRICS_PATH, MQTT_METRICS_QOS, MQTT_METRICS_RETAIN, true, MIVE_OFFLINE_DROP},
+  [MIVE_TOPIC_TRACE] = {MQTT_TRACE_PATH, MQTT_TRACE_QOS, MQTT_TRACE_RETAIN, true, MIVE_OFFLINE_DROP},
+  [MIVE_TOPIC_HISTORY] = {MQTT_HISTORY_PATH, MQTT_HISTORY_QOS, MQTT_HISTORY_RETAIN, true, MIVE_OFFLINE_DROP},
+  [MIVE_TOPIC_BOOT] = {MQTT_BOOT_PATH, MQTT_BOOT_QOS, MQTT_BOOT_RETAIN, true, MIVE_OFFLINE_LATEST},
+  [MIVE_TOPIC_EVENTS] = {MQTT_EVENTS_PATH, MQTT_EVENTS_QOS, MQTT_EVENTS_RETAIN, true, MIVE_OFFLINE_DROP},
+};
+
+const char* mive_topic_get_path(enum mive_topic_e topic)
+{
+  if(topic >= MIVE_TOPIC_MAX)
+  {
+    return NULL;
+  }
+
+  return topic_policy[topic].path;
+}
+
+static void outbox_park(mive_outbox_t* outbox, enum mive_topic_e topic, const char* data, int len, bool offline)
+{
+  const struct mive_topic_policy* policy = &topic_policy[topic];
+  struct mive_outbox_value* latest = &outbox->latest[topic];
+
+  if(policy->offline == MIVE_OFFLINE_DROP || len > MIVE_OUTBOX_VALUE_LEN)
+  {
+    if(offline)
+    {
+      outbox->dropped++;
+    }
+    return;
+  }
+
+  // Same value as before, nothing to remember.
+  if(latest->len == len && memcmp(latest->data, data, len) == 0)
+  {
+    latest->pending |= offline;
+    return;
+  }
+
+  memcpy(latest->data, data, len);
+  latest->len = len;
+  latest->pending = offline;
+
+  if(offline && policy->offline == MIVE_OFFLINE_HISTORY)
+  {
+    struct mive_outbox_history* entry = &outbox->history[outbox->history_count % MIVE_OUTBOX_HISTORY_LEN];
+
+    entry->time_us = esp_timer_get_time();
+    entry->topic = topic;
+    entry->len = (len < MIVE_OUTBOX_HISTORY_VALUE_LEN) ? len : MIVE_OUTBOX_HISTORY_VALUE_LEN;
+    memcpy(entry->data, data, entry->len);
+    outbox->history_count++;
+  }
+}
+
+static bool push(mive_program_t* program, enum mive_topic_e topic, const char* data, int len, uint8_t flags)
+{
+  const struct mive_topic_policy* policy = &topic_policy[topic];
+
+  // Topics that keep nothing offline are bulk, they give way to state.
+  return mive_net_push(&program->net, policy->path, data, len, policy->qos, flags | (policy->retain ? MIVE_NET_FLAG_RETAIN : 0),
+                       policy->offline == MIVE_OFFLINE_DROP);
+}
+
+int mive_publish(mive_program_t* program, enum mive_topic_e topic, const char* data, int len)
+{
+  const struct mive_topic_policy* policy = NULL;
+  bool online = false;
+  int64_t start_us = 0;
+
+  if(topic >= MIVE_TOPIC_MAX)
+  {
+    return -1;
+  }
+
+  policy = &topic_policy[topic];
+  if(!policy->enabled)
+  {
+    return 0;
+  }
+
+  if(len == 0)
+  {
+    len = strlen(data);
+  }
+
+  online = __atomic_load_n(&program->outbox.online, __ATOMIC_ACQUIRE);
+  if(online)
+  {
+    start_us = esp_timer_get_time();
+    // No room means the broker is behind, treated like offline: state waits
+    // in the outbox for the net task to catch up, bulk is dropped.
+    online = push(program, topic, data, len, 0);
+    mive_metrics_record(&program->metrics, program->metrics.current_source, MIVE_STAGE_PUBLISH, esp_timer_get_time() - start_us);
+  }
+
+  outbox_park(&program->outbox, topic, data, len, !online);
+
+  return online ? 1 : 0;
+}
+
+void mive_publish_seed(mive_program_t* program, enum mive_topic_e topic, const char* data, int len)
+{
+  struct mive_outbox_value* latest = NULL;
+
+  if(topic >= MIVE_TOPIC_MAX || !topic_policy[topic].enabled || topic_policy[topic].offline == MIVE_OFFLINE_DROP)
+  {
+    return;
+  }
+
+  if(len == 0)
+  {
+    len = strlen(data);
+  }
+
+  if(len > MIVE_OUTBOX_VALUE_LEN)
+  {
+    return;
+  }
+
+  latest = &program->outbox.latest[topic];
+  memcpy(latest->data, data, len);
+  latest->len = len;
+  latest->pending = 1;
+}
+
+void mive_publish_set_connected(mive_program_t* program)
+{
+  uint32_t connection = program->outbox.connection;
+
+  if(!(connection & 1))
+  {
+    __atomic_store_n(&program->outbox.connection, connection + 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+void mive_publish_set_offline(mive_program_t* program)
+{
+  uint32_t connection = program->outbox.connection;
+
+  if(connection & 1)
+  {
+    __atomic_store_n(&program->outbox.connection, connection + 1, __ATOMIC_SEQ_CST);
+  }
+  __atomic_store_n(&program->outbox.online, 0, __ATOMIC_SEQ_CST);
+}
+
+void mive_publish_flush(mive_program_t* program)
+{
+  mive_outbox_t* outbox = &program->outbox;
+  uint32_t count = (outbox->history_count < MIVE_OUTBOX_HISTORY_LEN) ? outbox->history_count : MIVE_OUTBOX_HISTORY_LEN;
+  int64_t now = esp_timer_get_time();
+  char event[MIVE_OUTBOX_EVENT_MAX_LEN];
+  uint32_t sent = 0;
+  uint32_t connection = __atomic_load_n(&outbox->connection, __ATOMIC_SEQ_CST);
+
+  if(outbox->history_count > count)
+  {
+    MIVE_DLOGW(TAG, "%lu offline events overwritten", (unsigned long)(outbox->history_count - count));
+  }
+
+  // Oldest first, so consumers see the changes in the order they happened.
+  for(uint32_t i = outbox->history_count - count; i != outbox->history_count; ++i)
+  {
+    const struct mive_outbox_history* entry = &outbox->history[i % MIVE_OUTBOX_HISTORY_LEN];
+    int len = snprintf(event, sizeof(event), "{\"topic\":\"%s\",\"value\":\"%.*s\",\"age_ms\":%lld}",
+                       topic_policy[entry->topic].path, entry->len, entry->data, (long long)((now - entry->time_us) / 1000));
+
+    if(len > 0 && len < (int)sizeof(event) && push(program, MIVE_TOPIC_EVENTS, event, len, MIVE_NET_FLAG_STORE))
+    {
+      sent++;
+    }
+  }
+  outbox->history_count = 0;
+
+  // Every known value, not only the pending ones, the broker may have lost its retained copies.
+  for(uint32_t topic = 0; topic < MIVE_TOPIC_MAX; ++topic)
+  {
+    struct mive_outbox_value* latest = &outbox->latest[topic];
+
+    if(latest->len == 0 || !topic_policy[topic].enabled)
+    {
+      continue;
+    }
+    // Stays pending if the ring is full, the next drain comes back for it.
+    if(push(program, topic, latest->data, latest->len, MIVE_NET_FLAG_STORE))
+    {
+      latest->pending = 0;
+      sent++;
+    }
+  }
+
+  MIVE_DLOGI(TAG, "Flushed %lu messages, %lu dropped while offline", (unsigned long)sent, (unsigned long)outbox->dropped);
+
+  // A connected event handled late, or a disconnect while flushing, must not
+  // leave the outbox online. set_offline clears it after the bump, so
+  // whichever side comes last wins.
+  if(connection & 1)
+  {
+    __atomic_store_n(&outbox->online, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&outbox->connection, __ATOMIC_SEQ_CST) != connection)
+    {
+      __atomic_store_n(&outbox->online, 0, __ATOMIC_SEQ_CST);
+    }
+  }
+}
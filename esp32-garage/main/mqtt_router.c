@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "esp_log.h"
+
+#include "include/mqtt_router.h"
+
+static const char *TAG = "mqtt_router";
+
+#define ROOT_NODE 0
+#define NONE -1
+
+// FNV-1a, good enough for a handful of short topics.
+static uint32_t topic_hash(const char* topic, size_t len)
+{
+  uint32_t hash = 2166136261u;
+
+  for(size_t i = 0; i < len; ++i)
+  {
+    hash ^= (uint8_t)topic[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static bool filter_has_wildcard(const char* filter)
+{
+  return strchr(filter, '+') != NULL || strchr(filter, '#') != NULL;
+}
+
+// Length of the topic level starting at topic, up to the next '/' or the end.
+static size_t level_len(const char* topic, size_t len)
+{
+  const char* end = memchr(topic, '/', len);
+
+  return (end == NULL) ? len : (size_t)(end - topic);
+}
+
+void mive_mqtt_router_init(mive_mqtt_router_t* router, uint8_t source)
+{
+  memset(router, 0, sizeof(*router));
+  memset(router->buckets, NONE, sizeof(router->buckets));
+  router->source = source;
+
+  router->nodes[ROOT_NODE].first_child = NONE;
+  router->nodes[ROOT_NODE].next_sibling = NONE;
+  router->nodes[ROOT_NODE].route = NONE;
+  router->num_nodes = 1;
+}
+
+static int8_t node_find_child(mive_mqtt_router_t* router, int8_t parent, const char* level, size_t len)
+{
+  for(int8_t i = router->nodes[parent].first_child; i != NONE; i = router->nodes[i].next_sibling)
+  {
+    if(router->nodes[i].level_len == len && memcmp(router->nodes[i].level, level, len) == 0)
+    {
+      return i;
+    }
+  }
+
+  return NONE;
+}
+
+static esp_err_t trie_insert(mive_mqtt_router_t* router, const char* filter, int8_t route)
+{
+  size_t remaining = strlen(filter);
+  int8_t node = ROOT_NODE;
+
+  while(1)
+  {
+    size_t len = level_len(filter, remaining);
+    int8_t child = node_find_child(router, node, filter, len);
+
+    if(child == NONE)
+    {
+      if(router->num_nodes >= MIVE_ROUTER_MAX_NODES)
+      {
+        return ESP_ERR_NO_MEM;
+      }
+
+      child = router->num_nodes++;
+      router->nodes[child].level = filter;
+      router->nodes[child].level_len = len;
+      router->nodes[child].first_child = NONE;
+      router->nodes[child].route = NONE;
+      router->nodes[child].next_sibling = router->nodes[node].first_child;
+      router->nodes[node].first_child = child;
+    }
+    node = child;
+
+    if(len == remaining)
+    {
+      break;
+    }
+    filter += len + 1;
+    remaining -= len + 1;
+  }
+
+  router->nodes[node].route = route;
+  return ESP_OK;
+}
+
+esp_err_t mive_mqtt_router_add(mive_mqtt_router_t* router, const mive_route_t* route)
+{
+  int8_t index = router->num_routes;
+  uint32_t bucket = 0;
+  esp_err_t retval = ESP_OK;
+
+  if(index >= MIVE_ROUTER_MAX_ROUTES || route->num_keywords > MIVE_ROUTER_MAX_KEYWORDS)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+
+  if(filter_has_wildcard(route->filter))
+  {
+    retval = trie_insert(router, route->filter, index);
+    if(retval != ESP_OK)
+    {
+      return retval;
+    }
+  }
+  else
+  {
+    router->route_hash[index] = topic_hash(route->filter, strlen(route->filter));
+    bucket = router->route_hash[index] & (MIVE_ROUTER_HASH_BUCKETS - 1);
+    router->bucket_next[index] = router->buckets[bucket];
+    router->buckets[bucket] = index;
+  }
+
+  router->routes[index] = route;
+  router->num_routes++;
+
+  return ESP_OK;
+}
+
+static int8_t trie_match(mive_mqtt_router_t* router, int8_t node, const char* topic, size_t remaining, bool at_end)
+{
+  struct mive_router_node* nodes = router->nodes;
+  size_t len = 0;
+  const char* next = NULL;
+  size_t next_remaining = 0;
+  bool last = false;
+  int8_t found = NONE;
+
+  if(at_end)
+  {
+    if(nodes[node].route != NONE)
+    {
+      return nodes[node].route;
+    }
+    // "a/#" matches "a" as well.
+    for(int8_t i = nodes[node].first_child; i != NONE; i = nodes[i].next_sibling)
+    {
+      if(nodes[i].level_len == 1 && nodes[i].level[0] == '#')
+      {
+        return nodes[i].route;
+      }
+    }
+    return NONE;
+  }
+
+  len = level_len(topic, remaining);
+  last = (len == remaining);
+  next = last ? topic + len : topic + len + 1;
+  next_remaining = last ? 0 : remaining - len - 1;
+
+  // Literal levels win over +, + wins over #.
+  found = node_find_child(router, node, topic, len);
+  if(found != NONE)
+  {
+    found = trie_match(router, found, next, next_remaining, last);
+    if(found != NONE)
+    {
+      return found;
+    }
+  }
+
+  found = node_find_child(router, node, "+", 1);
+  if(found != NONE)
+  {
+    found = trie_match(router, found, next, next_remaining, last);
+    if(found != NONE)
+    {
+      return found;
+    }
+  }
+
+  found = node_find_child(router, node, "#", 1);
+  if(found != NONE)
+  {
+    return nodes[found].route;
+  }
+
+  return NONE;
+}
+
+const mive_route_t* mive_mqtt_router_match(mive_mqtt_router_t* router, const char* topic, size_t topic_len)
+{
+  uint32_t hash = topic_hash(topic, topic_len);
+  int8_t index = NONE;
+
+  for(index = router->buckets[hash & (MIVE_ROUTER_HASH_BUCKETS - 1)]; index != NONE; index = router->bucket_next[index])
+  {
+    const char* filter = router->routes[index]->filter;
+    if(router->route_hash[index] == hash && strlen(filter) == topic_len && memcmp(filter, topic, topic_len) == 0)
+    {
+      return router->routes[index];
+    }
+  }
+
+  // Topics starting with '$' are reserved for the broker and never match wildcards.
+  if(router->nodes[ROOT_NODE].first_child == NONE || (topic_len > 0 && topic[0] == '$'))
+  {
+    return NULL;
+  }
+
+  index = trie_match(router, ROOT_NODE, topic, topic_len, false);
+  return (index == NONE) ? NULL : router->routes[index];
+}
+
+void mive_mqtt_router_subscribe(mive_mqtt_router_t* router, esp_mqtt_client_handle_t client)
+{
+  for(uint32_t i = 0; i < router->num_routes; ++i)
+  {
+    esp_mqtt_client_subscribe(client, router->routes[i]->filter, router->routes[i]->qos);
+  }
+}
+
+// ==== Keyword parser ====
+// Every keyword starts out as a candidate, each payload byte knocks out the
+// ones it doesn't match. Whatever is left with its whole word consumed wins.
+
+static void keyword_begin(mive_mqtt_router_t* router)
+{
+  const mive_route_t* route = router->current;
+
+  router->keyword_pos = 0;
+  router->candidates = (route->num_keywords >= 32) ? UINT32_MAX : ((1u << route->num_keywords) - 1);
+}
+
+static void keyword_feed(mive_mqtt_router_t* router, const char* data, size_t len)
+{
+  const mive_route_t* route = router->current;
+
+  for(size_t i = 0; i < len && router->candidates != 0; ++i)
+  {
+    char c = tolower((unsigned char)data[i]);
+
+    if(isspace((unsigned char)c))
+    {
+      continue;
+    }
+
+    if(router->keyword_pos >= MIVE_ROUTER_MAX_KEYWORD_LEN)
+    {
+      router->candidates = 0;
+      break;
+    }
+
+    for(uint32_t k = 0; k < route->num_keywords; ++k)
+    {
+      if(!(router->candidates & (1u << k)))
+      {
+        continue;
+      }
+
+      char w = route->keywords[k].word[router->keyword_pos];
+      if(w == '\0' || tolower((unsigned char)w) != c)
+      {
+        router->candidates &= ~(1u << k);
+      }
+    }
+    router->keyword_pos++;
+  }
+}
+
+static int32_t keyword_end(mive_mqtt_router_t* router)
+{
+  const mive_route_t* route = router->current;
+
+  for(uint32_t k = 0; k < route->num_keywords; ++k)
+  {
+    if((router->candidates & (1u << k)) && route->keywords[k].word[router->keyword_pos] == '\0')
+    {
+      return route->keywords[k].value;
+    }
+  }
+
+  return MIVE_ROUTER_NO_MATCH;
+}
+
+// ==== Number parser ====
+
+static void numbers_begin(mive_mqtt_router_t* router)
+{
+  memset(router->numbers, 0, sizeof(router->numbers));
+  router->num_numbers = 0;
+  router->in_number = false;
+}
+
+static void numbers_feed(mive_mqtt_router_t* router, const char* data, size_t len)
+{
+  for(size_t i = 0; i < len; ++i)
+  {
+    uint32_t* number = NULL;
+
+    if(!isdigit((unsigned char)data[i]))
+    {
+      router->in_number = false;
+      continue;
+    }
+
+    if(!router->in_number)
+    {
+      if(router->num_numbers >= MIVE_ROUTER_MAX_NUMBERS)
+      {
+        continue;
+      }
+      router->num_numbers++;
+      router->in_number = true;
+    }
+
+    // Saturates instead of wrapping around.
+    number = &router->numbers[router->num_numbers - 1];
+    *number = (*number > (UINT32_MAX - 9) / 10) ? UINT32_MAX : *number * 10 + (data[i] - '0');
+  }
+}
+
+bool mive_mqtt_router_feed(mive_mqtt_router_t* router, const char* topic, size_t topic_len, const char* data, size_t data_len,
+                           size_t offset, size_t total_len, bool retain)
+{
+  mive_mqtt_message_t message = {0};
+
+  // Only the first fragment carries the topic.
+  if(offset == 0)
+  {
+    router->current = mive_mqtt_router_match(router, topic, topic_len);
+    router->current_retain = retain;
+    if(router->current == NULL)
+    {
+      ESP_LOGD(TAG, "No route for %.*s", (int)topic_len, topic);
+      return false;
+    }
+
+    if(router->current->keywords != NULL)
+    {
+      keyword_begin(router);
+      if(total_len > MIVE_ROUTER_MAX_KEYWORD_LEN * 2)
+      {
+        // Can't be a keyword, even with whitespace around it.
+        router->candidates = 0;
+      }
+    }
+
+    if(router->current->numbers)
+    {
+      numbers_begin(router);
+    }
+  }
+
+  if(router->current == NULL)
+  {
+    return false;
+  }
+
+  if(router->current->keywords != NULL)
+  {
+    keyword_feed(router, data, data_len);
+  }
+
+  if(router->current->numbers)
+  {
+    numbers_feed(router, data, data_len);
+  }
+
+  if(offset + data_len < total_len)
+  {
+    // More fragments to come.
+    return false;
+  }
+
+  message.route = router->current;
+  message.source = router->source;
+  message.retain = router->current_retain;
+  message.value = (router->current->keywords != NULL) ? keyword_end(router) : 0;
+  if(router->current->numbers)
+  {
+    memcpy(message.numbers, router->numbers, sizeof(message.numbers));
+    message.num_numbers = router->num_numbers;
+  }
+  router->current = NULL;
+
+  if(message.retain && !message.route->accept_retained)
+  {
+    ESP_LOGI(TAG, "Ignoring retained message on %s", message.route->filter);
+    return false;
+  }
+
+  return message.route->handler(&message, message.route->arg);
+}
+
+void mive_mqtt_router_dispatch(mive_mqtt_router_t* router, esp_mqtt_event_handle_t event)
+{
+  mive_mqtt_router_feed(router, event->topic, event->topic_len, event->data, event->data_len, event->current_data_offset,
+                        event->total_data_len, event->retain);
+}
@@ -0,0 +1,194 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "include/net.h"
+#include "include/sysmon.h"
+
+static const char *TAG = "net";
+
+#if MIVE_STATIC_ALLOC
+static StaticTask_t net_task_buffer;
+static StackType_t net_task_stack[MIVE_NET_TASK_STACK];
+#endif
+
+struct net_header
+{
+  const char* path;
+  uint16_t len;
+  uint8_t qos;
+  uint8_t flags;
+};
+
+// Header length of a skip to the start of the ring.
+#define NET_WRAP 0xffff
+#define NET_ALIGN(x) (((x) + 3) & ~3u)
+
+static void net_task(void* context)
+{
+  mive_net_t* net = (mive_net_t*)context;
+  struct net_header header;
+  uint32_t tail = 0;
+  uint32_t offset = 0;
+  uint32_t to_end = 0;
+  int64_t start_us = 0;
+  int64_t elapsed_us = 0;
+  int retval = 0;
+
+  while(1)
+  {
+    xSemaphoreTake(net->wake, portMAX_DELAY);
+
+    tail = net->tail;
+    while(tail != __atomic_load_n(&net->head, __ATOMIC_ACQUIRE))
+    {
+      offset = tail % MIVE_NET_RING_SIZE;
+      to_end = MIVE_NET_RING_SIZE - offset;
+
+      if(to_end < sizeof(header))
+      {
+        tail += to_end;
+        continue;
+      }
+
+      memcpy(&header, &net->ring[offset], sizeof(header));
+      if(header.len == NET_WRAP)
+      {
+        tail += to_end;
+        continue;
+      }
+
+      start_us = esp_timer_get_time();
+      if(header.flags & MIVE_NET_FLAG_STORE)
+      {
+        retval = esp_mqtt_client_enqueue(net->client, header.path, (const char*)&net->ring[offset + sizeof(header)], header.len,
+                                         header.qos, header.flags & MIVE_NET_FLAG_RETAIN, true);
+      }
+      else
+      {
+        retval = esp_mqtt_client_publish(net->client, header.path, (const char*)&net->ring[offset + sizeof(header)], header.len,
+                                         header.qos, header.flags & MIVE_NET_FLAG_RETAIN);
+      }
+      elapsed_us = esp_timer_get_time() - start_us;
+
+      if(retval < 0)
+      {
+        // Lost the connection, the flush after reconnecting sends the latest values again.
+        net->stats.failed++;
+      }
+      else
+      {
+        net->stats.sent++;
+      }
+      if(elapsed_us > net->stats.max_publish_us)
+      {
+        net->stats.max_publish_us = elapsed_us;
+      }
+
+      // Only now can main_task reuse the bytes.
+      tail += NET_ALIGN(sizeof(header) + header.len);
+      __atomic_store_n(&net->tail, tail, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&net->tail, tail, __ATOMIC_RELEASE);
+
+    if(__atomic_exchange_n(&net->congested, 0, __ATOMIC_ACQ_REL) && net->on_drained != NULL)
+    {
+      net->on_drained(net->arg);
+    }
+  }
+}
+
+esp_err_t mive_net_init(mive_net_t* net, esp_mqtt_client_handle_t client, mive_net_drained_cb_t on_drained, void* arg)
+{
+  net->head = 0;
+  net->tail = 0;
+  net->congested = 0;
+  net->client = client;
+  net->on_drained = on_drained;
+  net->arg = arg;
+  memset(&net->stats, 0, sizeof(net->stats));
+
+  net->wake = xSemaphoreCreateBinaryStatic(&net->wake_buffer);
+  if(net->wake == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+
+#if MIVE_STATIC_ALLOC
+  xTaskCreateStaticPinnedToCore(net_task, "net", MIVE_NET_TASK_STACK, net, MIVE_NET_TASK_PRIO, net_task_stack, &net_task_buffer,
+                                MIVE_NET_CORE);
+#else
+  if(xTaskCreatePinnedToCore(net_task, "net", MIVE_NET_TASK_STACK, net, MIVE_NET_TASK_PRIO, NULL, MIVE_NET_CORE) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Couldn't start the net task");
+    return ESP_ERR_NO_MEM;
+  }
+#endif
+
+  return ESP_OK;
+}
+
+bool mive_net_push(mive_net_t* net, const char* path, const char* data, int len, uint8_t qos, uint8_t flags, bool bulk)
+{
+  struct net_header header = {
+    .path = path,
+    .len = len,
+    .qos = qos,
+    .flags = flags,
+  };
+  uint32_t head = net->head;
+  uint32_t used = head - __atomic_load_n(&net->tail, __ATOMIC_ACQUIRE);
+  uint32_t offset = head % MIVE_NET_RING_SIZE;
+  uint32_t to_end = MIVE_NET_RING_SIZE - offset;
+  uint32_t total = NET_ALIGN(sizeof(header) + len);
+  uint32_t skip = (to_end < total) ? to_end : 0;
+  uint32_t limit = bulk ? (MIVE_NET_RING_SIZE - MIVE_NET_RESERVE) : MIVE_NET_RING_SIZE;
+
+  if(len < 0 || len >= NET_WRAP)
+  {
+    return false;
+  }
+
+  if(used + skip + total > limit)
+  {
+    if(bulk || total > MIVE_NET_RING_SIZE / 2)
+    {
+      net->stats.refused++;
+    }
+    // Whoever got turned away tries again on on_drained.
+    __atomic_store_n(&net->congested, 1, __ATOMIC_RELEASE);
+    xSemaphoreGive(net->wake);
+    return false;
+  }
+
+  if(skip >= sizeof(header))
+  {
+    struct net_header wrap = {
+      .len = NET_WRAP,
+    };
+    memcpy(&net->ring[offset], &wrap, sizeof(wrap));
+  }
+
+  offset = (head + skip) % MIVE_NET_RING_SIZE;
+  memcpy(&net->ring[offset], &header, sizeof(header));
+  memcpy(&net->ring[offset + sizeof(header)], data, len);
+
+  head += skip + total;
+  __atomic_store_n(&net->head, head, __ATOMIC_RELEASE);
+  xSemaphoreGive(net->wake);
+
+  if(used + skip + total > net->stats.high_water)
+  {
+    net->stats.high_water = used + skip + total;
+  }
+
+  return true;
+}
+
+uint32_t mive_net_pending(mive_net_t* net)
+{
+  return __atomic_load_n(&net->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&net->tail, __ATOMIC_ACQUIRE);
+}
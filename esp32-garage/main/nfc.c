@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "include/nfc.h"
+#include "include/program.h"
+#include "include/events.h"
+#include "include/event_queue.h"
+#include "include/trace.h"
+#include "include/dlog.h"
+#include "include/boot.h"
+
+static const char *TAG = "nfc";
+
+static uint8_t compare_uid(rc522_picc_uid_t uid1, rc522_picc_uid_t uid2);
+
+static char* mive_nfc_state_str[] = {
+  [NFC_STATE_IDLE] = "IDLE",
+  [NFC_STATE_WAITING_FOR_CARD] = "WAITING",
+  [NFC_STATE_REMOVE_CARD] = "REMOVE",
+  [NFC_STATE_SUCCESS] = "SUCCESS",
+  [NFC_STATE_FAIL] = "FAIL",
+};
+
+char* mive_nfc_get_state_str(enum mive_nfc_state state)
+{
+  if(state > NFC_STATE_MAX)
+  {
+    return NULL;
+  }
+
+  return mive_nfc_state_str[state];
+}
+
+void mive_nfc_save_uuids(mive_program_t* program)
+{
+  nvs_handle_t my_handle;
+  esp_err_t err;
+
+  err = nvs_open_from_partition(NFC_PARTITION_NAME, NFC_STORAGE_NAMESPACE, NVS_READWRITE, &my_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) nvs_open!", esp_err_to_name(err));
+    return;
+  }
+
+  err = nvs_set_blob(my_handle, "uuid_data", program->nfc_uuids, NFC_MAX_UIDS * sizeof(*program->nfc_uuids));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) saving array data!", esp_err_to_name(err));
+  }
+
+  err = nvs_commit(my_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) commiting data!", esp_err_to_name(err));
+  }
+  nvs_close(my_handle);
+}
+
+esp_err_t mive_nfc_load_uuids(mive_program_t* program)
+{
+  nvs_handle_t my_handle;
+  esp_err_t err;
+
+  size_t required_size = 0;
+  err = nvs_open_from_partition(NFC_PARTITION_NAME, NFC_STORAGE_NAMESPACE, NVS_READONLY, &my_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) nvs_open!", esp_err_to_name(err));
+    return err;
+  }
+
+  err = nvs_get_blob(my_handle, "uuid_data", NULL, &required_size);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) nvs_get_blob!", esp_err_to_name(err));
+  }
+
+  if(required_size > (NFC_MAX_UIDS * sizeof(*program->nfc_uuids)))
+  {
+    ESP_LOGW(TAG, "Warning: Too much data. Got %u, expected max %u\n", (unsigned)required_size, (unsigned)(NFC_MAX_UIDS * sizeof(*program->nfc_uuids)));
+    required_size = (NFC_MAX_UIDS * sizeof(*program->nfc_uuids));
+  }
+
+  err = nvs_get_blob(my_handle, "uuid_data", program->nfc_uuids, &required_size);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) nvs_get_blob!", esp_err_to_name(err));
+    goto end;
+  }
+
+  program->num_uuids = required_size / sizeof(*program->nfc_uuids);
+
+end:
+  nvs_close(my_handle);
+  return err;
+}
+
+static bool add_uuid(mive_program_t* program, rc522_picc_uid_t* uuid)
+{
+  rc522_picc_uid_t* temp_uuid = NULL;
+
+  for(uint32_t i = 0; i < NFC_MAX_UIDS; ++i)
+  {
+    temp_uuid = &program->nfc_uuids[i];
+    if(temp_uuid->length == 0)
+    {
+      mive_seqlock_write_begin(&program->nfc_lock);
+      memcpy(temp_uuid->value, uuid->value, uuid->length);
+      temp_uuid->length = uuid->length;
+      mive_seqlock_write_end(&program->nfc_lock);
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void remove_uuid(mive_program_t* program, rc522_picc_uid_t* uuid)
+{
+  rc522_picc_uid_t* temp_uuid = NULL;
+
+  for(uint32_t i = 0; i < NFC_MAX_UIDS; ++i)
+  {
+    temp_uuid = &program->nfc_uuids[i];
+    if(compare_uid(*temp_uuid, *uuid))
+    {
+      mive_seqlock_write_begin(&program->nfc_lock);
+      memset(temp_uuid->value, 0, sizeof(temp_uuid->value));
+      temp_uuid->length = 0;
+      mive_seqlock_write_end(&program->nfc_lock);
+
+      break;
+    }
+  }
+  return;
+}
+
+// Index of the card in the list, -1 if it isn't registered.
+static int32_t find_uuid(mive_program_t* program, rc522_picc_uid_t* uuid)
+{
+  for(uint32_t i = 0; i < NFC_MAX_UIDS; ++i)
+  {
+    if(compare_uid(*uuid, program->nfc_uuids[i]))
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void mive_nfc_set_state(mive_program_t* program, enum mive_nfc_state state)
+{
+  mive_seqlock_write_begin(&program->nfc_lock);
+  program->nfc_state = state;
+  mive_seqlock_write_end(&program->nfc_lock);
+}
+
+void mive_nfc_ensure_loaded(mive_program_t* program)
+{
+  esp_err_t retval = ESP_OK;
+
+  if(program->nfc_loaded)
+  {
+    return;
+  }
+
+  retval = nvs_flash_init_partition(NFC_PARTITION_NAME);
+  if (retval == ESP_ERR_NVS_NO_FREE_PAGES || retval == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_flash_erase_partition(NFC_PARTITION_NAME));
+    retval = nvs_flash_init_partition(NFC_PARTITION_NAME);
+  }
+
+  // Without the partition the list stays as it is, cards registered from
+  // here on only last until the next reset.
+  if(retval == ESP_OK)
+  {
+    mive_nfc_load_uuids(program);
+  }
+  else
+  {
+    ESP_LOGE(TAG, "Error (%s) opening the card partition", esp_err_to_name(retval));
+  }
+
+  // Publishes the list to the RC522 callback.
+  mive_seqlock_write_begin(&program->nfc_lock);
+  program->nfc_loaded = true;
+  mive_seqlock_write_end(&program->nfc_lock);
+  mive_boot_mark(MIVE_BOOT_CREDENTIALS);
+}
+
+int32_t mive_nfc_find(mive_program_t* program, const uint8_t* uid, uint8_t length)
+{
+  rc522_picc_uid_t uuid = {
+    .length = (length < sizeof(uuid.value)) ? length : sizeof(uuid.value),
+  };
+
+  memcpy(uuid.value, uid, uuid.length);
+  return find_uuid(program, &uuid);
+}
+
+bool mive_nfc_enroll(mive_program_t* program, const uint8_t* uid, uint8_t length)
+{
+  rc522_picc_uid_t uuid = {
+    .length = (length < sizeof(uuid.value)) ? length : sizeof(uuid.value),
+  };
+
+  memcpy(uuid.value, uid, uuid.length);
+
+  // Registering a card twice only burns a slot.
+  if(find_uuid(program, &uuid) >= 0)
+  {
+    return true;
+  }
+
+  if(!add_uuid(program, &uuid))
+  {
+    ESP_LOGW(TAG, "No room for another card, %d registered", NFC_MAX_UIDS);
+    return false;
+  }
+
+  return true;
+}
+
+static uint8_t compare_uid(rc522_picc_uid_t uid1, rc522_picc_uid_t uid2)
+{
+  uint8_t retval = true;
+  if(uid1.length == uid2.length)
+  {
+    for(int i = 0; i < uid1.length; ++i)
+    {
+      if(uid1.value[i] != uid2.value[i])
+      {
+        retval = false;
+      }
+    }
+  }
+  else{
+    retval = false;
+  }
+
+  return retval;
+}
+
+void mive_nfc_on_picc_state_changed(void *arg, esp_event_base_t base, int32_t event_id, void *data)
+{
+  mive_program_t *program = (mive_program_t*)arg;
+  rc522_picc_state_changed_event_t *event = (rc522_picc_state_changed_event_t *)data;
+  rc522_picc_t *picc = event->picc;
+
+  uint8_t nfc_state = NFC_STATE_IDLE;
+  bool loaded = false;
+  int32_t index = -1;
+  uint32_t seq = 0;
+
+  // main_task owns the state and the card list, this only takes a
+  // consistent look at both.
+  do
+  {
+    seq = mive_seqlock_read_begin(&program->nfc_lock);
+    nfc_state = program->nfc_state;
+    loaded = program->nfc_loaded;
+    index = (loaded && picc->state == RC522_PICC_STATE_ACTIVE) ? find_uuid(program, &picc->uid) : -1;
+  } while(mive_seqlock_read_retry(&program->nfc_lock, seq));
+
+  if (picc->state == RC522_PICC_STATE_ACTIVE) {
+    program->nfc_irq.card_present = true;
+    MIVE_DLOG_DATA(MIVE_DLOG_INFO, TAG, MIVE_DLOG_DATA_HEX, picc->uid.value, picc->uid.length, "Card detected, UID");
+    // Tapped before the list came out of NVS, main_task loads it and looks
+    // the card up itself.
+    if(nfc_state == NFC_STATE_IDLE && !loaded)
+    {
+      mive_event_t m_event = {
+        .event_type = MIVE_EVENT_CHECK_CARD,
+        .source = MIVE_SOURCE_NFC,
+        .event_data.nfc_card.length = picc->uid.length,
+      };
+      memcpy(m_event.event_data.nfc_card.uid, picc->uid.value, picc->uid.length);
+      mive_event_queue_send(&program->main_queue, &m_event, pdMS_TO_TICKS(10));
+      return;
+    }
+
+    mive_trace(MIVE_TRACE_NFC_CARD, MIVE_SOURCE_NFC, nfc_state, index >= 0);
+    // If we aren't registering anything, do as normal
+    if(nfc_state == NFC_STATE_IDLE)
+    {
+      if(index >= 0)
+      {
+        mive_event_t m_event = {
+          .event_type = MIVE_EVENT_START_GARAGE,
+          .source = MIVE_SOURCE_NFC,
+          .event_data.start_garage.credential = index,
+        };
+
+        mive_event_queue_send(&program->main_queue, &m_event, pdMS_TO_TICKS(10));
+      }
+      else
+      {
+        // Only for the history.
+        mive_event_t m_event = {
+          .event_type = MIVE_EVENT_CARD_REJECTED,
+          .source = MIVE_SOURCE_NFC,
+        };
+
+        mive_event_queue_send(&program->main_queue, &m_event, 0);
+      }
+    }
+    else if(nfc_state == NFC_STATE_WAITING_FOR_CARD)
+    {
+      // main_task adds it, it checks the state again.
+      mive_event_t m_event = {
+        .event_type = MIVE_EVENT_ENROLL_CARD,
+        .source = MIVE_SOURCE_NFC,
+        .event_data.nfc_card.length = picc->uid.length,
+      };
+      memcpy(m_event.event_data.nfc_card.uid, picc->uid.value, picc->uid.length);
+      mive_event_queue_send(&program->main_queue, &m_event, pdMS_TO_TICKS(10));
+    }
+  }
+  else if (picc->state == RC522_PICC_STATE_IDLE && event->old_state >= RC522_PICC_STATE_ACTIVE) {
+    program->nfc_irq.card_present = false;
+    MIVE_DLOGI(TAG, "Card has been removed");
+    // main_task may not have taken the enrollment yet, it follows this in
+    // the same lane.
+    if(nfc_state == NFC_STATE_WAITING_FOR_CARD || nfc_state == NFC_STATE_REMOVE_CARD)
+    {
+      mive_event_t m_event = {
+        .event_type = MIVE_EVENT_CARD_REMOVED,
+        .source = MIVE_SOURCE_NFC,
+      };
+      mive_event_queue_send(&program->main_queue, &m_event, pdMS_TO_TICKS(10));
+    }
+  }
+}
+
+void mive_nfc_set_scanning(mive_program_t* program, bool on)
+{
+  esp_err_t retval = ESP_OK;
+
+  // app_main starts the reader after main_task, it may not be there yet.
+  if(program->nfc_scanner == NULL || program->duty.nfc_scanning == on)
+  {
+    return;
+  }
+
+  retval = on ? rc522_start(program->nfc_scanner) : rc522_pause(program->nfc_scanner);
+  if(retval != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Error (%s) %s the reader", esp_err_to_name(retval), on ? "resuming" : "pausing");
+    return;
+  }
+  program->duty.nfc_scanning = on;
+}
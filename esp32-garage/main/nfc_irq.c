@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "rc522_driver.h"
+
+#include "include/nfc_irq.h"
+
+static const char *TAG = "nfc_irq";
+
+// MFRC522 registers and values, see the datasheet section 9.
+#define REG_COMMAND 0x01
+#define REG_COM_IEN 0x02
+#define REG_DIV_IEN 0x03
+#define REG_COM_IRQ 0x04
+#define REG_FIFO_DATA 0x09
+#define REG_FIFO_LEVEL 0x0A
+#define REG_BIT_FRAMING 0x0D
+
+#define CMD_IDLE 0x00
+#define CMD_TRANSCEIVE 0x0C
+
+// IRQ pin active low (inverted), only the receiver interrupt enabled.
+#define COM_IEN_IRQ_INV 0x80
+#define COM_IEN_RX 0x20
+#define DIV_IEN_PUSH_PULL 0x80
+// Writing 0 to Set1 clears every bit marked with a 1.
+#define COM_IRQ_CLEAR_ALL 0x7F
+#define FIFO_FLUSH 0x80
+// REQA is a short frame, 7 bits of its only byte go out.
+#define PICC_CMD_REQA 0x26
+#define BIT_FRAMING_7_BITS 0x07
+#define BIT_FRAMING_START_SEND 0x80
+
+typedef struct reg_write_s
+{
+  uint8_t reg;
+  uint8_t value;
+} reg_write_t;
+
+static esp_err_t write_regs(mive_nfc_irq_t* irq, const reg_write_t* writes, size_t count)
+{
+  esp_err_t retval = ESP_OK;
+
+  for(size_t i = 0; i < count; ++i)
+  {
+    retval = rc522_driver_write(irq->driver, writes[i].reg, &writes[i].value, 1);
+    if(retval != ESP_OK)
+    {
+      return retval;
+    }
+  }
+
+  return ESP_OK;
+}
+
+static void IRAM_ATTR on_irq(void* arg)
+{
+  mive_nfc_irq_t* irq = (mive_nfc_irq_t*)arg;
+
+  // The line stays low until the reader is disarmed, one call per probe.
+  gpio_intr_disable(irq->irq_pin);
+  if(irq->on_card(irq->arg))
+  {
+    portYIELD_FROM_ISR();
+  }
+}
+
+esp_err_t mive_nfc_irq_init(mive_nfc_irq_t* irq, rc522_driver_handle_t driver, gpio_num_t irq_pin, mive_nfc_irq_cb_t on_card, void* arg)
+{
+  esp_err_t retval = ESP_OK;
+
+  irq->driver = driver;
+  irq->irq_pin = irq_pin;
+  irq->on_card = on_card;
+  irq->arg = arg;
+  irq->card_present = false;
+  irq->session_us = 0;
+
+  gpio_config_t irq_config = {
+    .pin_bit_mask = 1ULL << irq_pin,
+    .mode = GPIO_MODE_INPUT,
+    .pull_up_en = GPIO_PULLUP_ENABLE,
+    .intr_type = GPIO_INTR_NEGEDGE,
+  };
+  retval = gpio_config(&irq_config);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  // Shared with the other GPIO users, fine if somebody installed it already.
+  retval = gpio_install_isr_service(0);
+  if(retval != ESP_OK && retval != ESP_ERR_INVALID_STATE)
+  {
+    goto end;
+  }
+
+  retval = gpio_isr_handler_add(irq_pin, on_irq, irq);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+  gpio_intr_disable(irq_pin);
+
+#if CONFIG_PM_ENABLE
+  // Edge interrupts don't fire in light sleep, the level wakes the chip up.
+  ESP_ERROR_CHECK_WITHOUT_ABORT(gpio_wakeup_enable(irq_pin, GPIO_INTR_LOW_LEVEL));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_sleep_enable_gpio_wakeup());
+#endif
+
+  return ESP_OK;
+
+end:
+  ESP_LOGE(TAG, "Error (%s) setting up the IRQ line", esp_err_to_name(retval));
+  return retval;
+}
+
+esp_err_t mive_nfc_irq_probe(mive_nfc_irq_t* irq)
+{
+  const reg_write_t probe[] = {
+    {REG_COMMAND, CMD_IDLE},
+    {REG_COM_IRQ, COM_IRQ_CLEAR_ALL},
+    {REG_DIV_IEN, DIV_IEN_PUSH_PULL},
+    {REG_COM_IEN, COM_IEN_IRQ_INV | COM_IEN_RX},
+    {REG_FIFO_LEVEL, FIFO_FLUSH},
+    {REG_FIFO_DATA, PICC_CMD_REQA},
+    {REG_BIT_FRAMING, BIT_FRAMING_7_BITS},
+    {REG_COMMAND, CMD_TRANSCEIVE},
+  };
+  const reg_write_t send = {REG_BIT_FRAMING, BIT_FRAMING_7_BITS | BIT_FRAMING_START_SEND};
+  esp_err_t retval = ESP_OK;
+
+  if(irq->driver == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // The line stays masked until the old ComIrq bits are gone, a reader that
+  // didn't take the writes must not fire on what it held from before.
+  gpio_intr_disable(irq->irq_pin);
+  retval = write_regs(irq, probe, sizeof(probe) / sizeof(probe[0]));
+  if(retval != ESP_OK)
+  {
+    return retval;
+  }
+
+  gpio_intr_enable(irq->irq_pin);
+  retval = write_regs(irq, &send, 1);
+  if(retval != ESP_OK)
+  {
+    gpio_intr_disable(irq->irq_pin);
+  }
+
+  return retval;
+}
+
+esp_err_t mive_nfc_irq_disarm(mive_nfc_irq_t* irq)
+{
+  const reg_write_t disarm[] = {
+    {REG_COM_IEN, COM_IEN_IRQ_INV},
+    {REG_COMMAND, CMD_IDLE},
+    {REG_COM_IRQ, COM_IRQ_CLEAR_ALL},
+    {REG_BIT_FRAMING, 0},
+  };
+
+  if(irq->driver == NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  gpio_intr_disable(irq->irq_pin);
+  return write_regs(irq, disarm, sizeof(disarm) / sizeof(disarm[0]));
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#include "esp_attr.h"
+#endif
+
+#include "include/power.h"
+
+static const char *TAG = "power";
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpu_lock;
+#endif
+static int64_t window_start_us;
+static int64_t hold_start_us;
+static int64_t busy_us;
+static volatile uint32_t sleep_count;
+static volatile int64_t sleep_us;
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+// Runs from the idle task with interrupts off, sleep_time_us is how long the
+// chip actually slept.
+static IRAM_ATTR esp_err_t on_light_sleep_exit(int64_t sleep_time_us, void* arg)
+{
+  sleep_count++;
+  sleep_us += sleep_time_us;
+  return ESP_OK;
+}
+#endif
+
+esp_err_t mive_power_init(void)
+{
+  window_start_us = esp_timer_get_time();
+
+#if CONFIG_PM_ENABLE
+  esp_err_t retval = ESP_OK;
+  esp_pm_config_t pm_config = {
+    .max_freq_mhz = MIVE_PM_MAX_FREQ_MHZ,
+    .min_freq_mhz = MIVE_PM_MIN_FREQ_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    .light_sleep_enable = MIVE_PM_LIGHT_SLEEP,
+#endif
+  };
+
+  retval = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "main_task", &cpu_lock);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  retval = esp_pm_configure(&pm_config);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+  esp_pm_sleep_cbs_register_config_t sleep_cbs = {
+    .exit_cb = on_light_sleep_exit,
+  };
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_pm_light_sleep_register_cbs(&sleep_cbs));
+#endif
+
+  ESP_LOGI(TAG, "DFS %d-%d MHz, light sleep %s", MIVE_PM_MIN_FREQ_MHZ, MIVE_PM_MAX_FREQ_MHZ,
+    pm_config.light_sleep_enable ? "on" : "off");
+  return ESP_OK;
+
+end:
+  ESP_LOGE(TAG, "Error (%s) configuring power management", esp_err_to_name(retval));
+  return retval;
+#else
+  return ESP_OK;
+#endif
+}
+
+void mive_power_hold(void)
+{
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(cpu_lock);
+#endif
+  hold_start_us = esp_timer_get_time();
+}
+
+void mive_power_release(void)
+{
+  busy_us += esp_timer_get_time() - hold_start_us;
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_release(cpu_lock);
+#endif
+}
+
+int mive_power_take_json(char* buf, size_t buf_len)
+{
+  int64_t now_us = esp_timer_get_time();
+  int64_t asleep_us = sleep_us;
+  int64_t idle_us = (now_us - window_start_us) - asleep_us - busy_us;
+  int written = snprintf(buf, buf_len, ",\"pm\":{\"sleep\":[%lu,%lu],\"busy_ms\":%lu,\"idle_ms\":%lu}", (unsigned long)sleep_count,
+    (unsigned long)(asleep_us / 1000), (unsigned long)(busy_us / 1000), (unsigned long)((idle_us > 0) ? idle_us / 1000 : 0));
+
+  if(written < 0 || (size_t)written >= buf_len)
+  {
+    return -1;
+  }
+
+  // A sleep ending right here may get lost, that's a few ms in a whole window.
+  sleep_count = 0;
+  sleep_us = 0;
+  busy_us = 0;
+  window_start_us = now_us;
+
+  return written;
+}
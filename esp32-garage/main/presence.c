@@ -0,0 +1,193 @@
+#include <string.h>
+#include "esp_log.h"
+#include "include/presence.h"
+
+static char* presence_state_str[] = {
+  [MIVE_PRESENCE_UNKNOWN] = "UNKNOWN",
+  [MIVE_PRESENCE_VACANT] = "VACANT",
+  [MIVE_PRESENCE_OCCUPIED] = "OCCUPIED",
+};
+
+const char* mive_presence_state_str(enum mive_presence_state_e state)
+{
+  if(state > MIVE_PRESENCE_OCCUPIED)
+  {
+    return NULL;
+  }
+
+  return presence_state_str[state];
+}
+
+void mive_presence_init(mive_presence_t* presence, uint32_t max_distance_cm)
+{
+  memset(presence, 0, sizeof(*presence));
+  presence->max_distance_cm = max_distance_cm;
+  presence->state = MIVE_PRESENCE_UNKNOWN;
+}
+
+static uint32_t window_median(mive_presence_t* presence)
+{
+  uint32_t sorted[MIVE_PRESENCE_MEDIAN_WINDOW];
+  uint8_t len = presence->window_len;
+
+  memcpy(sorted, presence->window, len * sizeof(sorted[0]));
+
+  // Insertion sort, the window is tiny.
+  for(uint8_t i = 1; i < len; ++i)
+  {
+    uint32_t value = sorted[i];
+    int j = i - 1;
+    while(j >= 0 && sorted[j] > value)
+    {
+      sorted[j + 1] = sorted[j];
+      --j;
+    }
+    sorted[j + 1] = value;
+  }
+
+  return sorted[len / 2];
+}
+
+static uint32_t abs_diff(uint32_t a, uint32_t b)
+{
+  return (a > b) ? (a - b) : (b - a);
+}
+
+static uint8_t presence_invalidate(mive_presence_t* presence)
+{
+  uint8_t changed = 0;
+
+  presence->window_len = 0;
+  presence->window_pos = 0;
+  presence->filtered_valid = false;
+
+  if(presence->reported_valid)
+  {
+    presence->reported_valid = false;
+    changed |= MIVE_PRESENCE_CHANGED_DISTANCE;
+  }
+
+  if(presence->state != MIVE_PRESENCE_UNKNOWN)
+  {
+    presence->state = MIVE_PRESENCE_UNKNOWN;
+    changed |= MIVE_PRESENCE_CHANGED_STATE;
+  }
+
+  return changed;
+}
+
+uint8_t mive_presence_update(mive_presence_t* presence, const mive_ranging_result_t* result, int64_t now_us)
+{
+  uint8_t changed = 0;
+  uint32_t sample = 0;
+  uint32_t previous_cm = 0;
+  uint32_t filtered_cm = 0;
+
+  switch (result->status)
+  {
+    case MIVE_RANGING_OK:
+      sample = result->distance_cm;
+      break;
+    case MIVE_RANGING_ECHO_TIMEOUT:
+      // Nothing within range is a perfectly good answer for an empty spot.
+      sample = presence->max_distance_cm;
+      break;
+    default:
+      // Sensor didn't answer. Hold the last value through short glitches.
+      if(presence->errors < MIVE_PRESENCE_MAX_ERRORS)
+      {
+        presence->errors++;
+        if(presence->errors == MIVE_PRESENCE_MAX_ERRORS)
+        {
+          return presence_invalidate(presence);
+        }
+      }
+      return 0;
+  }
+
+  presence->errors = 0;
+
+  if(presence->filtered_valid && abs_diff(sample, presence->filtered_x16 >> 4) >= MIVE_PRESENCE_STEP_CM)
+  {
+    presence->last_motion_us = now_us;
+  }
+
+  presence->window[presence->window_pos] = sample;
+  presence->window_pos = (presence->window_pos + 1) % MIVE_PRESENCE_MEDIAN_WINDOW;
+  if(presence->window_len < MIVE_PRESENCE_MEDIAN_WINDOW)
+  {
+    presence->window_len++;
+  }
+
+  sample = window_median(presence);
+
+  previous_cm = presence->filtered_x16 >> 4;
+  if(!presence->filtered_valid)
+  {
+    presence->filtered_x16 = sample << 4;
+    presence->filtered_valid = true;
+    previous_cm = sample;
+  }
+  else
+  {
+    presence->filtered_x16 += (((int32_t)sample << 4) - presence->filtered_x16) >> MIVE_PRESENCE_EMA_SHIFT;
+  }
+  filtered_cm = presence->filtered_x16 >> 4;
+
+  if(abs_diff(filtered_cm, previous_cm) >= MIVE_PRESENCE_MOTION_CM)
+  {
+    presence->last_motion_us = now_us;
+  }
+
+  if(!presence->reported_valid || abs_diff(filtered_cm, presence->reported_cm) >= MIVE_PRESENCE_DEADBAND_CM)
+  {
+    presence->reported_cm = filtered_cm;
+    presence->reported_valid = true;
+    changed |= MIVE_PRESENCE_CHANGED_DISTANCE;
+  }
+
+  if(filtered_cm < MIVE_PRESENCE_OCCUPIED_CM && presence->state != MIVE_PRESENCE_OCCUPIED)
+  {
+    presence->state = MIVE_PRESENCE_OCCUPIED;
+    changed |= MIVE_PRESENCE_CHANGED_STATE;
+  }
+  else if(filtered_cm > MIVE_PRESENCE_VACANT_CM && presence->state != MIVE_PRESENCE_VACANT)
+  {
+    presence->state = MIVE_PRESENCE_VACANT;
+    changed |= MIVE_PRESENCE_CHANGED_STATE;
+  }
+  else if(presence->state == MIVE_PRESENCE_UNKNOWN)
+  {
+    // First reading landed inside the hysteresis band, pick the closer side.
+    presence->state = (filtered_cm < (MIVE_PRESENCE_OCCUPIED_CM + MIVE_PRESENCE_VACANT_CM) / 2) ? MIVE_PRESENCE_OCCUPIED : MIVE_PRESENCE_VACANT;
+    changed |= MIVE_PRESENCE_CHANGED_STATE;
+  }
+
+  return changed;
+}
+
+bool mive_presence_get_distance(mive_presence_t* presence, uint32_t* distance_cm)
+{
+  *distance_cm = presence->reported_cm;
+  return presence->reported_valid;
+}
+
+enum mive_presence_state_e mive_presence_get_state(mive_presence_t* presence)
+{
+  return (enum mive_presence_state_e)presence->state;
+}
+
+uint32_t mive_presence_next_period_ms(mive_presence_t* presence, bool door_moving, int64_t now_us)
+{
+  if(door_moving)
+  {
+    return MIVE_PRESENCE_FAST_PERIOD_MS;
+  }
+
+  if(presence->last_motion_us != 0 && (now_us - presence->last_motion_us) < (MIVE_PRESENCE_MOTION_HOLD_MS * 1000LL))
+  {
+    return MIVE_PRESENCE_FAST_PERIOD_MS;
+  }
+
+  return MIVE_PRESENCE_SLOW_PERIOD_MS;
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "include/ranging.h"
+
+static const char *TAG = "ranging";
+
+#define TIMEOUT_TIMER_RESOLUTION_HZ 1000000
+#define TRIGGER_PULSE_US 10
+
+static char* ranging_status_str[] = {
+  [MIVE_RANGING_OK] = "OK",
+  [MIVE_RANGING_PING_TIMEOUT] = "Ping timeout (no device found)",
+  [MIVE_RANGING_ECHO_TIMEOUT] = "Echo timeout (i.e. distance too big)",
+};
+
+const char* mive_ranging_status_str(enum mive_ranging_status_e status)
+{
+  if(status > MIVE_RANGING_ECHO_TIMEOUT)
+  {
+    return NULL;
+  }
+
+  return ranging_status_str[status];
+}
+
+// Both ISRs below race to finish a measurement, whoever moves the state back
+// to idle first gets to report it.
+static bool ranging_finish(mive_ranging_t* ranging, uint8_t expected_state, mive_ranging_result_t* result)
+{
+  bool finished = false;
+
+  portENTER_CRITICAL_ISR(&ranging->lock);
+  if(ranging->state == expected_state)
+  {
+    ranging->state = MIVE_RANGING_IDLE;
+    finished = true;
+  }
+  portEXIT_CRITICAL_ISR(&ranging->lock);
+
+  if(!finished)
+  {
+    return false;
+  }
+
+  gptimer_stop(ranging->timeout_timer);
+  return ranging->config.on_done(result, ranging->config.arg);
+}
+
+static bool ranging_on_capture(mcpwm_cap_channel_handle_t channel, const mcpwm_capture_event_data_t* edata, void* user_data)
+{
+  mive_ranging_t* ranging = (mive_ranging_t*)user_data;
+  mive_ranging_result_t result = {.status = MIVE_RANGING_OK};
+  uint32_t pulse_ticks = 0;
+
+  if(edata->cap_edge == MCPWM_CAP_EDGE_POS)
+  {
+    portENTER_CRITICAL_ISR(&ranging->lock);
+    if(ranging->state == MIVE_RANGING_WAIT_RISE)
+    {
+      ranging->rise_ticks = edata->cap_value;
+      ranging->state = MIVE_RANGING_WAIT_FALL;
+    }
+    portEXIT_CRITICAL_ISR(&ranging->lock);
+    return false;
+  }
+
+  pulse_ticks = edata->cap_value - ranging->rise_ticks;
+  result.distance_cm = (uint32_t)(((uint64_t)pulse_ticks * 1000000 / ranging->cap_resolution_hz) / MIVE_RANGING_US_PER_CM);
+  if(result.distance_cm > ranging->config.max_distance_cm)
+  {
+    result.status = MIVE_RANGING_ECHO_TIMEOUT;
+  }
+
+  return ranging_finish(ranging, MIVE_RANGING_WAIT_FALL, &result);
+}
+
+static bool ranging_on_timeout(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata, void* user_data)
+{
+  mive_ranging_t* ranging = (mive_ranging_t*)user_data;
+  mive_ranging_result_t result = {0};
+  uint8_t state = ranging->state;
+
+  if(state == MIVE_RANGING_IDLE)
+  {
+    return false;
+  }
+
+  result.status = (state == MIVE_RANGING_WAIT_RISE) ? MIVE_RANGING_PING_TIMEOUT : MIVE_RANGING_ECHO_TIMEOUT;
+
+  return ranging_finish(ranging, state, &result);
+}
+
+esp_err_t mive_ranging_init(mive_ranging_t* ranging, const mive_ranging_config_t* config)
+{
+  esp_err_t retval = ESP_OK;
+
+  ranging->config = *config;
+  ranging->state = MIVE_RANGING_IDLE;
+  portMUX_INITIALIZE(&ranging->lock);
+
+  gpio_config_t trigger_config = {
+    .pin_bit_mask = 1ULL << config->trigger_pin,
+    .mode = GPIO_MODE_OUTPUT,
+  };
+  retval = gpio_config(&trigger_config);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+  gpio_set_level(config->trigger_pin, 0);
+
+  mcpwm_capture_timer_config_t cap_timer_config = {
+    .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    .group_id = 0,
+  };
+  retval = mcpwm_new_capture_timer(&cap_timer_config, &ranging->cap_timer);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  mcpwm_capture_channel_config_t cap_channel_config = {
+    .gpio_num = config->echo_pin,
+    .prescale = 1,
+    .flags.pos_edge = true,
+    .flags.neg_edge = true,
+    .flags.pull_up = true,
+  };
+  retval = mcpwm_new_capture_channel(ranging->cap_timer, &cap_channel_config, &ranging->cap_channel);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  mcpwm_capture_event_callbacks_t cap_callbacks = {
+    .on_cap = ranging_on_capture,
+  };
+  retval = mcpwm_capture_channel_register_event_callbacks(ranging->cap_channel, &cap_callbacks, ranging);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  gptimer_config_t timeout_config = {
+    .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+    .direction = GPTIMER_COUNT_UP,
+    .resolution_hz = TIMEOUT_TIMER_RESOLUTION_HZ,
+  };
+  retval = gptimer_new_timer(&timeout_config, &ranging->timeout_timer);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  gptimer_event_callbacks_t timeout_callbacks = {
+    .on_alarm = ranging_on_timeout,
+  };
+  retval = gptimer_register_event_callbacks(ranging->timeout_timer, &timeout_callbacks, ranging);
+  if(retval != ESP_OK)
+  {
+    goto end;
+  }
+
+  gptimer_alarm_config_t alarm_config = {
+    .alarm_count = MIVE_RANGING_PING_TIMEOUT_US + config->max_distance_cm * MIVE_RANGING_US_PER_CM,
+  };
+  gptimer_set_alarm_action(ranging->timeout_timer, &alarm_config);
+
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mcpwm_capture_channel_enable(ranging->cap_channel));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mcpwm_capture_timer_get_resolution(ranging->cap_timer, &ranging->cap_resolution_hz));
+  // The timers only run while a ping is in flight, see mive_ranging_release.
+  ranging->enabled = false;
+
+  return ESP_OK;
+
+end:
+  ESP_LOGE(TAG, "Error (%s) initializing ranging", esp_err_to_name(retval));
+  return retval;
+}
+
+esp_err_t mive_ranging_trigger(mive_ranging_t* ranging)
+{
+  portENTER_CRITICAL(&ranging->lock);
+  if(ranging->state != MIVE_RANGING_IDLE)
+  {
+    portEXIT_CRITICAL(&ranging->lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  ranging->state = MIVE_RANGING_WAIT_RISE;
+  portEXIT_CRITICAL(&ranging->lock);
+
+  if(!ranging->enabled)
+  {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(mcpwm_capture_timer_enable(ranging->cap_timer));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(mcpwm_capture_timer_start(ranging->cap_timer));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(gptimer_enable(ranging->timeout_timer));
+    ranging->enabled = true;
+  }
+
+  gptimer_set_raw_count(ranging->timeout_timer, 0);
+  gptimer_start(ranging->timeout_timer);
+
+  gpio_set_level(ranging->config.trigger_pin, 1);
+  esp_rom_delay_us(TRIGGER_PULSE_US);
+  gpio_set_level(ranging->config.trigger_pin, 0);
+
+  return ESP_OK;
+}
+
+void mive_ranging_release(mive_ranging_t* ranging)
+{
+  if(!ranging->enabled || ranging->state != MIVE_RANGING_IDLE)
+  {
+    return;
+  }
+
+  ESP_ERROR_CHECK_WITHOUT_ABORT(gptimer_disable(ranging->timeout_timer));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mcpwm_capture_timer_stop(ranging->cap_timer));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(mcpwm_capture_timer_disable(ranging->cap_timer));
+  ranging->enabled = false;
+}
@@ -0,0 +1,163 @@
+#include <string.h>
+
+#include "include/scheduler.h"
+
+#define TICK_US (portTICK_PERIOD_MS * 1000)
+
+static void place(mive_scheduler_t* sched, uint8_t index, const mive_sched_entry_t* entry)
+{
+  sched->heap[index] = *entry;
+  sched->slot[entry->job] = index + 1;
+}
+
+static void sift_up(mive_scheduler_t* sched, uint8_t index)
+{
+  mive_sched_entry_t entry = sched->heap[index];
+
+  while(index > 0)
+  {
+    uint8_t parent = (index - 1) / 2;
+    if(sched->heap[parent].due_us <= entry.due_us)
+    {
+      break;
+    }
+    place(sched, index, &sched->heap[parent]);
+    index = parent;
+  }
+  place(sched, index, &entry);
+}
+
+static void sift_down(mive_scheduler_t* sched, uint8_t index)
+{
+  mive_sched_entry_t entry = sched->heap[index];
+
+  while(1)
+  {
+    uint8_t child = 2 * index + 1;
+    if(child >= sched->count)
+    {
+      break;
+    }
+    if(child + 1 < sched->count && sched->heap[child + 1].due_us < sched->heap[child].due_us)
+    {
+      child++;
+    }
+    if(entry.due_us <= sched->heap[child].due_us)
+    {
+      break;
+    }
+    place(sched, index, &sched->heap[child]);
+    index = child;
+  }
+  place(sched, index, &entry);
+}
+
+// Restores the heap after the entry at index changed its deadline.
+static void fix(mive_scheduler_t* sched, uint8_t index)
+{
+  if(index > 0 && sched->heap[index].due_us < sched->heap[(index - 1) / 2].due_us)
+  {
+    sift_up(sched, index);
+  }
+  else
+  {
+    sift_down(sched, index);
+  }
+}
+
+static void remove_at(mive_scheduler_t* sched, uint8_t index)
+{
+  sched->slot[sched->heap[index].job] = 0;
+  sched->count--;
+  if(index == sched->count)
+  {
+    return;
+  }
+  place(sched, index, &sched->heap[sched->count]);
+  fix(sched, index);
+}
+
+void mive_scheduler_init(mive_scheduler_t* sched)
+{
+  memset(sched, 0, sizeof(*sched));
+}
+
+void mive_scheduler_arm(mive_scheduler_t* sched, enum mive_job_e job, int64_t now_us, uint32_t delay_us, uint32_t period_us)
+{
+  mive_sched_entry_t entry = {
+    .due_us = now_us + delay_us,
+    .period_us = period_us,
+    .job = job,
+  };
+  uint8_t index = 0;
+
+  if(sched->slot[job])
+  {
+    index = sched->slot[job] - 1;
+  }
+  else
+  {
+    index = sched->count++;
+  }
+  place(sched, index, &entry);
+  fix(sched, index);
+}
+
+void mive_scheduler_cancel(mive_scheduler_t* sched, enum mive_job_e job)
+{
+  if(sched->slot[job])
+  {
+    remove_at(sched, sched->slot[job] - 1);
+  }
+}
+
+bool mive_scheduler_is_armed(const mive_scheduler_t* sched, enum mive_job_e job)
+{
+  return sched->slot[job] != 0;
+}
+
+int mive_scheduler_take_due(mive_scheduler_t* sched, int64_t now_us, int64_t* due_us)
+{
+  mive_sched_entry_t* top = &sched->heap[0];
+  int job = -1;
+
+  if(sched->count == 0 || top->due_us > now_us)
+  {
+    return -1;
+  }
+
+  job = top->job;
+  *due_us = top->due_us;
+  if(top->period_us == 0)
+  {
+    remove_at(sched, 0);
+    return job;
+  }
+
+  top->due_us += top->period_us;
+  if(top->due_us <= now_us)
+  {
+    // Fell more than a whole period behind, skip the missed runs instead of
+    // firing them back to back.
+    top->due_us = now_us + top->period_us;
+  }
+  sift_down(sched, 0);
+  return job;
+}
+
+TickType_t mive_scheduler_timeout(const mive_scheduler_t* sched, int64_t now_us)
+{
+  int64_t remaining_us = 0;
+
+  if(sched->count == 0)
+  {
+    return portMAX_DELAY;
+  }
+
+  remaining_us = sched->heap[0].due_us - now_us;
+  if(remaining_us <= 0)
+  {
+    return 0;
+  }
+  return (remaining_us + TICK_US - 1) / TICK_US;
+}
@@ -0,0 +1,40 @@
+#include "include/seqlock.h"
+
+void mive_seqlock_init(mive_seqlock_t* lock)
+{
+  lock->seq = 0;
+  portMUX_INITIALIZE(&lock->writer);
+}
+
+void mive_seqlock_write_begin(mive_seqlock_t* lock)
+{
+  taskENTER_CRITICAL(&lock->writer);
+  __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);
+  // The odd counter is visible before any of the data changes.
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void mive_seqlock_write_end(mive_seqlock_t* lock)
+{
+  __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELEASE);
+  taskEXIT_CRITICAL(&lock->writer);
+}
+
+uint32_t mive_seqlock_read_begin(const mive_seqlock_t* lock)
+{
+  uint32_t seq = 0;
+
+  // The writer is in a critical section on the other core, a few stores away.
+  while((seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE)) & 1)
+  {
+  }
+
+  return seq;
+}
+
+bool mive_seqlock_read_retry(const mive_seqlock_t* lock, uint32_t seq)
+{
+  // The data reads complete before the counter is checked again.
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq;
+}
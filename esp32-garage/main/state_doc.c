@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "include/state_doc.h"
+#include "include/garage.h"
+#include "include/nfc.h"
+#include "include/presence.h"
+
+// JSON keys, CBOR uses the field index (plus the two header keys) instead.
+static const char* field_name[MIVE_STATE_DOC_FIELD_MAX] = {
+  [MIVE_STATE_DOC_GARAGE] = "door",
+  [MIVE_STATE_DOC_AUTH] = "auth",
+  [MIVE_STATE_DOC_DISTANCE] = "dist",
+  [MIVE_STATE_DOC_PRESENCE] = "pres",
+  [MIVE_STATE_DOC_SWITCH] = "sw",
+};
+
+#define CBOR_KEY_SEQ 0
+#define CBOR_KEY_CHANGED 1
+#define CBOR_KEY_FIELD(field) (2 + (field))
+
+void mive_state_doc_init(mive_state_doc_t* doc)
+{
+  memset(doc, 0, sizeof(*doc));
+}
+
+bool mive_state_doc_set(mive_state_doc_t* doc, enum mive_state_doc_field_e field, uint32_t value, bool valid)
+{
+  uint8_t bit = 1 << field;
+  bool was_valid = (doc->valid & bit) != 0;
+
+  if(was_valid == valid && (!valid || doc->values[field] == value))
+  {
+    return false;
+  }
+
+  doc->values[field] = value;
+  if(valid)
+  {
+    doc->valid |= bit;
+  }
+  else
+  {
+    doc->valid &= ~bit;
+  }
+  doc->changed |= bit;
+
+  return true;
+}
+
+void mive_state_doc_touch(mive_state_doc_t* doc, uint8_t mask)
+{
+  doc->changed |= mask & MIVE_STATE_DOC_ALL_FIELDS;
+}
+
+int mive_state_doc_take(mive_state_doc_t* doc, uint8_t* buf, size_t buf_len)
+{
+  int len = 0;
+
+  if(doc->changed == 0)
+  {
+    return 0;
+  }
+
+  doc->seq++;
+#if MIVE_STATE_DOC_FORMAT == MIVE_STATE_DOC_CBOR
+  len = mive_state_doc_encode_cbor(doc, doc->changed, buf, buf_len);
+#else
+  len = mive_state_doc_encode_json(doc, doc->changed, (char*)buf, buf_len);
+#endif
+  if(len < 0)
+  {
+    // Keep the changes around, nothing went out.
+    doc->seq--;
+    return len;
+  }
+  doc->changed = 0;
+
+  return len;
+}
+
+// ==== JSON ====
+
+static const char* field_str(const mive_state_doc_t* doc, enum mive_state_doc_field_e field)
+{
+  uint32_t value = doc->values[field];
+
+  switch (field)
+  {
+    case MIVE_STATE_DOC_GARAGE:
+      return mive_garage_get_state_str((enum garage_state_e)value);
+    case MIVE_STATE_DOC_AUTH:
+      return mive_nfc_get_state_str((enum mive_nfc_state)value);
+    case MIVE_STATE_DOC_PRESENCE:
+      return mive_presence_state_str((enum mive_presence_state_e)value);
+    case MIVE_STATE_DOC_SWITCH:
+      return value ? "ON" : "OFF";
+    default:
+      return NULL;
+  }
+}
+
+int mive_state_doc_encode_json(const mive_state_doc_t* doc, uint8_t changed, char* buf, size_t buf_len)
+{
+  size_t pos = 0;
+  int written = 0;
+  const char* str = NULL;
+
+  written = snprintf(buf, buf_len, "{\"seq\":%lu,\"chg\":%u", (unsigned long)doc->seq, changed);
+  if(written < 0 || (size_t)written >= buf_len)
+  {
+    return -1;
+  }
+  pos = written;
+
+  for(uint32_t i = 0; i < MIVE_STATE_DOC_FIELD_MAX; ++i)
+  {
+    str = field_str(doc, i);
+    if(!(doc->valid & (1 << i)))
+    {
+      written = snprintf(buf + pos, buf_len - pos, ",\"%s\":null", field_name[i]);
+    }
+    else if(str != NULL)
+    {
+      written = snprintf(buf + pos, buf_len - pos, ",\"%s\":\"%s\"", field_name[i], str);
+    }
+    else
+    {
+      written = snprintf(buf + pos, buf_len - pos, ",\"%s\":%lu", field_name[i], (unsigned long)doc->values[i]);
+    }
+
+    if(written < 0 || (size_t)written >= buf_len - pos)
+    {
+      return -1;
+    }
+    pos += written;
+  }
+
+  if(pos + 1 >= buf_len)
+  {
+    return -1;
+  }
+  buf[pos++] = '}';
+  buf[pos] = '\0';
+
+  return pos;
+}
+
+// ==== CBOR ====
+// Just enough of RFC 8949 for a flat map of small unsigned integers.
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_MAP 5
+#define CBOR_SIMPLE_NULL 0xf6
+
+struct cbor_writer
+{
+  uint8_t* buf;
+  size_t len;
+  size_t pos;
+  bool overflow;
+};
+
+static void cbor_put_byte(struct cbor_writer* writer, uint8_t byte)
+{
+  if(writer->pos >= writer->len)
+  {
+    writer->overflow = true;
+    return;
+  }
+  writer->buf[writer->pos++] = byte;
+}
+
+static void cbor_put_head(struct cbor_writer* writer, uint8_t major, uint32_t value)
+{
+  major <<= 5;
+
+  if(value < 24)
+  {
+    cbor_put_byte(writer, major | value);
+  }
+  else if(value <= 0xff)
+  {
+    cbor_put_byte(writer, major | 24);
+    cbor_put_byte(writer, value);
+  }
+  else if(value <= 0xffff)
+  {
+    cbor_put_byte(writer, major | 25);
+    cbor_put_byte(writer, value >> 8);
+    cbor_put_byte(writer, value);
+  }
+  else
+  {
+    cbor_put_byte(writer, major | 26);
+    cbor_put_byte(writer, value >> 24);
+    cbor_put_byte(writer, value >> 16);
+    cbor_put_byte(writer, value >> 8);
+    cbor_put_byte(writer, value);
+  }
+}
+
+int mive_state_doc_encode_cbor(const mive_state_doc_t* doc, uint8_t changed, uint8_t* buf, size_t buf_len)
+{
+  struct cbor_writer writer = {
+    .buf = buf,
+    .len = buf_len,
+  };
+
+  cbor_put_head(&writer, CBOR_MAJOR_MAP, 2 + MIVE_STATE_DOC_FIELD_MAX);
+  cbor_put_head(&writer, CBOR_MAJOR_UINT, CBOR_KEY_SEQ);
+  cbor_put_head(&writer, CBOR_MAJOR_UINT, doc->seq);
+  cbor_put_head(&writer, CBOR_MAJOR_UINT, CBOR_KEY_CHANGED);
+  cbor_put_head(&writer, CBOR_MAJOR_UINT, changed);
+
+  for(uint32_t i = 0; i < MIVE_STATE_DOC_FIELD_MAX; ++i)
+  {
+    cbor_put_head(&writer, CBOR_MAJOR_UINT, CBOR_KEY_FIELD(i));
+    if(doc->valid & (1 << i))
+    {
+      cbor_put_head(&writer, CBOR_MAJOR_UINT, doc->values[i]);
+    }
+    else
+    {
+      cbor_put_byte(&writer, CBOR_SIMPLE_NULL);
+    }
+  }
+
+  if(writer.overflow)
+  {
+    return -1;
+  }
+
+  return writer.pos;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+#include "include/sysmon.h"
+
+static const char* sysmon_tasks[] = MIVE_SYSMON_TASKS;
+static TaskHandle_t sysmon_handles[sizeof(sysmon_tasks) / sizeof(sysmon_tasks[0])];
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// Run-time counters at the previous call. Unsigned differences, so a
+// counter wrapping within one metrics window does no harm.
+static configRUN_TIME_COUNTER_TYPE sysmon_total;
+static configRUN_TIME_COUNTER_TYPE sysmon_idle[portNUM_PROCESSORS];
+static configRUN_TIME_COUNTER_TYPE sysmon_run[sizeof(sysmon_tasks) / sizeof(sysmon_tasks[0])];
+#endif
+
+// Share of elapsed, in percent.
+static uint32_t percent(uint32_t part, uint32_t elapsed)
+{
+  if(elapsed == 0)
+  {
+    return 0;
+  }
+
+  part = (part < elapsed) ? part : elapsed;
+  return (uint32_t)(((uint64_t)part * 100 + elapsed / 2) / elapsed);
+}
+
+int mive_sysmon_json(char* buf, size_t buf_len)
+{
+  size_t pos = 0;
+  int written = 0;
+  uint32_t free_bytes = 0;
+  uint32_t min_free_bytes = 0;
+  uint32_t largest_block = 0;
+  uint32_t elapsed = 0;
+  uint32_t delta = 0;
+  bool first = true;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  configRUN_TIME_COUNTER_TYPE counter = 0;
+#endif
+
+#define APPEND(...) \
+  do { \
+    written = snprintf(buf + pos, buf_len - pos, __VA_ARGS__); \
+    if(written < 0 || (size_t)written >= buf_len - pos) { return -1; } \
+    pos += written; \
+  } while(0)
+
+  // The linux target has no heap_caps, the host bench reports zeros.
+#if !CONFIG_IDF_TARGET_LINUX
+  free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  min_free_bytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#endif
+
+  APPEND(",\"mem\":{\"heap\":[%lu,%lu,%lu],\"stack\":{", (unsigned long)free_bytes,
+    (unsigned long)min_free_bytes, (unsigned long)largest_block);
+
+  for(uint32_t i = 0; i < sizeof(sysmon_tasks) / sizeof(sysmon_tasks[0]); ++i)
+  {
+    // Long-lived tasks, the handle stays valid once found.
+    if(sysmon_handles[i] == NULL)
+    {
+      sysmon_handles[i] = xTaskGetHandle(sysmon_tasks[i]);
+      if(sysmon_handles[i] == NULL)
+      {
+        continue;
+      }
+    }
+
+    APPEND("%s\"%s\":%lu", first ? "" : ",", sysmon_tasks[i],
+      (unsigned long)uxTaskGetStackHighWaterMark(sysmon_handles[i]));
+    first = false;
+  }
+  APPEND("}}");
+
+  // Load is whatever the idle task didn't get, light sleep counts as idle.
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  counter = portGET_RUN_TIME_COUNTER_VALUE();
+  elapsed = counter - sysmon_total;
+  sysmon_total = counter;
+#endif
+
+  APPEND(",\"cpu\":{\"load\":[");
+  for(uint32_t core = 0; core < portNUM_PROCESSORS; ++core)
+  {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    counter = ulTaskGetIdleRunTimeCounterForCore(core);
+    delta = counter - sysmon_idle[core];
+    sysmon_idle[core] = counter;
+#endif
+    APPEND("%s%lu", (core == 0) ? "" : ",", (unsigned long)((elapsed > 0) ? 100 - percent(delta, elapsed) : 0));
+  }
+  APPEND("],\"task\":{");
+
+  first = true;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  for(uint32_t i = 0; i < sizeof(sysmon_tasks) / sizeof(sysmon_tasks[0]); ++i)
+  {
+    if(sysmon_handles[i] == NULL)
+    {
+      continue;
+    }
+
+    counter = ulTaskGetRunTimeCounter(sysmon_handles[i]);
+    delta = counter - sysmon_run[i];
+    sysmon_run[i] = counter;
+    APPEND("%s\"%s\":%lu", first ? "" : ",", sysmon_tasks[i], (unsigned long)percent(delta, elapsed));
+    first = false;
+  }
+#endif
+  APPEND("}}");
+
+#undef APPEND
+
+  return pos;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "include/trace.h"
+
+static mive_trace_record_t trace_ring[MIVE_TRACE_RECORDS];
+// Next slot to write, only ever grows.
+static uint32_t trace_head = 0;
+
+void mive_trace(uint8_t kind, uint8_t source, uint8_t arg, uint8_t result)
+{
+  uint32_t slot = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+  mive_trace_record_t* record = &trace_ring[slot & (MIVE_TRACE_RECORDS - 1)];
+
+  record->time_us = (uint32_t)esp_timer_get_time();
+  record->kind = kind;
+  record->source = source;
+  record->arg = arg;
+  record->result = result;
+}
+
+int mive_trace_dump(uint8_t* buf, size_t buf_len)
+{
+  mive_trace_header_t header = {0};
+  uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+  uint32_t count = (head < MIVE_TRACE_RECORDS) ? head : MIVE_TRACE_RECORDS;
+  uint8_t* out = buf + sizeof(header);
+
+  if(buf_len < MIVE_TRACE_DUMP_MAX_LEN)
+  {
+    return -1;
+  }
+
+  header.magic = MIVE_TRACE_MAGIC;
+  header.version = MIVE_TRACE_VERSION;
+  header.record_size = sizeof(mive_trace_record_t);
+  header.count = count;
+  header.total = head;
+  header.dump_us = esp_timer_get_time();
+  memcpy(buf, &header, sizeof(header));
+
+  // Oldest first.
+  for(uint32_t i = head - count; i != head; ++i)
+  {
+    memcpy(out, &trace_ring[i & (MIVE_TRACE_RECORDS - 1)], sizeof(mive_trace_record_t));
+    out += sizeof(mive_trace_record_t);
+  }
+
+  return out - buf;
+}
+
+void mive_trace_dump_console(const uint8_t* buf, size_t len)
+{
+  for(size_t pos = 0; pos < len; pos += MIVE_TRACE_CONSOLE_LINE)
+  {
+    size_t line_len = (len - pos < MIVE_TRACE_CONSOLE_LINE) ? (len - pos) : MIVE_TRACE_CONSOLE_LINE;
+
+    printf("TRACE ");
+    for(size_t i = 0; i < line_len; ++i)
+    {
+      printf("%02x", buf[pos + i]);
+    }
+    printf("\n");
+  }
+}
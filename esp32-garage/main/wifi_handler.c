@@ -7,21 +7,43 @@
 #include "esp_event.h"
 #include "esp_now.h"
 #include "esp_netif_sntp.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 
 #include "include/events.h"
+#include "include/event_queue.h"
 #include "include/wifi_handler.h"
 #include "include/program.h"
+#include "include/control.h"
+#include "include/dlog.h"
+#include "include/boot.h"
 
 // Garage MAC is e8:6b:ea:fb:ef:54
 // Remote MAC is e8:6b:ea:fb:47:e8
 // Using 2.4G channel 13
 
-static const uint32_t magic_value = 0x494d4556;
-
 static mive_program_t* program_g = NULL;
 
 static int s_retry_num = 0;
 
+// Where the last connection ended up, read back at boot to skip the scan and DHCP.
+typedef struct wifi_cache_s
+{
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t valid;
+  esp_netif_ip_info_t ip_info;
+} wifi_cache_t;
+
+static wifi_cache_t s_cache = {0};
+// Filled in while connecting, stored once the connection got an IP.
+static wifi_cache_t s_cache_pending = {0};
+static wifi_config_t s_wifi_config = {0};
+static esp_netif_t* s_sta_netif = NULL;
+static esp_timer_handle_t s_reconnect_timer = NULL;
+// Time of the first disconnect of the current outage, 0 while connected.
+static int64_t s_disconnected_us = 0;
+
 static const char *TAG = "wifi_handler";
 static uint8_t s_remote_mac[ESP_NOW_ETH_ALEN] = {0xe8, 0x6b, 0xea, 0xfb, 0x47, 0xe8};
 
@@ -30,39 +52,25 @@ static const uint8_t LMK[] = {0x1b,0x3d,0x02,0xc4,0x92,0x04,0x03,0x72,0xe4,0x3f,
 
 static void example_espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len)
 {
-  mive_event_t mive_event = {0};
   uint8_t * mac_addr = recv_info->src_addr;
   uint8_t * des_addr = recv_info->des_addr;
-  uint32_t* magic_val = (uint32_t*)data;
 
   if (mac_addr == NULL || data == NULL || len <= 0) {
-    ESP_LOGE(TAG, "Receive cb arg error");
+    MIVE_DLOGE(TAG, "Receive cb arg error");
     return;
   }
 
-  if(*magic_val == magic_value)
-  { 
-    printf("Got magic val\n");
-    mive_event.event_type = MIVE_EVENT_START_GARAGE;
-    xQueueSend(program_g->main_queue, &mive_event, pdMS_TO_TICKS(10));
-  }
-  printf("ESPNOW Data from:");
-  for(uint8_t i = 0; i < 6; ++i)
-  {
-    printf(" %02x", mac_addr[i]);
-  }
-  printf(" = ");
-  for(uint8_t i = 0; i < len; ++i)
-  {
-    printf("%02x ", data[i]);
-  }
-  printf("\n");
+  mive_control_espnow_received(program_g, mac_addr, data, len);
 
+  MIVE_DLOG_DATA(MIVE_DLOG_DEBUG, TAG, MIVE_DLOG_DATA_HEX, data, len, "ESPNOW data from %02x:%02x:%02x:%02x:%02x:%02x =",
+                 mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
 }
 
 static void espnow_start()
 {
   ESP_ERROR_CHECK( esp_now_init() );
+  // Frames from anybody else are dropped, see espnow_link.h.
+  ESP_ERROR_CHECK( mive_espnow_link_add_peer(&program_g->espnow, s_remote_mac) );
   ESP_ERROR_CHECK( esp_now_register_recv_cb(example_espnow_recv_cb) );
   /* Set primary master key. */
   ESP_ERROR_CHECK( esp_now_set_pmk((uint8_t *)PMK) );
@@ -70,7 +78,7 @@ static void espnow_start()
   /* Add broadcast peer information to peer list. */
   esp_now_peer_info_t *peer = malloc(sizeof(esp_now_peer_info_t));
   memset(peer, 0, sizeof(esp_now_peer_info_t));
-  peer->channel = 13;
+  peer->channel = WIFI_CHANNEL;
   peer->ifidx = ESP_IF_WIFI_STA;
   peer->encrypt = true;
   memcpy(peer->lmk, LMK, 16);
@@ -79,30 +87,151 @@ static void espnow_start()
   free(peer);
 }
 
+static void wifi_cache_load(void)
+{
+  nvs_handle_t handle;
+  size_t len = sizeof(s_cache);
+
+  if(nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+  {
+    return;
+  }
+
+  if(nvs_get_blob(handle, "ap", &s_cache, &len) != ESP_OK || len != sizeof(s_cache))
+  {
+    memset(&s_cache, 0, sizeof(s_cache));
+  }
+  nvs_close(handle);
+}
+
+static void wifi_cache_store(const wifi_cache_t* cache)
+{
+  nvs_handle_t handle;
+
+  // Only write when something changed, this runs on every reconnect.
+  if(memcmp(cache, &s_cache, sizeof(s_cache)) == 0)
+  {
+    return;
+  }
+  s_cache = *cache;
+
+  if(nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+  {
+    return;
+  }
+  ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_set_blob(handle, "ap", &s_cache, sizeof(s_cache)));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_commit(handle));
+  nvs_close(handle);
+}
+
+// Connects straight to the cached AP on its channel, no scan needed. Also
+// keeps the radio on the ESP-NOW channel while reconnecting.
+static void wifi_config_apply(bool use_cache)
+{
+  s_wifi_config.sta.bssid_set = use_cache && s_cache.valid;
+  if(s_wifi_config.sta.bssid_set)
+  {
+    memcpy(s_wifi_config.sta.bssid, s_cache.bssid, sizeof(s_cache.bssid));
+    s_wifi_config.sta.channel = s_cache.channel;
+  }
+  else
+  {
+    s_wifi_config.sta.channel = 0;
+  }
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config));
+}
+
+static void wifi_static_ip_apply(void)
+{
+#if WIFI_STATIC_IP_FROM_CACHE
+  esp_netif_dns_info_t dns = {0};
+
+  if(!s_cache.valid || s_cache.ip_info.ip.addr == 0)
+  {
+    return;
+  }
+
+  if(esp_netif_dhcpc_stop(s_sta_netif) != ESP_OK)
+  {
+    return;
+  }
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_ip_info(s_sta_netif, &s_cache.ip_info));
+  // The broker is addressed by IP, DNS is only needed for SNTP.
+  dns.ip.u_addr.ip4 = s_cache.ip_info.gw;
+  dns.ip.type = ESP_IPADDR_TYPE_V4;
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns));
+#endif
+}
+
+static uint32_t wifi_backoff_ms(int attempt)
+{
+  uint32_t delay_ms = WIFI_BACKOFF_MIN_MS;
+
+  for(int i = 1; i < attempt && delay_ms < WIFI_BACKOFF_MAX_MS; ++i)
+  {
+    delay_ms *= 2;
+  }
+  if(delay_ms > WIFI_BACKOFF_MAX_MS)
+  {
+    delay_ms = WIFI_BACKOFF_MAX_MS;
+  }
+
+  return delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+}
+
+static void wifi_reconnect_cb(void* arg)
+{
+  esp_wifi_connect();
+}
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
   mive_program_t* program = (mive_program_t*)arg;
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
     esp_wifi_connect();
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+    wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+    memcpy(s_cache_pending.bssid, event->bssid, sizeof(s_cache_pending.bssid));
+    s_cache_pending.channel = event->channel;
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    esp_mqtt_client_disconnect(program->mqtt_client);
-    if (s_retry_num < 10) {
-      esp_wifi_connect();
-      s_retry_num++;
-      ESP_LOGI(TAG, "retry to connect to the AP");
-    } else {
-      esp_now_deinit();
-      esp_wifi_stop();
-      esp_wifi_start();
-      espnow_start();
-      s_retry_num = 0;
+    uint32_t delay_ms = 0;
+
+    if (s_disconnected_us == 0) {
+      s_disconnected_us = esp_timer_get_time();
+      esp_mqtt_client_disconnect(program->mqtt_client);
+      // Pin the AP the last connection found, only while not associated,
+      // a new config then would make the driver drop the link.
+      if (!s_wifi_config.sta.bssid_set) {
+        wifi_config_apply(true);
+      }
     }
-    ESP_LOGI(TAG,"connect to the AP fail");
+    s_retry_num++;
+
+    // The AP may have moved to another channel or been replaced.
+    if (s_retry_num == WIFI_CACHE_MAX_RETRIES && s_wifi_config.sta.bssid_set) {
+      ESP_LOGI(TAG, "cached AP unreachable, scanning");
+      wifi_config_apply(false);
+    }
+
+    // ESP-NOW stays up, only the station reconnects.
+    delay_ms = wifi_backoff_ms(s_retry_num);
+    MIVE_DLOGI(TAG, "retry %d to connect to the AP in %u ms", s_retry_num, (unsigned)delay_ms);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_timer_start_once(s_reconnect_timer, (uint64_t)delay_ms * 1000));
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
     ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+    mive_boot_mark(MIVE_BOOT_WIFI);
+    if (s_disconnected_us != 0) {
+      ESP_LOGI(TAG, "reconnected after %d attempts in %lld ms", s_retry_num, (long long)((esp_timer_get_time() - s_disconnected_us) / 1000));
+    }
+    s_disconnected_us = 0;
     s_retry_num = 0;
+
+    s_cache_pending.ip_info = event->ip_info;
+    s_cache_pending.valid = 1;
+    wifi_cache_store(&s_cache_pending);
+
     esp_mqtt_client_reconnect(program->mqtt_client);
     esp_netif_sntp_start();
   }
@@ -114,7 +243,16 @@ void wifi_init_sta(mive_program_t* program)
   ESP_ERROR_CHECK(esp_netif_init());
 
   ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
+  s_sta_netif = esp_netif_create_default_wifi_sta();
+
+  const esp_timer_create_args_t reconnect_timer_args = {
+    .callback = wifi_reconnect_cb,
+    .name = "wifi_reconnect",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &s_reconnect_timer));
+
+  wifi_cache_load();
+  wifi_static_ip_apply();
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -132,10 +270,12 @@ void wifi_init_sta(mive_program_t* program)
                                                       program,
                                                       &instance_got_ip));
 
-  wifi_config_t wifi_config = {
+  s_wifi_config = (wifi_config_t){
     .sta = {
       .ssid = WIFI_SSID,
       .password = WIFI_PWD,
+      // Take the first AP with our SSID instead of scanning all channels for the best one.
+      .scan_method = WIFI_FAST_SCAN,
       /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
         * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
         * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
@@ -145,9 +285,18 @@ void wifi_init_sta(mive_program_t* program)
     },
   };
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
+  // The cache is applied on top, the plain config is the fallback.
+  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config) );
+  wifi_config_apply(true);
   ESP_ERROR_CHECK(esp_wifi_start() );
   espnow_start();
+#if WIFI_MODEM_SLEEP
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_connectionless_module_set_wake_interval(WIFI_ESPNOW_WAKE_INTERVAL_MS));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_now_set_wake_window(WIFI_ESPNOW_WAKE_WINDOW_MS));
+#else
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_set_ps(WIFI_PS_NONE));
+#endif
   esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
   config.start = false;
   esp_netif_sntp_init(&config);
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/ws_server.h"
+
+#if MIVE_WS_ENABLE
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_http_server.h"
+#include "mbedtls/md.h"
+
+#include "include/sysmon.h"
+
+static const char *TAG = "ws";
+
+// The server task handles one frame at a time, these are never shared.
+static uint8_t frame_buf[MIVE_WS_FRAME_MAX_LEN + 1];
+static uint8_t mac_input[MIVE_WS_NONCE_LEN + MIVE_WS_FRAME_MAX_LEN];
+static uint8_t state_buf[MIVE_STATE_DOC_MAX_LEN];
+
+static const httpd_ws_type_t state_frame_type = (MIVE_STATE_DOC_FORMAT == MIVE_STATE_DOC_JSON) ? HTTPD_WS_TYPE_TEXT : HTTPD_WS_TYPE_BINARY;
+
+static int hex_value(char c)
+{
+  if(c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if(c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  if(c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static bool hex_decode(const char* hex, uint8_t* out, size_t len)
+{
+  for(size_t i = 0; i < len; ++i)
+  {
+    int high = hex_value(hex[2 * i]);
+    int low = hex_value(hex[2 * i + 1]);
+    if(high < 0 || low < 0)
+    {
+      return false;
+    }
+    out[i] = (high << 4) | low;
+  }
+
+  return true;
+}
+
+static struct mive_ws_client* client_find(mive_ws_t* ws, int fd)
+{
+  for(uint32_t i = 0; i < MIVE_WS_MAX_CLIENTS; ++i)
+  {
+    if(ws->clients[i].fd == fd)
+    {
+      return &ws->clients[i];
+    }
+  }
+
+  return NULL;
+}
+
+static esp_err_t send_text(httpd_req_t* req, const char* text)
+{
+  httpd_ws_frame_t frame = {
+    .type = HTTPD_WS_TYPE_TEXT,
+    .payload = (uint8_t*)text,
+    .len = strlen(text),
+  };
+
+  return httpd_ws_send_frame(req, &frame);
+}
+
+// Copies the latest document out, false if there is none yet. push ends the
+// queued push, the next change queues another.
+static bool take_state(mive_ws_t* ws, httpd_ws_frame_t* frame, bool push)
+{
+  taskENTER_CRITICAL(&ws->lock);
+  memcpy(state_buf, ws->state, ws->state_len);
+  frame->len = ws->state_len;
+  ws->push_queued &= !push;
+  taskEXIT_CRITICAL(&ws->lock);
+
+  frame->type = state_frame_type;
+  frame->payload = state_buf;
+  return frame->len > 0;
+}
+
+// httpd_queue_work callback, runs on the server task.
+static void push_work(void* arg)
+{
+  mive_ws_t* ws = (mive_ws_t*)arg;
+  httpd_ws_frame_t frame = {0};
+
+  if(!take_state(ws, &frame, true))
+  {
+    return;
+  }
+
+  for(uint32_t i = 0; i < MIVE_WS_MAX_CLIENTS; ++i)
+  {
+    if(ws->clients[i].fd >= 0 && ws->clients[i].subscribed)
+    {
+      httpd_ws_send_frame_async(ws->server, ws->clients[i].fd, &frame);
+    }
+  }
+}
+
+static esp_err_t client_open(mive_ws_t* ws, httpd_req_t* req)
+{
+  int fd = httpd_req_to_sockfd(req);
+  struct mive_ws_client* client = client_find(ws, fd);
+  char text[16 + MIVE_WS_NONCE_LEN * 2];
+  size_t pos = 0;
+
+  if(client == NULL)
+  {
+    client = client_find(ws, -1);
+  }
+  if(client == NULL)
+  {
+    ESP_LOGW(TAG, "No room for another client");
+    return ESP_FAIL;
+  }
+
+  client->fd = fd;
+  client->seq = 0;
+  client->subscribed = false;
+  esp_fill_random(client->nonce, sizeof(client->nonce));
+
+  pos = snprintf(text, sizeof(text), "{\"nonce\":\"");
+  for(uint32_t i = 0; i < MIVE_WS_NONCE_LEN; ++i)
+  {
+    pos += snprintf(text + pos, sizeof(text) - pos, "%02x", client->nonce[i]);
+  }
+  snprintf(text + pos, sizeof(text) - pos, "\"}");
+
+  return send_text(req, text);
+}
+
+// Checks the MAC and seq of a frame and carries it out.
+// seq is set as soon as it could be read, for the answer.
+static bool handle_frame(mive_ws_t* ws, struct mive_ws_client* client, char* text, size_t len, uint32_t* seq)
+{
+  uint8_t mac[MIVE_WS_MAC_LEN];
+  uint8_t expected[MIVE_WS_MAC_LEN];
+  uint8_t diff = 0;
+  const char* signed_text = text + MIVE_WS_MAC_LEN * 2 + 1;
+  size_t signed_len = 0;
+  char* end = NULL;
+  const char* body = NULL;
+  size_t body_len = 0;
+  const char* space = NULL;
+
+  if(len < MIVE_WS_MAC_LEN * 2 + 4 || text[MIVE_WS_MAC_LEN * 2] != ' ' || !hex_decode(text, mac, sizeof(mac)))
+  {
+    return false;
+  }
+  signed_len = len - (MIVE_WS_MAC_LEN * 2 + 1);
+
+  *seq = strtoul(signed_text, &end, 10);
+  if(end == signed_text || *end != ' ')
+  {
+    return false;
+  }
+  body = end + 1;
+  body_len = text + len - body;
+
+  // Older or repeated, the MAC doesn't matter.
+  if(*seq <= client->seq)
+  {
+    return false;
+  }
+
+  memcpy(mac_input, client->nonce, MIVE_WS_NONCE_LEN);
+  memcpy(mac_input + MIVE_WS_NONCE_LEN, signed_text, signed_len);
+  if(mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t*)MIVE_WS_KEY, strlen(MIVE_WS_KEY),
+                     mac_input, MIVE_WS_NONCE_LEN + signed_len, expected) != 0)
+  {
+    return false;
+  }
+
+  // Same time whatever byte differs.
+  for(uint32_t i = 0; i < MIVE_WS_MAC_LEN; ++i)
+  {
+    diff |= mac[i] ^ expected[i];
+  }
+  if(diff != 0)
+  {
+    return false;
+  }
+  client->seq = *seq;
+
+  if(body_len == 5 && memcmp(body, "hello", 5) == 0)
+  {
+    if(!client->subscribed)
+    {
+      client->subscribed = true;
+      __atomic_add_fetch(&ws->subscribers, 1, __ATOMIC_RELAXED);
+    }
+    return true;
+  }
+
+  // Acked only once the command is queued for main_task.
+  space = memchr(body, ' ', body_len);
+  if(space == NULL)
+  {
+    return ws->on_message(body, body_len, body + body_len, 0, ws->arg);
+  }
+
+  return ws->on_message(body, space - body, space + 1, body + body_len - (space + 1), ws->arg);
+}
+
+static esp_err_t ws_handler(httpd_req_t* req)
+{
+  mive_ws_t* ws = (mive_ws_t*)req->user_ctx;
+  struct mive_ws_client* client = NULL;
+  httpd_ws_frame_t frame = {0};
+  esp_err_t retval = ESP_OK;
+  uint32_t seq = 0;
+  bool ok = false;
+  bool subscribed = false;
+  char reply[24];
+
+  // Handshake done, the session starts with its nonce.
+  if(req->method == HTTP_GET)
+  {
+    return client_open(ws, req);
+  }
+
+  client = client_find(ws, httpd_req_to_sockfd(req));
+  if(client == NULL)
+  {
+    return ESP_FAIL;
+  }
+
+  retval = httpd_ws_recv_frame(req, &frame, 0);
+  if(retval != ESP_OK)
+  {
+    return retval;
+  }
+
+  // Anything else ends the session, ESP_FAIL closes the socket.
+  if(frame.type != HTTPD_WS_TYPE_TEXT || frame.len == 0 || frame.len > MIVE_WS_FRAME_MAX_LEN)
+  {
+    ws->rejected++;
+    return ESP_FAIL;
+  }
+
+  frame.payload = frame_buf;
+  retval = httpd_ws_recv_frame(req, &frame, frame.len);
+  if(retval != ESP_OK)
+  {
+    return retval;
+  }
+  frame_buf[frame.len] = '\0';
+
+  subscribed = client->subscribed;
+  ok = handle_frame(ws, client, (char*)frame_buf, frame.len, &seq);
+  if(ok)
+  {
+    ws->accepted++;
+  }
+  else
+  {
+    ws->rejected++;
+    ESP_LOGW(TAG, "Frame %lu refused", (unsigned long)seq);
+  }
+
+  snprintf(reply, sizeof(reply), "{\"%s\":%lu}", ok ? "ack" : "nack", (unsigned long)seq);
+  retval = send_text(req, reply);
+
+  // A new subscriber gets the current state right away.
+  if(retval == ESP_OK && !subscribed && client->subscribed && take_state(ws, &frame, false))
+  {
+    retval = httpd_ws_send_frame(req, &frame);
+  }
+
+  return retval;
+}
+
+static void ws_on_close(httpd_handle_t server, int fd)
+{
+  mive_ws_t* ws = (mive_ws_t*)httpd_get_global_user_ctx(server);
+  struct mive_ws_client* client = client_find(ws, fd);
+
+  if(client != NULL)
+  {
+    if(client->subscribed)
+    {
+      __atomic_sub_fetch(&ws->subscribers, 1, __ATOMIC_RELAXED);
+    }
+    client->fd = -1;
+    client->subscribed = false;
+  }
+
+  // With a close_fn the server leaves this to us.
+  close(fd);
+}
+
+// The context is the program's, the server must not free it.
+static void ws_keep_ctx(void* ctx)
+{
+}
+
+esp_err_t mive_ws_init(mive_ws_t* ws, mive_ws_message_cb_t on_message, void* arg)
+{
+  esp_err_t retval = ESP_OK;
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  httpd_uri_t uri = {
+    .uri = MIVE_WS_PATH,
+    .method = HTTP_GET,
+    .handler = ws_handler,
+    .user_ctx = ws,
+    .is_websocket = true,
+  };
+
+  memset(ws, 0, sizeof(*ws));
+
+  // The door is one MAC away, a guessable key opens it for the whole LAN.
+  if(strlen(MIVE_WS_KEY) < MIVE_WS_KEY_MIN_LEN || strcmp(MIVE_WS_KEY, MIVE_WS_PUBLISHED_KEY) == 0)
+  {
+    ESP_LOGW(TAG, "No CONFIG_MIVE_WS_KEY set, the local endpoint stays off");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  for(uint32_t i = 0; i < MIVE_WS_MAX_CLIENTS; ++i)
+  {
+    ws->clients[i].fd = -1;
+  }
+  portMUX_INITIALIZE(&ws->lock);
+  ws->on_message = on_message;
+  ws->arg = arg;
+
+  config.server_port = MIVE_WS_PORT;
+  config.max_open_sockets = MIVE_WS_MAX_CLIENTS;
+  // A new client pushes out the one idle the longest.
+  config.lru_purge_enable = true;
+  config.core_id = MIVE_NET_CORE;
+  config.task_priority = MIVE_WS_TASK_PRIO;
+  config.stack_size = MIVE_WS_TASK_STACK;
+  config.close_fn = ws_on_close;
+  config.global_user_ctx = ws;
+  config.global_user_ctx_free_fn = ws_keep_ctx;
+
+  retval = httpd_start(&ws->server, &config);
+  if(retval != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Error (%s) starting the server", esp_err_to_name(retval));
+    ws->server = NULL;
+    return retval;
+  }
+
+  retval = httpd_register_uri_handler(ws->server, &uri);
+  if(retval != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Error (%s) registering %s", esp_err_to_name(retval), MIVE_WS_PATH);
+  }
+
+  return retval;
+}
+
+void mive_ws_push_state(mive_ws_t* ws, const uint8_t* data, int len)
+{
+  bool queue = false;
+
+  if(ws->server == NULL || len <= 0 || len > (int)sizeof(ws->state))
+  {
+    return;
+  }
+
+  taskENTER_CRITICAL(&ws->lock);
+  memcpy(ws->state, data, len);
+  ws->state_len = len;
+  // One send in flight at a time, it picks up whatever is latest.
+  queue = !ws->push_queued && __atomic_load_n(&ws->subscribers, __ATOMIC_RELAXED) > 0;
+  ws->push_queued |= queue;
+  taskEXIT_CRITICAL(&ws->lock);
+
+  if(queue && httpd_queue_work(ws->server, push_work, ws) != ESP_OK)
+  {
+    taskENTER_CRITICAL(&ws->lock);
+    ws->push_queued = false;
+    taskEXIT_CRITICAL(&ws->lock);
+  }
+}
+
+#endif
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Decodes history replies from the garage controller (see main/include/history.h).
+
+Takes the raw payloads published on /garage/history, one after the other:
+
+    mosquitto_sub -h <broker> -t /garage/history > history.bin &
+    mosquitto_pub -h <broker> -t /garage/history/get -m "1717200000 1717286400"
+    ./history_decode.py history.bin
+
+The payload of /garage/history/get is "<from> <to>" in unix seconds, either
+may be left out for no limit.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+MAGIC = 0x4C48564D
+VERSION = 1
+HEADER = struct.Struct("<IBBHI")
+RECORD = struct.Struct("<IIBBBBHH")
+NO_CREDENTIAL = 0xFF
+
+# Mirrors enum mive_history_kind_e.
+KINDS = ["NONE", "BOOT", "DOOR", "COMMAND", "CARD_REJECTED", "FAULT"]
+
+# Mirrors enum mive_history_result_e.
+RESULTS = ["ok", "n/a", "busy"]
+
+# Mirrors enum mive_event_source_e.
+SOURCES = ["internal", "timer", "sensor", "nfc", "mqtt", "espnow", "local"]
+
+# Mirrors enum garage_state_e.
+DOOR_STATES = ["INVALID", "CLOSED", "CLOSING_STOPPED", "OPEN", "OPENING_STOPPED", "OPENING", "CLOSING"]
+
+# Mirrors enum mive_garage_command_e.
+COMMANDS = ["TOGGLE", "OPEN", "CLOSE", "STOP"]
+
+# Mirrors esp_reset_reason_t.
+RESET_REASONS = ["UNKNOWN", "POWERON", "EXT", "SW", "PANIC", "INT_WDT", "TASK_WDT", "WDT", "DEEPSLEEP", "BROWNOUT", "SDIO"]
+
+
+def lookup(table, index):
+    return table[index] if 0 <= index < len(table) else str(index)
+
+
+def describe(kind, credential, result, arg):
+    if kind == "BOOT":
+        return lookup(RESET_REASONS, arg)
+    if kind == "DOOR":
+        return lookup(DOOR_STATES, arg)
+    if kind == "COMMAND":
+        text = "%s %s" % (lookup(COMMANDS, arg), lookup(RESULTS, result))
+        if credential != NO_CREDENTIAL:
+            text += " card=%d" % credential
+        return text
+    if kind == "CARD_REJECTED":
+        return "nfc_state=%d" % arg
+    if kind == "FAULT":
+        return "failures=%d" % arg
+    return "arg=%d result=%d" % (arg, result)
+
+
+def decode(data):
+    """Yields the records of every reply in data, in order."""
+    pos = 0
+    while pos < len(data):
+        if len(data) - pos < HEADER.size:
+            raise ValueError("reply too short at offset %d" % pos)
+
+        magic, version, record_size, count, _ = HEADER.unpack_from(data, pos)
+        if magic != MAGIC:
+            raise ValueError("bad magic 0x%08x at offset %d" % (magic, pos))
+        if version != VERSION or record_size != RECORD.size:
+            raise ValueError("unsupported reply version %d, record size %d" % (version, record_size))
+        pos += HEADER.size
+        if len(data) - pos < count * record_size:
+            raise ValueError("reply truncated, expected %d records" % count)
+
+        for _ in range(count):
+            yield RECORD.unpack_from(data, pos)
+            pos += record_size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("replies", help="concatenated binary replies")
+    args = parser.parse_args()
+
+    with open(args.replies, "rb") as f:
+        data = f.read()
+
+    try:
+        for seq, time_s, kind, source, credential, result, arg, _ in decode(data):
+            kind_name = lookup(KINDS, kind)
+            stamp = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(time_s)) if time_s else "(clock unset)"
+            print("%8d  %-19s  %-8s %-14s %s" % (seq, stamp, lookup(SOURCES, source), kind_name,
+                                                describe(kind_name, credential, result, arg)))
+    except ValueError as e:
+        sys.exit("history_decode: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
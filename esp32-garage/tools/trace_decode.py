@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Decodes a trace dump from the garage controller (see main/include/trace.h).
+
+Takes either the raw payload published on /garage/trace:
+
+    mosquitto_sub -h <broker> -t /garage/trace -C 1 > trace.bin
+    mosquitto_pub -h <broker> -t /garage/trace/dump -m MQTT
+    ./trace_decode.py trace.bin
+
+or a console log containing the "TRACE ..." lines printed for a CONSOLE dump.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x5254564D
+VERSION = 1
+HEADER = struct.Struct("<IBBHIIQ")
+RECORD = struct.Struct("<IBBBB")
+
+# Mirrors enum mive_trace_kind_e.
+KINDS = [
+    "NONE",
+    "EVENT_SENT",
+    "EVENT_BEGIN",
+    "EVENT_END",
+    "MQTT_CONNECTION",
+    "MQTT_COMMAND",
+    "NFC_CARD",
+    "ESPNOW_RX",
+    "ACTUATE",
+    "DOOR_STATE",
+]
+
+# Mirrors enum mive_espnow_rx_e.
+ESPNOW_RX = ["invalid", "legacy", "new", "duplicate", "stale", "unknown_peer"]
+
+# Mirrors enum mive_event_source_e.
+SOURCES = ["internal", "timer", "sensor", "nfc", "mqtt", "espnow", "local"]
+
+# Mirrors enum mive_event_e.
+EVENTS = [
+    "NONE",
+    "GET_GARAGE_INFO",
+    "SEND_GARAGE_INFO",
+    "SEND_AUTH_STATE",
+    "START_GARAGE",
+    "MEASURE_DISTANCE",
+    "REGISTER_CARD",
+    "MQTT_CONNECTED",
+    "SAVE_UUID",
+    "RESET_GARAGE_SWITCH",
+    "DISTANCE_READY",
+    "SEND_PRESENCE",
+    "SEND_STATE_DOC",
+    "PUBLISH_METRICS",
+    "DUMP_TRACE",
+    "NFC_DUTY",
+    "NFC_FIELD",
+    "GARAGE_DONE",
+    "CARD_REJECTED",
+    "HISTORY_FLUSH",
+    "HISTORY_QUERY",
+    "ENROLL_CARD",
+    "CARD_REMOVED",
+    "NET_DRAINED",
+    "CHECK_CARD",
+    "LOAD_CREDENTIALS",
+]
+
+# Mirrors enum garage_state_e.
+DOOR_STATES = ["INVALID", "CLOSED", "CLOSING_STOPPED", "OPEN", "OPENING_STOPPED", "OPENING", "CLOSING"]
+
+# Mirrors enum mive_garage_command_e, plus the router's special values.
+COMMANDS = {0: "TOGGLE", 1: "OPEN", 2: "CLOSE", 3: "STOP", -1: "NO_MATCH", -2: "IGNORE"}
+
+EVENT_KINDS = ("EVENT_SENT", "EVENT_BEGIN", "EVENT_END")
+
+
+def lookup(table, index):
+    if isinstance(table, dict):
+        return table.get(index, str(index))
+    return table[index] if 0 <= index < len(table) else str(index)
+
+
+def signed8(value):
+    return value - 256 if value > 127 else value
+
+
+def describe(kind, arg, result):
+    if kind in EVENT_KINDS:
+        text = lookup(EVENTS, arg)
+        if kind == "EVENT_SENT" and not result:
+            text += " DROPPED"
+        return text
+    if kind == "MQTT_CONNECTION":
+        return "connected" if arg else "disconnected"
+    if kind in ("MQTT_COMMAND", "ACTUATE"):
+        return "%s %s" % (lookup(COMMANDS, signed8(arg)), "accepted" if result else "rejected")
+    if kind == "NFC_CARD":
+        return "nfc_state=%d %s" % (arg, "known" if result else "unknown")
+    if kind == "ESPNOW_RX":
+        return "len=%d %s" % (arg, lookup(ESPNOW_RX, result))
+    if kind == "DOOR_STATE":
+        return lookup(DOOR_STATES, arg)
+    return "arg=%d result=%d" % (arg, result)
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if len(data) >= 4 and struct.unpack_from("<I", data)[0] == MAGIC:
+        return data
+
+    # Console log, pick the hex out of the TRACE lines.
+    hex_data = []
+    for line in data.decode("utf-8", errors="replace").splitlines():
+        pos = line.find("TRACE ")
+        if pos >= 0:
+            hex_data.append(line[pos + 6:].strip())
+    return bytes.fromhex("".join(hex_data))
+
+
+def decode(data):
+    if len(data) < HEADER.size:
+        raise ValueError("dump too short")
+
+    magic, version, record_size, count, total, _, dump_us = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError("bad magic 0x%08x" % magic)
+    if version != VERSION or record_size != RECORD.size:
+        raise ValueError("unsupported dump version %d, record size %d" % (version, record_size))
+    if len(data) < HEADER.size + count * record_size:
+        raise ValueError("dump truncated, expected %d records" % count)
+
+    records = [RECORD.unpack_from(data, HEADER.size + i * record_size) for i in range(count)]
+
+    # Walk back from the dump time to widen the 32 bit timestamps. Anything
+    # newer than the record after it was overwritten while the dump ran.
+    decoded = []
+    anchor = dump_us
+    torn = 0
+    for time_us, kind, source, arg, result in reversed(records):
+        full_us = anchor - ((anchor - time_us) & 0xFFFFFFFF)
+        if full_us > anchor:
+            torn += 1
+            continue
+        anchor = full_us
+        decoded.append((full_us, kind, source, arg, result))
+    decoded.reverse()
+
+    return dump_us, total, torn, decoded
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="binary dump or console log")
+    args = parser.parse_args()
+
+    try:
+        dump_us, total, torn, records = decode(read_dump(args.dump))
+    except ValueError as e:
+        sys.exit("trace_decode: %s" % e)
+
+    print("# dump at %.6f s, %d records since boot, %d shown, %d torn" % (dump_us / 1e6, total, len(records), torn))
+    previous_us = None
+    for time_us, kind, source, arg, result in records:
+        kind_name = lookup(KINDS, kind)
+        delta = "" if previous_us is None else "+%d" % (time_us - previous_us)
+        print("%14.6f %10s  %-8s %-16s %s" % (time_us / 1e6, delta, lookup(SOURCES, source), kind_name, describe(kind_name, arg, result)))
+        previous_us = time_us
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""Talks to the local WebSocket endpoint of the garage controller (see
+main/include/ws_server.h), no broker involved.
+
+    export GARAGE_WS_KEY=<CONFIG_MIVE_WS_KEY>
+    ./ws_client.py <host> watch
+    ./ws_client.py <host> send /garage/door/1/set OPEN
+    ./ws_client.py <host> send /garage/door/1/set TOGGLE --repeat 10
+
+watch prints every state document pushed by the controller. send signs the
+command, waits for the ack and for the next state document, and prints both
+latencies in milliseconds.
+"""
+
+import argparse
+import base64
+import hashlib
+import hmac
+import json
+import os
+import socket
+import struct
+import sys
+import time
+
+DEFAULT_PATH = "/ws"
+
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+
+class Session:
+    def __init__(self, host, port, path, key, timeout):
+        self.key = key.encode()
+        self.seq = 0
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b""
+        self._handshake(host, path)
+
+        opcode, payload = self.recv()
+        self.nonce = bytes.fromhex(json.loads(payload)["nonce"])
+
+    def _handshake(self, host, path):
+        challenge = base64.b64encode(os.urandom(16)).decode()
+        request = (
+            "GET %s HTTP/1.1\r\n"
+            "Host: %s\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: %s\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n" % (path, host, challenge)
+        )
+        self.sock.sendall(request.encode())
+
+        while b"\r\n\r\n" not in self.buf:
+            chunk = self.sock.recv(1024)
+            if not chunk:
+                raise ConnectionError("connection closed during the handshake")
+            self.buf += chunk
+        header, self.buf = self.buf.split(b"\r\n\r\n", 1)
+        if b" 101 " not in header.split(b"\r\n", 1)[0]:
+            raise ConnectionError("handshake refused: %s" % header.split(b"\r\n", 1)[0].decode(errors="replace"))
+
+    def _read(self, length):
+        while len(self.buf) < length:
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise ConnectionError("connection closed")
+            self.buf += chunk
+        data, self.buf = self.buf[:length], self.buf[length:]
+        return data
+
+    def _send_frame(self, opcode, payload):
+        # Client frames are always masked.
+        mask = os.urandom(4)
+        header = bytes([0x80 | opcode])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        else:
+            header += bytes([0x80 | 126]) + struct.pack(">H", len(payload))
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        self.sock.sendall(header + mask + masked)
+
+    def recv(self):
+        while True:
+            first, second = self._read(2)
+            opcode = first & 0x0F
+            length = second & 0x7F
+            if length == 126:
+                length = struct.unpack(">H", self._read(2))[0]
+            elif length == 127:
+                length = struct.unpack(">Q", self._read(8))[0]
+            payload = self._read(length)
+
+            if opcode == OP_PING:
+                self._send_frame(OP_PONG, payload)
+            elif opcode == OP_CLOSE:
+                raise ConnectionError("closed by the controller")
+            else:
+                return opcode, payload
+
+    def send(self, body):
+        self.seq += 1
+        signed = ("%d %s" % (self.seq, body)).encode()
+        mac = hmac.new(self.key, self.nonce + signed, hashlib.sha256).hexdigest()
+        self._send_frame(OP_TEXT, mac.encode() + b" " + signed)
+        return self.seq
+
+    # Waits for the answer to seq, state documents arriving meanwhile are
+    # returned along with it.
+    def wait_reply(self, seq):
+        states = []
+        while True:
+            opcode, payload = self.recv()
+            if opcode == OP_TEXT and (payload.startswith(b'{"ack"') or payload.startswith(b'{"nack"')):
+                reply = json.loads(payload)
+                if reply.get("ack", reply.get("nack")) == seq:
+                    return "ack" in reply, states
+            else:
+                states.append(payload)
+
+
+def show_state(payload):
+    try:
+        return payload.decode()
+    except UnicodeDecodeError:
+        # CBOR documents, MIVE_STATE_DOC_FORMAT.
+        return payload.hex()
+
+
+def watch(session):
+    ok, states = session.wait_reply(session.send("hello"))
+    if not ok:
+        sys.exit("ws_client: hello refused, check the key")
+    for payload in states:
+        print(show_state(payload), flush=True)
+    while True:
+        opcode, payload = session.recv()
+        print(show_state(payload), flush=True)
+
+
+def send(session, topic, payload, repeat):
+    ok, states = session.wait_reply(session.send("hello"))
+    if not ok:
+        sys.exit("ws_client: hello refused, check the key")
+    # The current document comes right after the ack, if there is one yet.
+    try:
+        if not states:
+            session.recv()
+    except socket.timeout:
+        pass
+
+    for _ in range(repeat):
+        start = time.monotonic()
+        ok, states = session.wait_reply(session.send("%s %s" % (topic, payload)))
+        ack_ms = (time.monotonic() - start) * 1000
+        if not ok:
+            sys.exit("ws_client: command %d refused" % session.seq)
+
+        # A command that changes nothing leaves the document alone.
+        state_ms = None
+        try:
+            if not states:
+                session.recv()
+            state_ms = (time.monotonic() - start) * 1000
+        except socket.timeout:
+            pass
+
+        print("seq %d ack %.1f ms state %s" % (session.seq, ack_ms, "-" if state_ms is None else "%.1f ms" % state_ms), flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host", help="controller address")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--path", default=DEFAULT_PATH)
+    parser.add_argument("--key", default=os.environ.get("GARAGE_WS_KEY"), help="CONFIG_MIVE_WS_KEY, defaults to $GARAGE_WS_KEY")
+    parser.add_argument("--timeout", type=float, default=5.0, help="seconds to wait for an answer")
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("watch", help="print every state document")
+    send_parser = commands.add_parser("send", help="send a command, e.g. /garage/door/1/set OPEN")
+    send_parser.add_argument("topic")
+    send_parser.add_argument("payload", nargs="?", default="")
+    send_parser.add_argument("--repeat", type=int, default=1)
+    args = parser.parse_args()
+    if not args.key:
+        parser.error("no key, pass --key or set GARAGE_WS_KEY")
+
+    try:
+        session = Session(args.host, args.port, args.path, args.key, args.timeout)
+        if args.command == "watch":
+            session.sock.settimeout(None)
+            watch(session)
+        else:
+            send(session, args.topic, args.payload, args.repeat)
+    except (OSError, ConnectionError, ValueError, KeyError) as e:
+        sys.exit("ws_client: %s" % e)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -22,6 +22,8 @@
 #include "iot_button.h"
 #include "button_gpio.h"
 
+#include "mive_espnow_proto.h"
+
 // Garage MAC is e8:6b:ea:fb:ef:54
 // Remote MAC is e8:6b:ea:fb:47:e8
 // Using 2.4G channel 13
@@ -29,7 +31,8 @@
 #define ESPNOW_MAXDELAY 512
 #define IS_BROADCAST_ADDR(addr) (memcmp(addr, s_example_broadcast_mac, ESP_NOW_ETH_ALEN) == 0)
 
-static const uint32_t magic_value = 0x494d4556;
+#define REMOTE_NVS_NAMESPACE "remote"
+#define REMOTE_NVS_BOOT_KEY "boot"
 
 static QueueHandle_t s_example_espnow_queue = NULL;
 
@@ -42,11 +45,19 @@ static uint8_t s_example_broadcast_mac[ESP_NOW_ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0
 
 static uint8_t s_garage_mac[ESP_NOW_ETH_ALEN] = {0xe8, 0x6b, 0xea, 0xfb, 0xef, 0x54};
 
-struct remote_data {
-    uint32_t data;
-};
+typedef enum {
+    REMOTE_EVENT_PRESS = 0,
+    REMOTE_EVENT_ACK,
+} remote_event_type_t;
+
+typedef struct {
+    remote_event_type_t type;
+    mive_espnow_frame_t frame;
+} example_espnow_event_t;
 
-typedef uint32_t example_espnow_event_t;
+// Boot number, goes into every command so the garage can tell a reboot
+// (seq starts over) from a replayed press.
+static uint32_t s_boot_counter = 0;
 
 static void example_espnow_task(void *pvParameter);
 
@@ -72,15 +83,37 @@ static void example_espnow_recv_cb(const esp_now_recv_info_t *recv_info, const u
         return;
     }
 
-    if (IS_BROADCAST_ADDR(des_addr)) {
-        /* If added a peer with encryption before, the receive packets may be
-         * encrypted as peer-to-peer message or unencrypted over the broadcast channel.
-         * Users can check the destination address to distinguish it.
-         */
-        ESP_LOGD(TAG, "Receive broadcast ESPNOW data");
-    } else {
-        ESP_LOGD(TAG, "Receive unicast ESPNOW data");
+    if (IS_BROADCAST_ADDR(des_addr) || memcmp(mac_addr, s_garage_mac, ESP_NOW_ETH_ALEN) != 0) {
+        return;
+    }
+
+    example_espnow_event_t event = {
+        .type = REMOTE_EVENT_ACK,
+    };
+    if (mive_espnow_frame_parse(data, len, &event.frame) && event.frame.type == MIVE_ESPNOW_TYPE_ACK) {
+        /* Runs in the Wi-Fi task, hand the ACK over without blocking. */
+        xQueueSend(s_example_espnow_queue, &event, 0);
+    }
+}
+
+static void remote_load_boot_counter(void)
+{
+    nvs_handle_t handle;
+    uint32_t counter = 0;
+
+    if (nvs_open(REMOTE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Can't open NVS, boot counter stays at 0");
+        return;
     }
+
+    nvs_get_u32(handle, REMOTE_NVS_BOOT_KEY, &counter);
+    counter++;
+    ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_set_u32(handle, REMOTE_NVS_BOOT_KEY, counter));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_commit(handle));
+    nvs_close(handle);
+
+    s_boot_counter = counter;
+    ESP_LOGI(TAG, "Boot %"PRIu32, s_boot_counter);
 }
 
 static esp_err_t example_espnow_init(void)
@@ -111,7 +144,8 @@ static esp_err_t example_espnow_init(void)
     ESP_ERROR_CHECK( esp_now_add_peer(peer) );
     free(peer);
 
-    xTaskCreate(example_espnow_task, "example_espnow_task", 2048, NULL, 4, NULL);
+    /* Above the button timer task, a press goes out as soon as it is queued. */
+    xTaskCreate(example_espnow_task, "example_espnow_task", 3072, NULL, configMAX_PRIORITIES - 2, NULL);
 
     return ESP_OK;
 }
@@ -119,15 +153,39 @@ static esp_err_t example_espnow_init(void)
 static void button_event_cb(void *arg, void *data)
 {
     button_event_t event = iot_button_get_event(arg);
-    ESP_LOGI(TAG, "%s", iot_button_get_event_str(event));
-    if (BUTTON_PRESS_REPEAT == event || BUTTON_PRESS_REPEAT_DONE == event) {
-        ESP_LOGI(TAG, "\tREPEAT[%d]", iot_button_get_repeat(arg));
+
+    /* One press, one command. PRESS_DOWN is the earliest debounced edge,
+     * everything after it (UP, long press, repeats) is ignored. */
+    if (BUTTON_PRESS_DOWN == event) {
+        example_espnow_event_t mive_event = {
+            .type = REMOTE_EVENT_PRESS,
+        };
+        xQueueSend(s_example_espnow_queue, &mive_event, 0);
     }
+}
+
+static void remote_send_command(mive_espnow_frame_t *frame)
+{
+    esp_err_t ret = esp_now_send(s_garage_mac, (uint8_t *)frame, sizeof(*frame));
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "seq %u attempt %u not sent (%s)", frame->seq, frame->attempt, esp_err_to_name(ret));
+    }
+}
+
+static void remote_handle_ack(const mive_espnow_frame_t *ack, int64_t sent_us)
+{
+    int64_t rtt_us = esp_timer_get_time() - sent_us;
 
-    if (BUTTON_PRESS_UP == event || BUTTON_LONG_PRESS_HOLD == event || BUTTON_LONG_PRESS_UP == event) {
-        example_espnow_event_t mive_event = 1;
-        xQueueSend(s_example_espnow_queue, &mive_event, pdMS_TO_TICKS(50));
-        ESP_LOGI(TAG, "\tPressed Time[%"PRIu32"]", iot_button_get_pressed_time(arg));
+    switch (ack->result) {
+    case MIVE_ESPNOW_RESULT_ACTUATED:
+        ESP_LOGI(TAG, "seq %u actuated, door state %u, attempt %u, %"PRIi64" us", ack->seq, ack->state, ack->attempt, rtt_us);
+        break;
+    case MIVE_ESPNOW_RESULT_NOT_APPLICABLE:
+        ESP_LOGI(TAG, "seq %u not applicable, door state %u", ack->seq, ack->state);
+        break;
+    default:
+        ESP_LOGW(TAG, "seq %u result %u", ack->seq, ack->result);
+        break;
     }
 }
 
@@ -135,7 +193,18 @@ static void button_event_cb(void *arg, void *data)
 void example_espnow_task(void *pvParameter)
 {
     example_espnow_event_t event;
-    struct remote_data data = {0};
+    mive_espnow_frame_t frame = {
+        .magic = MIVE_ESPNOW_MAGIC,
+        .version = MIVE_ESPNOW_VERSION,
+        .type = MIVE_ESPNOW_TYPE_COMMAND,
+        .command = MIVE_ESPNOW_CMD_TOGGLE,
+    };
+    bool pending = false;
+    int64_t sent_us = 0;
+    int64_t retry_us = 0;
+    int64_t deadline_us = 0;
+    /* Wait before resending after a BUSY, doubles with every one. */
+    uint32_t busy_ms = MIVE_ESPNOW_RETRY_MS;
     button_handle_t btn = NULL;
     const button_config_t btn_cfg = {0};
     const button_gpio_config_t btn_gpio_cfg = {
@@ -144,15 +213,54 @@ void example_espnow_task(void *pvParameter)
     };
     iot_button_new_gpio_device(&btn_cfg, &btn_gpio_cfg, &btn);
     iot_button_register_cb(btn, BUTTON_PRESS_DOWN, NULL, button_event_cb, NULL);
-    iot_button_register_cb(btn, BUTTON_PRESS_UP, NULL, button_event_cb, NULL);
 
 
+    frame.counter = s_boot_counter;
+
     while(1)
     {
-        if(xQueueReceive(s_example_espnow_queue, &event, pdMS_TO_TICKS(1000)) == pdTRUE)
+        TickType_t wait = portMAX_DELAY;
+        if (pending) {
+            int64_t left_us = retry_us - esp_timer_get_time();
+            /* Round up, waking early would only spin until the retry is due. */
+            wait = (left_us > 0) ? (left_us / 1000 + portTICK_PERIOD_MS) / portTICK_PERIOD_MS : 0;
+        }
+
+        if(xQueueReceive(s_example_espnow_queue, &event, wait) == pdTRUE)
         {
-            data.data = magic_value;
-            esp_now_send((uint8_t*)&s_garage_mac, (uint8_t*)&data, sizeof(data));
+            if (event.type == REMOTE_EVENT_PRESS) {
+                /* A new press supersedes one still waiting for its ACK. */
+                frame.seq++;
+                frame.attempt = 0;
+                sent_us = esp_timer_get_time();
+                deadline_us = sent_us + MIVE_ESPNOW_DEADLINE_MS * 1000;
+                retry_us = sent_us + MIVE_ESPNOW_RETRY_MS * 1000;
+                busy_ms = MIVE_ESPNOW_RETRY_MS;
+                pending = true;
+                remote_send_command(&frame);
+            } else if (pending && event.frame.counter == frame.counter && event.frame.seq == frame.seq) {
+                if (event.frame.result == MIVE_ESPNOW_RESULT_BUSY) {
+                    /* Not accepted, the door is still busy with the last
+                     * pulse. Give it time before asking again. */
+                    retry_us = esp_timer_get_time() + busy_ms * 1000;
+                    busy_ms *= 2;
+                } else {
+                    pending = false;
+                    remote_handle_ack(&event.frame, sent_us);
+                }
+            }
+        }
+
+        if (pending && esp_timer_get_time() >= retry_us) {
+            int64_t now = esp_timer_get_time();
+            if (now >= deadline_us) {
+                ESP_LOGW(TAG, "seq %u: no ACK after %u attempts", frame.seq, frame.attempt + 1);
+                pending = false;
+            } else {
+                frame.attempt++;
+                retry_us = now + MIVE_ESPNOW_RETRY_MS * 1000;
+                remote_send_command(&frame);
+            }
         }
     }
 
@@ -166,6 +274,7 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK( ret );
+    remote_load_boot_counter();
     example_wifi_init();
     example_espnow_init();
 }